@@ -7,10 +7,12 @@
  * - Service API structure and function interception
  * - Plugin API header format
  * - Emulating a plugin that calls service functions
+ * - Batched I2C transactions on a reference device model
  */
 #include <stdio.h>
 #include <string.h>
 #include "arm_emulator.h"
+#include "arm_i2c.h"
 #include "plugin_api.h"
 
 /*
@@ -34,18 +36,16 @@ static uint8_t data_memory[DATA_SIZE];
 /* Simulated service API at address 0x300 */
 static struct service_api sim_service_api;
 
-/* Simulated uptime counter */
-static uint32_t uptime_ms = 1000;
+/* Reference I2C device: TDA9984-like, 2 pages of registers at 0x70 */
+static uint8_t hdmi_registers[2 * 256];
+static struct arm_i2c_device i2c_devices[] = {
+    { 0x70, 2, hdmi_registers, 0, 0 }
+};
+static struct arm_i2c_bus i2c_bus = { i2c_devices, 1, 0 };
 
 /*
  * Service function implementations (called via callback)
  */
-static uint32_t sim_get_uptime(void)
-{
-    uptime_ms += 16;  /* Simulate ~16ms resolution */
-    return uptime_ms;
-}
-
 static void sim_debug_writeln(const char *s, uint16_t length)
 {
     printf("[PLUGIN DEBUG] %.*s\n", length, s);
@@ -65,25 +65,21 @@ int arm_emulator_callback_functioncall(
 {
     /* Check if calling GetUptime (offset 4 in service_api after header) */
     if (function_address == (uint32_t)(uintptr_t)sim_service_api.GetUptime) {
-        state->R[0] = sim_get_uptime();
+        /* Virtual clock, derived from executed instructions */
+        state->R[0] = arm_emulator_get_uptime(state);
         printf("  Service: GetUptime() -> %u\n", state->R[0]);
         return 0;
     }
 
     /* Check if calling DebugWriteLine */
     if (function_address == (uint32_t)(uintptr_t)sim_service_api.DebugWriteLine) {
-        /* R0 = string pointer, R1 = length */
-        uint32_t str_addr = state->R[0];
+        /* R0 = string pointer, R1 = length; the string is used in place,
+           in data memory or in .plugin.rodata */
         uint16_t length = (uint16_t)state->R[1];
-        char buffer[256];
+        const uint8_t *s = arm_emulator_host_pointer(state, state->R[0], length);
 
-        if (length > sizeof(buffer) - 1) length = sizeof(buffer) - 1;
-
-        /* Read string from emulator memory */
-        if (str_addr >= DATA_BASE && str_addr < DATA_BASE + DATA_SIZE) {
-            memcpy(buffer, &data_memory[str_addr - DATA_BASE], length);
-            buffer[length] = '\0';
-            sim_debug_writeln(buffer, length);
+        if (s != NULL) {
+            sim_debug_writeln((const char *)s, length);
         }
         return 0;
     }
@@ -91,17 +87,11 @@ int arm_emulator_callback_functioncall(
     /* Check if calling DebugWriteLineHex32 */
     if (function_address == (uint32_t)(uintptr_t)sim_service_api.DebugWriteLineHex32) {
         /* R0 = string pointer, R1 = length, R2 = hex value */
-        uint32_t str_addr = state->R[0];
         uint16_t length = (uint16_t)state->R[1];
-        uint32_t value = state->R[2];
-        char buffer[256];
-
-        if (length > sizeof(buffer) - 1) length = sizeof(buffer) - 1;
+        const uint8_t *s = arm_emulator_host_pointer(state, state->R[0], length);
 
-        if (str_addr >= DATA_BASE && str_addr < DATA_BASE + DATA_SIZE) {
-            memcpy(buffer, &data_memory[str_addr - DATA_BASE], length);
-            buffer[length] = '\0';
-            sim_debug_writeln_hex32(buffer, length, value);
+        if (s != NULL) {
+            sim_debug_writeln_hex32((const char *)s, length, state->R[2]);
         }
         return 0;
     }
@@ -144,9 +134,9 @@ int arm_emulator_callback_read_program_memory(
  */
 static void init_service_api(void)
 {
-    sim_service_api.version_major = 1;
-    sim_service_api.version_minor = 0;
-    sim_service_api.function_count = 7;
+    sim_service_api.version_major = SERVICE_API_VERSION_MAJOR;
+    sim_service_api.version_minor = SERVICE_API_VERSION_MINOR;
+    sim_service_api.function_count = SERVICE_API_FUNCTION_COUNT;
 
     /* Use distinctive addresses that we'll intercept */
     sim_service_api.GetUptime = (service_get_uptime_t)0x1001;
@@ -156,6 +146,27 @@ static void init_service_api(void)
     sim_service_api.WriteScreenDecimal = (service_write_screen_decimal_t)0x1005;
     sim_service_api.WriteI2C = (service_write_i2c_t)0x1006;
     sim_service_api.ReadI2C = (service_read_i2c_t)0x1007;
+
+    /* Version 1.1, run natively (registered in main) */
+    sim_service_api.MemCopy = (service_mem_copy_t)0x1011;
+    sim_service_api.MemSet = (service_mem_set_t)0x1013;
+    sim_service_api.MemCompare = (service_mem_compare_t)0x1015;
+    sim_service_api.Crc32 = (service_crc32_t)0x1017;
+
+    /* Version 1.2 */
+    sim_service_api.I2CTransaction = (service_i2c_transaction_t)0x1019;
+}
+
+/* Store a struct service_i2c_op in plugin data memory */
+static void put_i2c_op(uint32_t address, uint32_t address_page_register,
+    uint32_t data, uint16_t nbytes, uint8_t direction)
+{
+    uint8_t *p = &data_memory[address - DATA_BASE];
+    memcpy(p, &address_page_register, 4);
+    memcpy(p + 4, &data, 4);
+    memcpy(p + 8, &nbytes, 2);
+    p[10] = direction;
+    p[11] = 0;
 }
 
 int main(void)
@@ -187,11 +198,28 @@ int main(void)
         0x0300, 0x0000,  /* SERVICE_API_ADDRESS = 0x00000300 */
     };
 
+    /*
+     * Second entry point at PROGRAM_BASE + 0x20: write three registers
+     * and read them back in one I2CTransaction call.
+     */
+    const uint16_t i2c_code[] = {
+        0xb500,  /* PUSH {LR} */
+        0x4802,  /* LDR R0, [PC, #8] - ops */
+        0x2102,  /* MOVS R1, #2 - count */
+        0x4a02,  /* LDR R2, [PC, #8] - I2CTransaction */
+        0x4790,  /* BLX R2 */
+        0xbd00,  /* POP {PC} */
+        /* Literal pool */
+        (DATA_BASE + 0x40) & 0xFFFF, (DATA_BASE + 0x40) >> 16,
+        0x1019, 0x0000,
+    };
+
     /* Initialize */
     init_service_api();
     memset(program_memory, 0, sizeof(program_memory));
     memset(data_memory, 0, sizeof(data_memory));
     memcpy(program_memory, code, sizeof(code));
+    memcpy(program_memory + 0x20, i2c_code, sizeof(i2c_code));
 
     /* Put a test string in data memory */
     const char *test_msg = "Hello from plugin!";
@@ -210,6 +238,13 @@ int main(void)
         data_memory, DATA_BASE, sizeof(data_memory),
         (uint8_t *)&sim_service_api, SERVICE_API_ADDRESS, sizeof(struct service_api)
     );
+    arm_emulator_set_clock(&emu, ARM_CLOCK_INSTRUCTIONS_PER_MS, 1000);
+    arm_emulator_register_native(&emu, (uint32_t)(uintptr_t)sim_service_api.MemCopy, arm_emulator_native_mem_copy);
+    arm_emulator_register_native(&emu, (uint32_t)(uintptr_t)sim_service_api.MemSet, arm_emulator_native_mem_set);
+    arm_emulator_register_native(&emu, (uint32_t)(uintptr_t)sim_service_api.MemCompare, arm_emulator_native_mem_compare);
+    arm_emulator_register_native(&emu, (uint32_t)(uintptr_t)sim_service_api.Crc32, arm_emulator_native_crc32);
+    arm_emulator_register_native(&emu, (uint32_t)(uintptr_t)sim_service_api.I2CTransaction, arm_i2c_native_transaction);
+    arm_i2c_attach(&emu, &i2c_bus);
 
     printf("Calling plugin entry point...\n\n");
     arm_emulator_start_function_call(&emu, (void *)(PROGRAM_BASE + 1), NULL, 0);
@@ -223,5 +258,26 @@ int main(void)
         printf("\nExecution error: %d\n", result);
     }
 
+    /* Batched I2C: write page 1, registers 0x10-0x12, then read them back */
+    data_memory[0x60] = 0x12;
+    data_memory[0x61] = 0x34;
+    data_memory[0x62] = 0x56;
+    put_i2c_op(DATA_BASE + 0x40, MAKE_ADDRESS_PAGE_REGISTER(0x70, 1, 0x10),
+        DATA_BASE + 0x60, 3, SERVICE_I2C_WRITE);
+    put_i2c_op(DATA_BASE + 0x40 + SERVICE_I2C_OP_SIZE, MAKE_ADDRESS_PAGE_REGISTER(0x70, 1, 0x10),
+        DATA_BASE + 0x70, 3, SERVICE_I2C_READ);
+
+    printf("\nCalling I2C entry point...\n\n");
+    arm_emulator_start_function_call(&emu, (void *)(PROGRAM_BASE + 0x20 + 1), NULL, 0);
+    result = arm_emulator_execute(&emu, 100);
+
+    if (result == ARM_EMULATOR_FUNCTION_RETURNED) {
+        printf("\nI2CTransaction returned %d, %u transfers, read back %02X %02X %02X\n",
+            (int)arm_emulator_get_function_return_value(&emu), i2c_bus.transfers,
+            data_memory[0x70], data_memory[0x71], data_memory[0x72]);
+    } else {
+        printf("\nExecution error: %d\n", result);
+    }
+
     return 0;
 }
@@ -0,0 +1,339 @@
+// SPDX-License-Identifier: MIT
+/** \file Static control flow recovery. */
+#include "arm_cfg.h"
+#include <stddef.h>	// NULL, offsetof
+#include <string.h>	// memcpy, memset
+#include "arm_decode.h"
+#include "plugin_api.h"	// struct plugin_api layout.
+
+/** Map bit of a leader whose path has not been followed yet. */
+#define PENDING	0x80
+
+//================================================================================================================
+/* Mark a branch target or entry point; the path from there is followed later. */
+static void
+_mark(
+	const struct arm_emulator_state *emu,
+	struct arm_cfg *cfg,
+	uint32_t address,
+	uint8_t bits)
+{
+	const uint32_t offset = (address & 0xFFFFFFFE) - emu->program_address;
+	if (offset < emu->program_size && offset + 2 <= emu->program_size)
+	{
+		uint8_t *m = &cfg->map[offset / 2];
+		*m |= bits | ((*m & ARM_CFG_CODE) == 0 ? PENDING : 0);
+	}
+}
+
+//================================================================================================================
+static void
+_mark_literal(
+	const struct arm_emulator_state *emu,
+	struct arm_cfg *cfg,
+	uint32_t address)
+{
+	const uint32_t offset = address - emu->program_address;
+	if (offset < emu->program_size && offset + 4 <= emu->program_size)
+	{
+		cfg->map[offset / 2] |= ARM_CFG_LITERAL;
+		cfg->map[offset / 2 + 1] |= ARM_CFG_LITERAL;
+	}
+}
+
+//================================================================================================================
+static uint16_t
+_halfword(
+	const struct arm_emulator_state *emu,
+	uint32_t offset)
+{
+	return emu->program[offset] | (emu->program[offset + 1] << 8);
+}
+
+//================================================================================================================
+/* Decode the instruction at offset; 0 if it is truncated or invalid. */
+static int
+_decode(
+	const struct arm_emulator_state *emu,
+	uint32_t offset,
+	struct arm_insn *insn)
+{
+	const uint16_t	instruction = _halfword(emu, offset);
+	uint16_t		instruction2 = 0;
+	if (arm_decode_is_32bit(instruction))
+	{
+		if (offset + 4 > emu->program_size)
+		{
+			return 0;
+		}
+		instruction2 = _halfword(emu, offset + 2);
+	}
+	arm_decode(emu->program_address + offset, instruction, instruction2, insn);
+	return insn->kind != ARM_INSN_INVALID;
+}
+
+//================================================================================================================
+/* Follow the path from offset until it ends or joins code found before. */
+static void
+_walk(
+	const struct arm_emulator_state *emu,
+	struct arm_cfg *cfg,
+	uint32_t offset)
+{
+	for (;;)
+	{
+		uint8_t			*m;
+		struct arm_insn	insn;
+		if (offset + 2 > emu->program_size)
+		{
+			++cfg->invalid_count;
+			return;
+		}
+		m = &cfg->map[offset / 2];
+		*m &= ~PENDING;
+		if ((*m & (ARM_CFG_CODE | ARM_CFG_LITERAL)) != 0)
+		{
+			return;
+		}
+		if (!_decode(emu, offset, &insn))
+		{
+			++cfg->invalid_count;
+			return;
+		}
+		*m |= ARM_CFG_CODE;
+		if (insn.size == 4)
+		{
+			m[1] |= ARM_CFG_CODE2;
+		}
+		if (insn.kind == ARM_INSN_LOAD_LITERAL)
+		{
+			_mark_literal(emu, cfg, insn.target);
+		}
+		else if (insn.kind == ARM_INSN_BRANCH || insn.kind == ARM_INSN_BRANCH_COND)
+		{
+			_mark(emu, cfg, insn.target, ARM_CFG_BLOCK);
+		}
+		else if (insn.kind == ARM_INSN_CALL)
+		{
+			_mark(emu, cfg, insn.target, ARM_CFG_BLOCK | ARM_CFG_FUNCTION);
+		}
+		if (insn.kind == ARM_INSN_BRANCH || insn.kind == ARM_INSN_INDIRECT || insn.kind == ARM_INSN_RETURN)
+		{
+			return;
+		}
+		offset += insn.size;
+		if (insn.kind >= ARM_INSN_BRANCH && offset + 2 <= emu->program_size)
+		{
+			cfg->map[offset / 2] |= ARM_CFG_BLOCK;
+		}
+	}
+}
+
+//================================================================================================================
+static void
+_start(
+	const struct arm_emulator_state *emu,
+	struct arm_cfg *cfg)
+{
+	memset(cfg->map, 0, ARM_CFG_MAP_SIZE(emu->program_size));
+	cfg->functions_count = 0;
+	cfg->blocks_count = 0;
+	cfg->calls_count = 0;
+	cfg->invalid_count = 0;
+}
+
+//================================================================================================================
+static void
+_close_block(
+	struct arm_cfg *cfg,
+	struct arm_cfg_block *block)
+{
+	if (block->count == 0)
+	{
+		return;
+	}
+	if (cfg->blocks_count < cfg->blocks_max)
+	{
+		cfg->blocks[cfg->blocks_count] = *block;
+	}
+	if (block->function < cfg->functions_count && block->function < cfg->functions_max)
+	{
+		++cfg->functions[block->function].blocks_count;
+	}
+	++cfg->blocks_count;
+	block->count = 0;
+}
+
+//================================================================================================================
+/* Follow all pending paths, then list functions, blocks and calls in address order. */
+static int
+_finish(
+	const struct arm_emulator_state *emu,
+	struct arm_cfg *cfg)
+{
+	struct arm_cfg_block	block;
+	uint32_t				offset;
+	int						pending = 1;
+	while (pending)
+	{
+		pending = 0;
+		for (offset = 0; offset + 2 <= emu->program_size; offset += 2)
+		{
+			if ((cfg->map[offset / 2] & PENDING) != 0)
+			{
+				_walk(emu, cfg, offset);
+				pending = 1;
+			}
+		}
+	}
+
+	block.count = 0;
+	block.function = 0;
+	for (offset = 0; offset + 2 <= emu->program_size; offset += 2)
+	{
+		const uint8_t	m = cfg->map[offset / 2];
+		struct arm_insn	insn;
+		if ((m & ARM_CFG_CODE) == 0 || (m & (ARM_CFG_BLOCK | ARM_CFG_FUNCTION)) != 0)
+		{
+			_close_block(cfg, &block);
+		}
+		if ((m & ARM_CFG_CODE) == 0)
+		{
+			continue;
+		}
+		if ((m & ARM_CFG_FUNCTION) != 0)
+		{
+			if (cfg->functions_count < cfg->functions_max)
+			{
+				struct arm_cfg_function *function = &cfg->functions[cfg->functions_count];
+				function->address = emu->program_address + offset;
+				function->first_block = (uint16_t)cfg->blocks_count;
+				function->blocks_count = 0;
+			}
+			++cfg->functions_count;
+		}
+		_decode(emu, offset, &insn);
+		if (block.count == 0)
+		{
+			block.address = emu->program_address + offset;
+			block.size = 0;
+			block.function = (uint16_t)(cfg->functions_count > 0 ? cfg->functions_count - 1 : 0);
+		}
+		block.size += insn.size;
+		++block.count;
+		block.kind = insn.kind;
+		block.target = insn.kind == ARM_INSN_BRANCH || insn.kind == ARM_INSN_BRANCH_COND || insn.kind == ARM_INSN_CALL
+			? insn.target
+			: 0;
+		if (insn.kind == ARM_INSN_CALL)
+		{
+			if (cfg->calls_count < cfg->calls_max)
+			{
+				cfg->calls[cfg->calls_count].address = block.address + block.size - insn.size;
+				cfg->calls[cfg->calls_count].target = insn.target;
+			}
+			++cfg->calls_count;
+		}
+		if (insn.kind >= ARM_INSN_BRANCH)
+		{
+			_close_block(cfg, &block);
+		}
+		offset += insn.size - 2;
+	}
+	_close_block(cfg, &block);
+	return cfg->functions_count > cfg->functions_max
+		|| cfg->blocks_count > cfg->blocks_max
+		|| cfg->calls_count > cfg->calls_max
+		? -1
+		: 0;
+}
+
+//================================================================================================================
+int
+arm_cfg_build(
+	const struct arm_emulator_state *emu,
+	const uint32_t *entries,
+	unsigned int count,
+	struct arm_cfg *cfg)
+{
+	unsigned int i;
+	_start(emu, cfg);
+	for (i = 0; i < count; ++i)
+	{
+		_mark(emu, cfg, entries[i], ARM_CFG_BLOCK | ARM_CFG_FUNCTION);
+	}
+	return _finish(emu, cfg);
+}
+
+//================================================================================================================
+int
+arm_cfg_build_plugin(
+	const struct arm_emulator_state *emu,
+	uint32_t api_address,
+	struct arm_cfg *cfg)
+{
+	const uint8_t	*api = arm_emulator_host_pointer(emu, api_address, sizeof(struct plugin_api));
+	const uint8_t	*table;
+	uint16_t		count;
+	unsigned int	i;
+	_start(emu, cfg);
+	if (api == NULL)
+	{
+		return -1;
+	}
+	memcpy(&count, api + offsetof(struct plugin_api, function_count), 2);
+	table = arm_emulator_host_pointer(emu, api_address + offsetof(struct plugin_api, Init), 4 * (uint32_t)count);
+	if (table == NULL)
+	{
+		return -1;
+	}
+	for (i = 0; i < count; ++i)
+	{
+		uint32_t entry;
+		memcpy(&entry, table + 4 * i, 4);
+		_mark(emu, cfg, entry, ARM_CFG_BLOCK | ARM_CFG_FUNCTION);
+	}
+	return _finish(emu, cfg);
+}
+
+//================================================================================================================
+const struct arm_cfg_block *
+arm_cfg_find_block(
+	const struct arm_cfg *cfg,
+	uint32_t address)
+{
+	unsigned int lo = 0;
+	unsigned int hi = cfg->blocks_count < cfg->blocks_max ? cfg->blocks_count : cfg->blocks_max;
+	while (lo < hi)
+	{
+		const unsigned int mid = (lo + hi) / 2;
+		const struct arm_cfg_block *block = &cfg->blocks[mid];
+		if (address < block->address)
+		{
+			hi = mid;
+		}
+		else if (address - block->address >= block->size)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			return block;
+		}
+	}
+	return NULL;
+}
+
+//================================================================================================================
+const struct arm_cfg_function *
+arm_cfg_find_function(
+	const struct arm_cfg *cfg,
+	uint32_t address)
+{
+	const struct arm_cfg_block *block = arm_cfg_find_block(cfg, address);
+	if (block == NULL || block->function >= cfg->functions_count || block->function >= cfg->functions_max)
+	{
+		return NULL;
+	}
+	return &cfg->functions[block->function];
+}
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Static control flow recovery over the program region: functions from
+ * the entry points and BL targets, basic blocks, literal pools and call
+ * edges, computed once at load time.
+ */
+#ifndef ARM_CFG_H
+#define ARM_CFG_H
+
+#include "arm_emulator.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** Entries of map storage needed for a program region of size bytes. */
+#define ARM_CFG_MAP_SIZE(size)	((size) / 2)
+
+/** Map bits, one byte per halfword of the program region. */
+enum {
+	/** First halfword of a reachable instruction. */
+	ARM_CFG_CODE = 0x01,
+	/** Second halfword of a reachable 32-bit instruction. */
+	ARM_CFG_CODE2 = 0x02,
+	/** First instruction of a basic block. */
+	ARM_CFG_BLOCK = 0x04,
+	/** Entry point of a function. */
+	ARM_CFG_FUNCTION = 0x08,
+	/** Literal pool data, loaded by LDR Rt, [PC, #imm]. */
+	ARM_CFG_LITERAL = 0x10,
+};
+
+/**
+ * Basic block: straight-line code entered only at the start.
+ */
+struct arm_cfg_block {
+	/** Address of the first instruction. */
+	uint32_t address;
+	/** Size in bytes. */
+	uint16_t size;
+	/** Number of instructions. */
+	uint16_t count;
+	/** enum arm_insn_kind of the last instruction. Blocks that end with
+	    a kind below ARM_INSN_BRANCH fall into the next block. */
+	uint8_t kind;
+	/** Index of the function the block belongs to. */
+	uint16_t function;
+	/** Target of a direct branch or call at the end, otherwise 0. */
+	uint32_t target;
+};
+
+/**
+ * Function, entered at a plugin_api entry point or a BL target.
+ */
+struct arm_cfg_function {
+	uint32_t address;
+	/** Index of the first block; the blocks of a function are those up
+	    to the next function entry in address order. */
+	uint16_t first_block;
+	uint16_t blocks_count;
+};
+
+/**
+ * Call edge from a BL instruction.
+ */
+struct arm_cfg_call {
+	/** Address of the BL instruction. */
+	uint32_t address;
+	/** Called address, which may be a native outside the program region. */
+	uint32_t target;
+};
+
+/**
+ * Control flow graph. Storage is provided by the user; the arrays are
+ * sorted by address.
+ */
+struct arm_cfg {
+	/** ARM_CFG_MAP_SIZE(program_size) entries of ARM_CFG_* bits. */
+	uint8_t *map;
+	struct arm_cfg_function *functions;
+	unsigned int functions_max;
+	struct arm_cfg_block *blocks;
+	unsigned int blocks_max;
+	struct arm_cfg_call *calls;
+	unsigned int calls_max;
+
+	/** Numbers found; entries beyond the maxima are not stored. */
+	unsigned int functions_count;
+	unsigned int blocks_count;
+	unsigned int calls_count;
+	/** Instructions that do not decode, or run off the program region;
+	    paths stop there. */
+	unsigned int invalid_count;
+};
+
+/**
+ * Recover the control flow reachable from a list of entry points. Paths
+ * are followed through fall-through, B, B<cond> and BL; code reached only
+ * through BLX, BX or MOV PC is not found. A path stops before literal
+ * pool data found so far.
+ *
+ * @param emu Emulator state.
+ * @param entries Entry point addresses, Thumb bit ignored; addresses
+ *        outside the program region are skipped.
+ * @param count Number of entry points.
+ * @param cfg Control flow graph with the storage filled in.
+ * @return 0 on success, negative if an array was too small.
+ */
+int arm_cfg_build(
+	const struct arm_emulator_state *emu,
+	const uint32_t *entries,
+	unsigned int count,
+	struct arm_cfg *cfg);
+
+/**
+ * Recover the control flow reachable from the functions published in a
+ * struct plugin_api, as far as function_count covers them.
+ *
+ * @param emu Emulator state.
+ * @param api_address Guest address of struct plugin_api, usually
+ *        PLUGIN_API_ADDRESS.
+ * @param cfg Control flow graph with the storage filled in.
+ * @return 0 on success, negative if the structure is out of bounds or an
+ *         array was too small.
+ */
+int arm_cfg_build_plugin(
+	const struct arm_emulator_state *emu,
+	uint32_t api_address,
+	struct arm_cfg *cfg);
+
+/**
+ * Find the block containing an address.
+ *
+ * @param cfg Control flow graph.
+ * @param address Address.
+ * @return Block, or NULL if the address is not in reachable code.
+ */
+const struct arm_cfg_block *arm_cfg_find_block(
+	const struct arm_cfg *cfg,
+	uint32_t address);
+
+/**
+ * Find the function containing an address.
+ *
+ * @param cfg Control flow graph.
+ * @param address Address.
+ * @return Function, or NULL if the address is not in reachable code.
+ */
+const struct arm_cfg_function *arm_cfg_find_function(
+	const struct arm_cfg *cfg,
+	uint32_t address);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* ARM_CFG_H */
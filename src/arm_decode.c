@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: MIT
+/** \file Instruction classification. */
+#include "arm_decode.h"
+#include <string.h>	// memset
+
+enum {
+	INDEX_SP = 13,
+	INDEX_LR = 14,
+	INDEX_PC = 15
+};
+
+/**
+ * Cycles by the top 5 bits of the first halfword, Cortex-M0 with the
+ * single-cycle multiplier. Taken branches (+2), multiple register
+ * transfers (+N) and flash wait states are added where they occur.
+ */
+const uint8_t	arm_decode_cycles[32] = {
+	1, 1, 1, 1, 1, 1, 1, 1,	// 0x00: shift, add, subtract, move, compare
+	1, 2, 2, 2, 2, 2, 2, 2,	// 0x40: data processing, special; 0x48: LDR literal; 0x50: load/store
+	2, 2, 2, 2, 1, 1, 1, 1,	// 0x80: load/store; 0xA0: ADR, ADD SP; 0xB0: miscellaneous
+	1, 1, 1, 1, 1, 4, 4, 4	// 0xC0: LDM, STM; 0xD0: B<c>; 0xE0: B; 0xE8: 32-bit (BL, MSR, MRS, barriers)
+};
+
+//================================================================================================================
+static uint32_t
+_SignExtendTo32(
+	const uint32_t	x,
+	const uint8_t	sign_bit)
+{
+	const uint32_t	m = 1U << sign_bit;
+	return ((x & ((1U << (sign_bit+1)) - 1)) ^ m) - m;
+}
+
+//================================================================================================================
+uint8_t
+arm_decode_condition_flags(uint8_t cond)
+{
+	switch (cond & 0x0E)
+	{
+	case 0x00: return ARM_FLAG_Z;							// EQ or NE
+	case 0x02: return ARM_FLAG_C;							// CS or CC
+	case 0x04: return ARM_FLAG_N;							// MI or PL
+	case 0x06: return ARM_FLAG_V;							// VS or VC
+	case 0x08: return ARM_FLAG_C | ARM_FLAG_Z;				// HI or LS
+	case 0x0A: return ARM_FLAG_N | ARM_FLAG_V;				// GE or LT
+	case 0x0C: return ARM_FLAG_N | ARM_FLAG_Z | ARM_FLAG_V;	// GT or LE
+	default: return 0;
+	}
+}
+
+//================================================================================================================
+int
+arm_decode_is_32bit(uint16_t instruction)
+{
+	const uint8_t	i_h = (uint8_t)(instruction >> 8);
+	return (i_h & 0xE0) == 0xE0 && (i_h & 0xF8) != 0xE0;
+}
+
+//================================================================================================================
+/* Set flags that are always written. */
+static void
+_writes(
+	struct arm_insn	*insn,
+	const uint8_t	flags)
+{
+	insn->flags_written = flags;
+	insn->flags_killed = flags;
+}
+
+//================================================================================================================
+void
+arm_decode(
+	uint32_t address,
+	uint16_t instruction,
+	uint16_t instruction2,
+	struct arm_insn *insn)
+{
+	const uint8_t	i_l = (uint8_t)instruction;
+	const uint8_t	i_h = (uint8_t)(instruction >> 8);
+	const uint8_t	opcode = i_h & 0xFC;
+	const uint8_t	opcode2bits = i_h & 0xC0;
+	const uint8_t	opcode3bits = i_h & 0xE0;
+	const uint8_t	opcode4bits = i_h & 0xF0;
+	const uint8_t	opcode5bits = i_h & 0xF8;
+
+	memset(insn, 0, sizeof(*insn));
+	insn->kind = ARM_INSN_NORMAL;
+	insn->size = 2;
+
+	if (opcode2bits==0)
+	{
+		// Shift (immediate), add, subtract, move, and compare.
+		const uint8_t	scode3bits = i_h & 0x38;
+		if (scode3bits==0x00)
+		{
+			// LSL (immediate); MOVS if the shift is zero.
+			_writes(insn, ((instruction >> 6) & 0x1F) ? ARM_FLAGS_NZC : ARM_FLAGS_NZ);
+		}
+		else if (scode3bits==0x08 || scode3bits==0x10)
+		{
+			// LSR, ASR (immediate)
+			_writes(insn, ARM_FLAGS_NZC);
+		}
+		else if (scode3bits==0x20)
+		{
+			// MOV (immediate)
+			_writes(insn, ARM_FLAGS_NZ);
+		}
+		else
+		{
+			// ADD, SUB, CMP.
+			_writes(insn, ARM_FLAGS_ALL);
+		}
+	}
+	else if (opcode==0x40)
+	{
+		// Data processing.
+		switch ((instruction >> 2) & 0xF0)
+		{
+		case 0x20:	// LSL
+		case 0x30:	// LSR
+		case 0x40:	// ASR
+		case 0x70:	// ROR
+			// C only if the shift amount is non-zero.
+			insn->flags_written = ARM_FLAGS_NZC;
+			insn->flags_killed = ARM_FLAGS_NZ;
+			break;
+		case 0x50:	// ADC
+		case 0x60:	// SBC
+			insn->flags_read = ARM_FLAG_C;
+			_writes(insn, ARM_FLAGS_ALL);
+			break;
+		case 0x90:	// RSB
+		case 0xA0:	// CMP
+		case 0xB0:	// CMN
+			_writes(insn, ARM_FLAGS_ALL);
+			break;
+		case 0xD0:	// MUL
+			_writes(insn, ARM_FLAGS_NZ);
+			break;
+		default:	// AND, EOR, TST, ORR, BIC, MVN
+			_writes(insn, ARM_FLAGS_NZC);
+			break;
+		}
+	}
+	else if (opcode==0x44)
+	{
+		// Special data instructions and branch and exchange
+		const uint8_t	scode =  (instruction >> 2) & 0xF0;
+		const uint8_t	scode2bits = scode & 0xC0;
+		const uint8_t	scode3bits = scode & 0xE0;
+		const uint8_t	Rdn = ((i_l >> 4) & 0x08) | (i_l & 0x07);
+		const uint8_t	Rm = (i_l >> 3) & 0x0F;
+		if (scode2bits==0x00)
+		{
+			// ADD (registers). Flags are kept when writing PC or SP.
+			if (Rdn == INDEX_PC)
+			{
+				insn->kind = ARM_INSN_INDIRECT;
+			}
+			else if (Rdn != INDEX_SP)
+			{
+				_writes(insn, ARM_FLAGS_ALL);
+			}
+		}
+		else if (scode==0x40)
+		{
+			insn->kind = ARM_INSN_INVALID;
+		}
+		else if ((scode==0x50) || (scode3bits==0x60))
+		{
+			// CMP (registers)
+			_writes(insn, ARM_FLAGS_ALL);
+		}
+		else if (scode2bits==0x80)
+		{
+			// MOV (registers)
+			if (Rdn == INDEX_PC)
+			{
+				insn->kind = Rm == INDEX_LR ? ARM_INSN_RETURN : ARM_INSN_INDIRECT;
+			}
+		}
+		else
+		{
+			const uint8_t	Rm2 = (instruction >> 3) & 0x0F;
+			if (Rm2 == INDEX_PC)
+			{
+				insn->kind = ARM_INSN_INVALID;
+			}
+			else if (scode3bits==0xC0)
+			{
+				// BX
+				insn->kind = Rm2 == INDEX_LR ? ARM_INSN_RETURN : ARM_INSN_INDIRECT;
+			}
+			else if (scode3bits==0xE0)
+			{
+				// BLX
+				insn->kind = ARM_INSN_CALL_INDIRECT;
+			}
+			else
+			{
+				insn->kind = ARM_INSN_INVALID;
+			}
+		}
+	}
+	else if (opcode5bits==0x48)
+	{
+		// Load from Literal Pool (LDR).
+		insn->kind = ARM_INSN_LOAD_LITERAL;
+		insn->target = ((address + 4) & ~(uint32_t)3) + i_l*4;
+	}
+	else if (opcode4bits==0x50 || opcode3bits==0x60 || opcode3bits==0x80
+		|| opcode5bits==0xC0 || opcode5bits==0xC8)
+	{
+		// Loads, stores, STM, LDM.
+		insn->access = 1;
+	}
+	else if (opcode5bits==0xA0 || opcode5bits==0xA8)
+	{
+		// ADR, ADD SP.
+	}
+	else if (opcode4bits==0xB0)
+	{
+		// Miscellaneous 16-bit instructions.
+		const uint8_t	scode = instruction >> 4 & 0xFE;
+		const uint8_t	scode3bits = scode & 0xE0;
+		const uint8_t	scode4bits = scode & 0xF0;
+		const uint8_t	scode5bits = scode & 0xF8;
+		const uint8_t	scode6bits = scode & 0xFC;
+		if (scode5bits==0x00 || scode5bits==0x08
+			|| scode6bits==0x20 || scode6bits==0x24 || scode6bits==0x28 || scode6bits==0x2C
+			|| scode==0x66
+			|| scode6bits==0xA0 || scode6bits==0xA4 || scode6bits==0xAC
+			|| scode4bits==0xE0)
+		{
+			// ADD/SUB SP, extend, CPS, REV, BKPT.
+		}
+		else if (scode3bits==0x40)
+		{
+			// PUSH
+			insn->access = 1;
+		}
+		else if (scode3bits==0xC0)
+		{
+			// POP
+			insn->access = 1;
+			if (i_h & 1)
+			{
+				insn->kind = ARM_INSN_RETURN;
+			}
+		}
+		else if (scode4bits==0xF0 && (i_l == 0x00 || i_l == 0x10 || i_l == 0x40))
+		{
+			// NOP, YIELD, SEV
+		}
+		else if (scode4bits==0xF0 && (i_l == 0x20 || i_l == 0x30))
+		{
+			// WFE, WFI
+			insn->kind = ARM_INSN_WAIT;
+		}
+		else
+		{
+			insn->kind = ARM_INSN_INVALID;
+		}
+	}
+	else if (opcode4bits==0xD0)
+	{
+		// Conditional branch, and Supervisor Call.
+		const uint8_t	cond = i_h & 0x0F;
+		if (cond==0x0F)
+		{
+			// SVC
+			insn->kind = ARM_INSN_CALL_INDIRECT;
+		}
+		else if (cond==0x0E)
+		{
+			insn->kind = ARM_INSN_INVALID;
+		}
+		else
+		{
+			insn->kind = ARM_INSN_BRANCH_COND;
+			insn->flags_read = arm_decode_condition_flags(cond);
+			insn->target = address + 4 + _SignExtendTo32(i_l*2, 8);
+		}
+	}
+	else if (opcode5bits==0xE0)
+	{
+		// Unconditional branch (B)
+		insn->kind = ARM_INSN_BRANCH;
+		insn->target = address + 4 + _SignExtendTo32(2*(instruction & 0x7FF), 11);
+	}
+	else
+	{
+		// 32-bit Thumb instruction
+		const uint8_t	i2_l = (uint8_t)instruction2;
+		const uint8_t	i2_h = (uint8_t)(instruction2 >> 8);
+		insn->size = 4;
+		insn->kind = ARM_INSN_INVALID;
+		if ((opcode5bits== 0xF0) && ((i2_h & 0x80) == 0x80))
+		{
+			const uint8_t	op1 = ((i_h << 5) & 0xE0) | ((i_l>>3) & 0x1E);
+			const uint8_t	op2 = (i2_h << 1) & 0xE0;
+			const uint8_t	op16bits = op1 & 0xFC;
+			if ((op2 & 0xA0) == 0)
+			{
+				if (op16bits == 0x70 && i2_l == 0)
+				{
+					// MSR APSR
+					insn->kind = ARM_INSN_NORMAL;
+					_writes(insn, ARM_FLAGS_ALL);
+				}
+				else if (op1 == 0x76)
+				{
+					// DSB, DMB, ISB
+					insn->kind = ARM_INSN_NORMAL;
+				}
+				else if (op16bits == 0x7C && i2_l == 0)
+				{
+					// MRS APSR
+					insn->kind = ARM_INSN_NORMAL;
+					insn->flags_read = ARM_FLAGS_ALL;
+				}
+			}
+			else if (op2==0x40 && op1==0xFE)
+			{
+				// UDF
+			}
+			else if ((op2 & 0xA0) == 0xA0)
+			{
+				// BL
+				const uint32_t	s = (instruction >> 10) & 1;
+				const uint32_t	j1 = (instruction2 >> 13) & 1;
+				const uint32_t	j2 = (instruction2 >> 11) & 1;
+				const uint32_t	x =
+					  ((instruction2 & 0x7FF) << 1)
+					| ((instruction & 0x3FF) << 12)
+					| ((1 - (j2 ^ s)) << 22)
+					| ((1 - (j1 ^ s)) << 23)
+					| (s << 24);
+				insn->kind = ARM_INSN_CALL;
+				insn->target = address + 4 + _SignExtendTo32(x, 24);
+			}
+		}
+	}
+}
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Instruction classification for analysis passes: control flow, condition
+ * flag usage and literal references. Mirrors the decoding in
+ * arm_emulator_execute().
+ */
+#ifndef ARM_DECODE_H
+#define ARM_DECODE_H
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** Condition flags, as bit masks. */
+enum {
+	ARM_FLAG_V = 0x01,
+	ARM_FLAG_C = 0x02,
+	ARM_FLAG_Z = 0x04,
+	ARM_FLAG_N = 0x08,
+	ARM_FLAGS_NZ = ARM_FLAG_N | ARM_FLAG_Z,
+	ARM_FLAGS_NZC = ARM_FLAG_N | ARM_FLAG_Z | ARM_FLAG_C,
+	ARM_FLAGS_ALL = 0x0F
+};
+
+/** Instruction kinds. Kinds from ARM_INSN_BRANCH onwards end a basic block. */
+enum arm_insn_kind {
+	/** Falls through to the next instruction. */
+	ARM_INSN_NORMAL = 0,
+	/** Falls through; target holds the literal address (LDR Rt, [PC, #imm]). */
+	ARM_INSN_LOAD_LITERAL,
+	/** B: unconditional direct branch to target. */
+	ARM_INSN_BRANCH,
+	/** B<cond>: conditional direct branch to target. */
+	ARM_INSN_BRANCH_COND,
+	/** BL: direct call to target. */
+	ARM_INSN_CALL,
+	/** BLX Rm, SVC: indirect call. */
+	ARM_INSN_CALL_INDIRECT,
+	/** BX Rm, MOV PC, Rm, ADD PC, Rm: indirect branch. */
+	ARM_INSN_INDIRECT,
+	/** BX LR, POP {..., PC}: function return. */
+	ARM_INSN_RETURN,
+	/** WFE, WFI: execution may stop after the instruction. */
+	ARM_INSN_WAIT,
+	/** Not executable by the emulator. */
+	ARM_INSN_INVALID
+};
+
+/**
+ * Decoded instruction.
+ */
+struct arm_insn {
+	/** enum arm_insn_kind. */
+	uint8_t kind;
+	/** Size in bytes, 2 or 4. */
+	uint8_t size;
+	/** Flags read (ARM_FLAG_*). */
+	uint8_t flags_read;
+	/** Flags that may be written. */
+	uint8_t flags_written;
+	/** Flags that are always written. */
+	uint8_t flags_killed;
+	/** Non-zero for loads and stores other than from the literal pool.
+	    They may leave the mapped regions and reach a callback or stop
+	    with an error, so the flags must be exact before them. */
+	uint8_t access;
+	/** Branch or call target, or literal address. */
+	uint32_t target;
+};
+
+/**
+ * Base cycles of an instruction, indexed by the top 5 bits of its first
+ * halfword, as charged by arm_emulator_execute(). Taken branches (+2),
+ * multiple register transfers (+N) and flash wait states come on top.
+ */
+extern const uint8_t arm_decode_cycles[32];
+
+/**
+ * Check whether the halfword is the first half of a 32-bit instruction.
+ *
+ * @param instruction First halfword.
+ * @return Non-zero for 32-bit instructions.
+ */
+int arm_decode_is_32bit(uint16_t instruction);
+
+/**
+ * Classify an instruction.
+ *
+ * @param address Address of the instruction.
+ * @param instruction First halfword.
+ * @param instruction2 Second halfword, ignored for 16-bit instructions.
+ * @param insn Result.
+ */
+void arm_decode(
+	uint32_t address,
+	uint16_t instruction,
+	uint16_t instruction2,
+	struct arm_insn *insn);
+
+/**
+ * Flags read by a condition code of a conditional branch.
+ *
+ * @param cond Condition code, 0x0...0xD.
+ * @return Flags read (ARM_FLAG_*).
+ */
+uint8_t arm_decode_condition_flags(uint8_t cond);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* ARM_DECODE_H */
@@ -2,6 +2,7 @@
 /** \file Implementation of the emulator. */
 #include "arm_emulator.h"
 #include <string.h>	// memset
+#include "arm_decode.h"	// Block analysis.
 #include "comm.h"	// Error message output.
 
 static const char*	_rnames[16] = {
@@ -10,8 +11,8 @@ static const char*	_rnames[16] = {
 
 #if defined(_MSC_VER) || defined(DESKTOP_BUILD)
 #include <stdio.h>	// printf
-// error printf
-#define	xprintf(args)	do { printf args; } while(0)
+// error printf, after any buffered output and written at once
+#define	xprintf(args)	do { uart_flush(); printf args; fflush(stdout); } while(0)
 // instruction printf
 #define	iprintf(args)	do { printf args; } while(0)
 static const char*	_cnames[16] = {
@@ -222,24 +223,209 @@ enum {
 	} while (0)
 
 //================================================================================================================
+/**
+ * Find native implementation of the function at the given address.
+ * @param emu Emulator state.
+ * @param address Function address, Thumb bit cleared.
+ * @return Native function or NULL.
+ */
+static arm_emulator_native_t
+_find_native(
+	const struct arm_emulator_state *emu,
+	uint32_t address)
+{
+	unsigned int lo = 0;
+	unsigned int hi = emu->natives_count;
+	while (lo < hi)
+	{
+		const unsigned int mid = (lo + hi) / 2;
+		const uint32_t x = emu->natives[mid].address;
+		if (x == address)
+		{
+			return emu->natives[mid].function;
+		}
+		else if (x < address)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return NULL;
+}
+
+//================================================================================================================
+/**
+ * Exception return: unstack the frame pushed by _exception_entry().
+ * @param emu Emulator state.
+ * @param exc_return EXC_RETURN value branched to.
+ */
 static enum arm_emulator_result
-_check_new_PC(
+_exception_return(
 	struct arm_emulator_state *emu,
-	uint32_t *new_pc)
+	uint32_t exc_return)
+{
+	const size_t	offset = SP - emu->data_address;
+	const uint32_t	*frame;
+	uint32_t		xpsr;
+	if ((exc_return != 0xFFFFFFF1 && exc_return != 0xFFFFFFF9)
+		|| (SP & 0x03) != 0 || offset > emu->data_size || emu->data_size - offset < 32)
+	{
+		uart_write_hex32("_exception_return: invalid return 0x", exc_return);
+		uart_write_hex32(", SP=0x", SP);
+		uart_write_crlf();
+		return ARM_EMULATOR_ERROR;
+	}
+	frame = (const uint32_t *)(emu->data + offset);
+	emu->R[0] = frame[0];
+	emu->R[1] = frame[1];
+	emu->R[2] = frame[2];
+	emu->R[3] = frame[3];
+	emu->R[12] = frame[4];
+	LR = frame[5];
+	PC = frame[6];
+	xpsr = frame[7];
+	SP += 32 + ((xpsr >> 9) & 1) * 4;
+	emu->APSR = xpsr & 0xF0000000;
+	emu->exception = xpsr & 0x3F;
+	emu->cycles += 16;
+	++emu->events;
+	// Tail-chain pending exceptions.
+	emu->next_check = 0;
+	return ARM_EMULATOR_OK;
+}
+
+//================================================================================================================
+/** Remember the return address of a BL or BLX. */
+#define	_push_return(emu, address) \
+	do { \
+		emu->return_stack_top = (emu->return_stack_top + 1) & (ARM_RETURN_STACK_SIZE - 1); \
+		emu->return_stack[emu->return_stack_top] = (address); \
+	} while (0)
+
+//================================================================================================================
+/**
+ * Check whether a branch target is plain guest code: a predicted return,
+ * or a target resolved before. Predicted returns are popped.
+ */
+static int
+_is_plain_target(
+	struct arm_emulator_state *emu,
+	uint32_t x)
+{
+	if (!emu->branch_cache_enabled)
+	{
+		return 0;
+	}
+	if (x == emu->return_stack[emu->return_stack_top])
+	{
+		emu->return_stack[emu->return_stack_top] = 0xFFFFFFFF;
+		emu->return_stack_top = (emu->return_stack_top - 1) & (ARM_RETURN_STACK_SIZE - 1);
+		return 1;
+	}
+	return emu->branch_cache[(x >> 1) & (ARM_BRANCH_CACHE_SIZE - 1)] == x;
+}
+
+//================================================================================================================
+void
+arm_emulator_set_branch_cache(
+	struct arm_emulator_state *emu,
+	int enable)
 {
-	const uint32_t x = *new_pc;
-	if (x == EMULATOR_RETURN_ADDRESS)
+	emu->branch_cache_enabled = enable != 0;
+	arm_emulator_flush_branch_cache(emu);
+}
+
+//================================================================================================================
+void
+arm_emulator_flush_branch_cache(struct arm_emulator_state *emu)
+{
+	unsigned int i;
+	for (i = 0; i < ARM_BRANCH_CACHE_SIZE; ++i)
 	{
-		return ARM_EMULATOR_FUNCTION_RETURNED;
+		emu->branch_cache[i] = 0xFFFFFFFF;
 	}
-	else if (arm_emulator_callback_functioncall(emu, x) == 0)
+	memset(emu->return_stack, 0xFF, sizeof(emu->return_stack));
+	emu->return_stack_top = 0;
+}
+
+//================================================================================================================
+static enum arm_emulator_result
+_check_new_PC(
+	struct arm_emulator_state *emu,
+	uint32_t *new_pc)
+{
+	arm_emulator_native_t	previous = NULL;
+	for (;;)
 	{
-		/* Function called, thus we must return. */
-		*new_pc = LR;
+		const uint32_t x = *new_pc;
+		arm_emulator_native_t native;
+		int r = -1;
+		if (x == emu->return_address)
+		{
+			return ARM_EMULATOR_FUNCTION_RETURNED;
+		}
+		if (x - EMULATOR_RETURN_ADDRESS <= 2*ARM_CALL_DEPTH_MAX && (x & 1))
+		{
+			uart_write_hex32("_check_new_PC: return to an outer call frame, 0x", x);
+			uart_write_crlf();
+			return ARM_EMULATOR_ERROR;
+		}
+		if (x >= 0xFFFFFFF0 && emu->exception != 0)
+		{
+			const enum arm_emulator_result	result = _exception_return(emu, x);
+			*new_pc = PC;
+			return result;
+		}
+		if (previous == NULL && _is_plain_target(emu, x))
+		{
+			return ARM_EMULATOR_OK;
+		}
+		native = emu->natives_count > 0
+			? _find_native(emu, x & 0xFFFFFFFE)
+			: NULL;
+		if (native != NULL && native != previous)
+		{
+			r = native(emu);
+		}
+		if (r >= 0 && native != arm_emulator_native_get_uptime)
+		{
+			++emu->events;
+		}
+		if (r > 0)
+		{
+			/* Partially handled: branch to PC, without re-entering the same native. */
+			*new_pc = PC;
+			previous = native;
+			continue;
+		}
+		if (r < 0 && arm_emulator_callback_functioncall(emu, x) == 0)
+		{
+			++emu->events;
+			r = 0;
+		}
+		if (r == 0)
+		{
+			/* Function called, thus we must return. */
+			if (LR == emu->return_stack[emu->return_stack_top])
+			{
+				emu->return_stack[emu->return_stack_top] = 0xFFFFFFFF;
+				emu->return_stack_top = (emu->return_stack_top - 1) & (ARM_RETURN_STACK_SIZE - 1);
+			}
+			*new_pc = LR;
+			return LR == emu->return_address
+				? ARM_EMULATOR_FUNCTION_RETURNED
+				: ARM_EMULATOR_OK;
+		}
+		/* nothing to see here. */
+		if (native == NULL && emu->branch_cache_enabled)
+		{
+			emu->branch_cache[(x >> 1) & (ARM_BRANCH_CACHE_SIZE - 1)] = x;
+		}
 		return ARM_EMULATOR_OK;
 	}
-	/* nothing to see here. */
-	return ARM_EMULATOR_OK;
 }
 
 //================================================================================================================
@@ -248,6 +434,7 @@ _check_new_PC(
 		uint32_t real_new_PC = new_PC; \
 		const enum arm_emulator_result r = _check_new_PC(emu, &real_new_PC); \
 		PC = (real_new_PC) & 0xFFFFFFFE; \
+		verified_next = 1; \
 		if (r != ARM_EMULATOR_OK) { \
 			return r; \
 		} \
@@ -360,6 +547,20 @@ void
 arm_emulator_reset(struct arm_emulator_state *emu)
 {
 	_reset_registers(emu);
+	emu->call_pending = 0;
+	emu->call_depth = 0;
+	emu->return_address = EMULATOR_RETURN_ADDRESS;
+	emu->call_sp = SP;
+	emu->call_result = 0;
+	emu->call_result_size = 0;
+	emu->exception = 0;
+	emu->primask = 0;
+	emu->event = 0;
+	emu->waiting = ARM_EMULATOR_NOT_WAITING;
+	emu->idle_branch = 0xFFFFFFFF;
+	emu->idle_taken = 0;
+	emu->idle_valid = 0;
+	arm_emulator_flush_branch_cache(emu);
 }
 
 //================================================================================================================
@@ -388,10 +589,209 @@ arm_emulator_init(
 	emu->service_address = service_address;
 	emu->service_size = service_size;
 
+	emu->natives_count = 0;
+	emu->branch_cache_enabled = 0;
+	emu->regions_count = 0;
+
+	emu->i2c = NULL;
+	emu->services = NULL;
+	emu->svc_table = NULL;
+	emu->svc_count = 0;
+
+	emu->blocks = NULL;
+	emu->blocks_count = 0;
+	memset(emu->code_pages, 0, sizeof(emu->code_pages));
+	emu->code_page_shift = ARM_CODE_PAGE_SHIFT_MIN;
+	while (((size_t)ARM_CODE_PAGES << emu->code_page_shift) < data_memory_size)
+	{
+		++emu->code_page_shift;
+	}
+	emu->code_stale = 0;
+	emu->verified = NULL;
+
+	emu->liveness_threshold = 1;
+	emu->translate_threshold = 0;
+	emu->translations = NULL;
+	emu->translations_count = 0;
+	emu->tier_pins_count = 0;
+
+	emu->clock_ticks = 0;
+	emu->cycles = 0;
+	emu->cycles_limit = ARM_CYCLES_UNLIMITED;
+	emu->flash_wait_states = 0;
+	emu->timers_count = 0;
+	emu->next_check = UINT64_MAX;
+	memset(emu->vectors, 0, sizeof(emu->vectors));
+	emu->pending = 0;
+	emu->systick_reload = 0;
+	emu->events = 0;
+	emu->clock_reads = 0;
+	emu->idle_skipped = 0;
+	arm_emulator_set_clock(emu, ARM_CLOCK_INSTRUCTIONS_PER_MS, 0);
+
 	memset(emu->data, 0, emu->data_size);
 	arm_emulator_reset(emu);
 }
 
+//================================================================================================================
+/**
+ * Find the mapped region containing a range.
+ * @return Region, or NULL if the range is not entirely in one.
+ */
+static const struct arm_emulator_region *
+_find_region(
+	const struct arm_emulator_state *emu,
+	uint32_t addr,
+	uint32_t count)
+{
+	unsigned int	i;
+	for (i = 0; i < emu->regions_count; ++i)
+	{
+		const struct arm_emulator_region	*region = &emu->regions[i];
+		const uint32_t						offset = addr - region->address;
+		if (offset <= region->size && count <= region->size - offset)
+		{
+			return region;
+		}
+	}
+	return NULL;
+}
+
+//================================================================================================================
+/** Check whether [addr, addr+size) overlaps [base, base+base_size). */
+static int
+_overlaps(
+	uint32_t addr,
+	uint64_t size,
+	uint32_t base,
+	uint64_t base_size)
+{
+	return size > 0 && base_size > 0
+		&& addr < base + base_size
+		&& base < addr + size;
+}
+
+//================================================================================================================
+int
+arm_emulator_map_region(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint8_t *memory,
+	uint32_t size,
+	int writable)
+{
+	unsigned int	i;
+	unsigned int	slot = emu->regions_count;
+	if (_overlaps(address, size, emu->program_address, emu->program_size)
+		|| _overlaps(address, size, emu->data_address, emu->data_size)
+		|| _overlaps(address, size, emu->service_address, emu->service_size))
+	{
+		return -1;
+	}
+	for (i = 0; i < emu->regions_count; ++i)
+	{
+		if (emu->regions[i].address == address)
+		{
+			slot = i;
+		}
+		else if (_overlaps(address, size, emu->regions[i].address, emu->regions[i].size))
+		{
+			return -1;
+		}
+	}
+	if (slot >= ARM_REGIONS_MAX)
+	{
+		return -1;
+	}
+	emu->regions[slot].memory = memory;
+	emu->regions[slot].address = address;
+	emu->regions[slot].size = size;
+	emu->regions[slot].writable = writable != 0;
+	if (slot == emu->regions_count)
+	{
+		++emu->regions_count;
+	}
+	// The memory under an idle loop may have changed.
+	emu->idle_valid = 0;
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_unmap_region(
+	struct arm_emulator_state *emu,
+	uint32_t address)
+{
+	unsigned int	i;
+	for (i = 0; i < emu->regions_count; ++i)
+	{
+		if (emu->regions[i].address == address)
+		{
+			emu->regions[i] = emu->regions[--emu->regions_count];
+			emu->idle_valid = 0;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+//================================================================================================================
+const uint8_t *
+arm_emulator_host_pointer(
+	const struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t length)
+{
+	const uint32_t program_offset = address - emu->program_address;
+	const uint32_t data_offset = address - emu->data_address;
+	const uint32_t service_offset = address - emu->service_address;
+	if (program_offset <= emu->program_size && length <= emu->program_size - program_offset)
+	{
+		return emu->program + program_offset;
+	}
+	if (data_offset <= emu->data_size && length <= emu->data_size - data_offset)
+	{
+		return emu->data + data_offset;
+	}
+	if (service_offset <= emu->service_size && length <= emu->service_size - service_offset)
+	{
+		return emu->service + service_offset;
+	}
+	if (emu->regions_count > 0)
+	{
+		const struct arm_emulator_region *region = _find_region(emu, address, length);
+		if (region != NULL)
+		{
+			return region->memory + (address - region->address);
+		}
+	}
+	return NULL;
+}
+
+//================================================================================================================
+uint8_t *
+arm_emulator_host_data_pointer(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t length)
+{
+	const uint32_t data_offset = address - emu->data_address;
+	if (data_offset <= emu->data_size && length <= emu->data_size - data_offset)
+	{
+		arm_emulator_invalidate_code(emu, address, length);
+		return emu->data + data_offset;
+	}
+	if (emu->regions_count > 0)
+	{
+		const struct arm_emulator_region *region = _find_region(emu, address, length);
+		if (region != NULL && region->writable)
+		{
+			return region->memory + (address - region->address);
+		}
+	}
+	return NULL;
+}
+
 //================================================================================================================
 int
 arm_emulator_read_memory(
@@ -445,7 +845,16 @@ arm_emulator_read_memory(
 	}
 	else
 	{
+		const struct arm_emulator_region *region = emu->regions_count > 0
+			? _find_region(emu, address, (uint32_t)count)
+			: NULL;
+		if (region != NULL)
+		{
+			memcpy(buffer, region->memory + (address - region->address), count);
+			return 0;
+		}
 		/* Address outside all defined regions - try callback */
+		++emu->events;
 		return arm_emulator_callback_read_program_memory(emu, buffer, address, count);
 	}
 	return -1;
@@ -453,82 +862,478 @@ arm_emulator_read_memory(
 
 //================================================================================================================
 int
-arm_emulator_start_function_call(
+arm_emulator_register_native(
 	struct arm_emulator_state *emu,
-	const void *function_address,
-	const uint32_t *arguments,
-	unsigned int arguments_count)
+	uint32_t address,
+	arm_emulator_native_t function)
 {
 	unsigned int i;
-	_reset_registers(emu);
+	unsigned int j;
+	address &= 0xFFFFFFFE;
+	/* The address may have been cached as plain code. */
+	arm_emulator_flush_branch_cache(emu);
 
-	LR = EMULATOR_RETURN_ADDRESS;
-	PC = ((uint32_t)(uintptr_t)function_address) & ~(uint32_t)(1); /* thumb all the way! */
-	if (arguments != NULL && arguments_count > 0)
+	/* Find the insertion point; the table is kept sorted. */
+	for (i = 0; i < emu->natives_count && emu->natives[i].address < address; ++i)
 	{
-		for (i = 0; i < arguments_count && i < 4; ++i)
+	}
+	if (i < emu->natives_count && emu->natives[i].address == address)
+	{
+		if (function != NULL)
 		{
-			emu->R[i] = arguments[i];
+			emu->natives[i].function = function;
+		}
+		else
+		{
+			for (j = i + 1; j < emu->natives_count; ++j)
+			{
+				emu->natives[j - 1] = emu->natives[j];
+			}
+			--emu->natives_count;
 		}
+		return 0;
+	}
+	if (function == NULL)
+	{
+		return 0;
+	}
+	if (emu->natives_count >= ARM_NATIVE_FUNCTIONS_MAX)
+	{
+		uart_write_hex32("arm_emulator_register_native: table full, dropping 0x", address);
+		uart_write_crlf();
+		return -1;
+	}
+	for (j = emu->natives_count; j > i; --j)
+	{
+		emu->natives[j] = emu->natives[j - 1];
 	}
+	emu->natives[i].address = address;
+	emu->natives[i].function = function;
+	++emu->natives_count;
 	return 0;
 }
 
-#define	error_unknown_instruction()	\
-	do { \
-		uart_write_hex("arm_emulator_execute: unknown opcode 0x", i_h); \
-		uart_write_hex("", i_l); \
-		uart_write_hex32(" at 0x", prev_pc); \
-		uart_write_crlf(); \
-		return ARM_EMULATOR_ERROR; \
-	} while (0)
-
 //================================================================================================================
-static uint8_t
-_ConditionPassed(struct arm_emulator_state *emu, uint8_t cond)
+/** Move timer i to its place in the heap. */
+static void
+_timer_sift(
+	struct arm_emulator_state *emu,
+	unsigned int i)
 {
-	uint8_t r = 0; /* don't branch. */
-	switch (cond & 0x0E)
+	struct arm_emulator_timer		*h = emu->timers;
+	const struct arm_emulator_timer	t = h[i];
+	while (i > 0 && h[(i - 1) / 2].when > t.when)
 	{
-	case 0x00:
-		r = APSR_Z == 1; // EQ or NE
-		break;
-	case 0x02:
-		r = APSR_C == 1; // CS or CC
-		break;
-	case 0x04:
-		r = APSR_N == 1; // MI or PL
-		break;
-	case 0x06:
-		r = APSR_V == 1; // VS or VC
-		break;
-	case 0x08:
-		r = APSR_C==1 && APSR_Z==0;	// HI or LS
-		break;
-	case 0x0A:
-		r = APSR_N == APSR_V;	// GE or LT
-		break;
-	case 0x0C:
-		r = APSR_N==APSR_V && APSR_Z==0;	// GT or LE
-		break;
-	case 0x0E:
-		r = 1;
-		break;
+		h[i] = h[(i - 1) / 2];
+		i = (i - 1) / 2;
 	}
-	return ((cond & 1)!=0 && (cond!=0x0F))
-		? !r
-		: r;
+	for (;;)
+	{
+		unsigned int	c = 2 * i + 1;
+		if (c >= emu->timers_count)
+		{
+			break;
+		}
+		if (c + 1 < emu->timers_count && h[c + 1].when < h[c].when)
+		{
+			++c;
+		}
+		if (h[c].when >= t.when)
+		{
+			break;
+		}
+		h[i] = h[c];
+		i = c;
+	}
+	h[i] = t;
 }
 
 //================================================================================================================
-// Logical Shift Left.
-static uint32_t
-_LSL_C(
+static void
+_timer_remove(
 	struct arm_emulator_state *emu,
-	const uint32_t x,
-	const uint8_t shift_n)
+	unsigned int i)
 {
-	if (shift_n >= 32)
+	--emu->timers_count;
+	if (i < emu->timers_count)
+	{
+		emu->timers[i] = emu->timers[emu->timers_count];
+		_timer_sift(emu, i);
+	}
+}
+
+//================================================================================================================
+int
+arm_emulator_add_timer(
+	struct arm_emulator_state *emu,
+	uint64_t when,
+	arm_emulator_timer_t function,
+	uint32_t id)
+{
+	struct arm_emulator_timer	*t;
+	if (emu->timers_count >= ARM_TIMERS_MAX)
+	{
+		return -1;
+	}
+	t = &emu->timers[emu->timers_count++];
+	t->when = when;
+	t->function = function;
+	t->id = id;
+	_timer_sift(emu, emu->timers_count - 1);
+	if (when < emu->next_check)
+	{
+		emu->next_check = when;
+	}
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_remove_timer(
+	struct arm_emulator_state *emu,
+	arm_emulator_timer_t function,
+	uint32_t id)
+{
+	unsigned int	i;
+	for (i = 0; i < emu->timers_count; ++i)
+	{
+		if (emu->timers[i].function == function && emu->timers[i].id == id)
+		{
+			// next_check may now be early, which is harmless.
+			_timer_remove(emu, i);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+//================================================================================================================
+int
+arm_emulator_set_vector(
+	struct arm_emulator_state *emu,
+	unsigned int exception,
+	uint32_t handler)
+{
+	if (exception == 0 || exception >= ARM_EXCEPTIONS_MAX)
+	{
+		return -1;
+	}
+	emu->vectors[exception] = handler;
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_set_pending(
+	struct arm_emulator_state *emu,
+	unsigned int exception)
+{
+	if (exception == 0 || exception >= ARM_EXCEPTIONS_MAX || emu->vectors[exception] == 0)
+	{
+		return -1;
+	}
+	emu->pending |= (uint32_t)1 << exception;
+	emu->next_check = 0;
+	return 0;
+}
+
+//================================================================================================================
+static void
+_systick(struct arm_emulator_state *emu, uint32_t id, uint64_t when)
+{
+	arm_emulator_set_pending(emu, ARM_EXCEPTION_SYSTICK);
+	arm_emulator_add_timer(emu, when + emu->systick_reload, _systick, id);
+}
+
+//================================================================================================================
+int
+arm_emulator_set_systick(
+	struct arm_emulator_state *emu,
+	uint32_t reload)
+{
+	arm_emulator_remove_timer(emu, _systick, 0);
+	emu->systick_reload = reload;
+	return reload == 0 ? 0 : arm_emulator_add_timer(emu, emu->clock_ticks + reload, _systick, 0);
+}
+
+//================================================================================================================
+void
+arm_emulator_set_flash_wait_states(
+	struct arm_emulator_state *emu,
+	uint8_t wait_states)
+{
+	emu->flash_wait_states = wait_states;
+}
+
+//================================================================================================================
+void
+arm_emulator_signal_event(struct arm_emulator_state *emu)
+{
+	emu->event = 1;
+}
+
+//================================================================================================================
+int
+arm_emulator_set_clock(
+	struct arm_emulator_state *emu,
+	uint32_t instructions_per_ms,
+	uint32_t uptime_ms)
+{
+	if (instructions_per_ms == 0)
+	{
+		return -1;
+	}
+	emu->clock_origin = emu->clock_ticks;
+	emu->clock_uptime = uptime_ms;
+	emu->clock_rate = instructions_per_ms;
+	return 0;
+}
+
+//================================================================================================================
+uint32_t
+arm_emulator_get_uptime(const struct arm_emulator_state *emu)
+{
+	return emu->clock_uptime + (uint32_t)((emu->clock_ticks - emu->clock_origin) / emu->clock_rate);
+}
+
+//================================================================================================================
+void
+arm_emulator_advance_clock(
+	struct arm_emulator_state *emu,
+	uint32_t ms)
+{
+	emu->clock_ticks += (uint64_t)ms * emu->clock_rate;
+}
+
+//================================================================================================================
+int
+arm_emulator_native_get_uptime(struct arm_emulator_state *emu)
+{
+	emu->R[0] = arm_emulator_get_uptime(emu);
+	++emu->clock_reads;
+	return 0;
+}
+
+//================================================================================================================
+/** Common part of starting a call: entry point, return address, state. */
+static void
+_start_call(
+	struct arm_emulator_state *emu,
+	uint32_t function_address)
+{
+	LR = emu->return_address;
+	PC = function_address & ~(uint32_t)(1); /* thumb all the way! */
+	emu->call_sp = SP;
+	emu->call_pending = 1;
+	emu->exception = 0;
+	emu->waiting = ARM_EMULATOR_NOT_WAITING;
+	emu->idle_branch = 0xFFFFFFFF;
+	emu->idle_taken = 0;
+	emu->idle_valid = 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_start_function_call(
+	struct arm_emulator_state *emu,
+	const void *function_address,
+	const uint32_t *arguments,
+	unsigned int arguments_count)
+{
+	unsigned int i;
+	_reset_registers(emu);
+	if (emu->call_depth > 0)
+	{
+		SP = emu->call_sp;
+	}
+	_start_call(emu, (uint32_t)(uintptr_t)function_address);
+	emu->call_result = 0;
+	emu->call_result_size = 0;
+	if (arguments != NULL && arguments_count > 0)
+	{
+		for (i = 0; i < arguments_count && i < 4; ++i)
+		{
+			emu->R[i] = arguments[i];
+		}
+	}
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_start_call(
+	struct arm_emulator_state *emu,
+	uint32_t function_address,
+	const struct arm_emulator_arg *arguments,
+	unsigned int arguments_count,
+	uint32_t result_size,
+	unsigned int flags)
+{
+	const uint32_t	sp = (flags & ARM_CALL_WARM) || emu->call_depth > 0
+		? emu->call_sp
+		: emu->data_address + emu->data_size;
+	uint32_t		reg[4];
+	unsigned int	ncrn = result_size > 4 ? 1 : 0;
+	uint32_t		nsaa = 0;
+	uint32_t		frame;
+	uint32_t		result;
+	uint8_t			*stack;
+	unsigned int	i;
+
+	// Stack size: the arguments that do not fit in R0-R3.
+	for (i = 0; i < arguments_count; ++i)
+	{
+		if (arguments[i].size == 8)
+		{
+			ncrn = (ncrn + 1) & ~1u;
+			if (ncrn + 2 <= 4)
+			{
+				ncrn += 2;
+			}
+			else
+			{
+				ncrn = 4;
+				nsaa = ((nsaa + 7) & ~7u) + 8;
+			}
+		}
+		else if (arguments[i].size == 4)
+		{
+			if (ncrn < 4)
+			{
+				++ncrn;
+			}
+			else
+			{
+				nsaa += 4;
+			}
+		}
+		else
+		{
+			return -1;
+		}
+	}
+
+	// Stack: arguments at SP, the structure result above; 8-byte aligned.
+	result = ((sp & ~7u) - ((result_size + 7) & ~7u)) & ~7u;
+	frame = (result - nsaa) & ~7u;
+	stack = arm_emulator_host_data_pointer(emu, frame, sp - frame);
+	if (result_size > emu->data_size || stack == NULL)
+	{
+		return -1;
+	}
+
+	if (!(flags & ARM_CALL_WARM))
+	{
+		_reset_registers(emu);
+	}
+	SP = sp;
+	_start_call(emu, function_address);
+	SP = frame;
+	emu->call_result = result_size > 4 ? result : 0;
+	emu->call_result_size = result_size > 4 ? result_size : 0;
+
+	// Second pass: place the arguments.
+	memset(reg, 0, sizeof(reg));
+	ncrn = 0;
+	nsaa = 0;
+	if (result_size > 4)
+	{
+		reg[ncrn++] = result;
+	}
+	for (i = 0; i < arguments_count; ++i)
+	{
+		const uint32_t	lo = (uint32_t)arguments[i].value;
+		const uint32_t	hi = (uint32_t)(arguments[i].value >> 32);
+		if (arguments[i].size == 8)
+		{
+			ncrn = (ncrn + 1) & ~1u;
+			if (ncrn + 2 <= 4)
+			{
+				reg[ncrn++] = lo;
+				reg[ncrn++] = hi;
+			}
+			else
+			{
+				ncrn = 4;
+				nsaa = (nsaa + 7) & ~7u;
+				memcpy(stack + nsaa, &lo, 4);
+				memcpy(stack + nsaa + 4, &hi, 4);
+				nsaa += 8;
+			}
+		}
+		else if (ncrn < 4)
+		{
+			reg[ncrn++] = lo;
+		}
+		else
+		{
+			memcpy(stack + nsaa, &lo, 4);
+			nsaa += 4;
+		}
+	}
+	for (i = 0; i < 4; ++i)
+	{
+		emu->R[i] = reg[i];
+	}
+	emu->R[12] = 0;
+	return 0;
+}
+
+#define	error_unknown_instruction()	\
+	do { \
+		uart_write_hex("arm_emulator_execute: unknown opcode 0x", i_h); \
+		uart_write_hex("", i_l); \
+		uart_write_hex32(" at 0x", prev_pc); \
+		uart_write_crlf(); \
+		return ARM_EMULATOR_ERROR; \
+	} while (0)
+
+//================================================================================================================
+static uint8_t
+_ConditionPassed(struct arm_emulator_state *emu, uint8_t cond)
+{
+	uint8_t r = 0; /* don't branch. */
+	switch (cond & 0x0E)
+	{
+	case 0x00:
+		r = APSR_Z == 1; // EQ or NE
+		break;
+	case 0x02:
+		r = APSR_C == 1; // CS or CC
+		break;
+	case 0x04:
+		r = APSR_N == 1; // MI or PL
+		break;
+	case 0x06:
+		r = APSR_V == 1; // VS or VC
+		break;
+	case 0x08:
+		r = APSR_C==1 && APSR_Z==0;	// HI or LS
+		break;
+	case 0x0A:
+		r = APSR_N == APSR_V;	// GE or LT
+		break;
+	case 0x0C:
+		r = APSR_N==APSR_V && APSR_Z==0;	// GT or LE
+		break;
+	case 0x0E:
+		r = 1;
+		break;
+	}
+	return ((cond & 1)!=0 && (cond!=0x0F))
+		? !r
+		: r;
+}
+
+//================================================================================================================
+// Logical Shift Left.
+static uint32_t
+_LSL_C(
+	struct arm_emulator_state *emu,
+	const uint32_t x,
+	const uint8_t shift_n)
+{
+	if (shift_n >= 32)
 	{
 		const uint8_t carry = (shift_n == 32 ? (x & 1) : 0);
 		_set_APSR_of_NZC(0, carry);
@@ -603,6 +1408,39 @@ _ROR_C(
 	return r;
 }
 
+//================================================================================================================
+// Shifts without flags, for instructions whose flags are dead.
+static uint32_t
+_LSL(const uint32_t x, const uint8_t shift_n)
+{
+	return shift_n >= 32 ? 0 : x << shift_n;
+}
+
+static uint32_t
+_LSR(const uint32_t x, const uint8_t shift_n)
+{
+	return shift_n >= 32 ? 0 : x >> shift_n;
+}
+
+static uint32_t
+_ASR(const uint32_t x, const uint8_t shift_n)
+{
+	if (shift_n == 0)
+	{
+		return x;
+	}
+	return shift_n >= 32
+		? (uint32_t)(0 - (x >> 31))
+		: (uint32_t)_SignExtendTo32(x >> shift_n, (31 - shift_n) & 31);
+}
+
+static uint32_t
+_ROR(const uint32_t x, const uint8_t x_shift_n)
+{
+	const uint8_t shift_n = x_shift_n & 31;
+	return shift_n == 0 ? x : (x >> shift_n) | (x << (32 - shift_n));
+}
+
 //================================================================================================================
 typedef uint32_t (*shift_operation_t)(struct arm_emulator_state *, const uint32_t, const uint8_t);
 
@@ -615,7 +1453,7 @@ _shift_processing(
 	uint8_t Rm)
 {
 	const uint32_t x = emu->R[Rdn];
-	const uint32_t shift_n = emu->R[Rm];
+	const uint8_t shift_n = emu->R[Rm] & 0xFF;
 	if (shift_n > 0)
 	{
 		emu->R[Rdn] = shift_operation(emu, x, shift_n);
@@ -718,83 +1556,1231 @@ _fetch_data8(
 }
 
 //================================================================================================================
-static enum arm_emulator_result
-_store_data32(
+/**
+ * Store to a writable mapped region.
+ * @return Non-zero on success.
+ */
+static int
+_store_region(
 	struct arm_emulator_state *emu,
 	uint32_t addr,
-	uint32_t data)
+	const void *data,
+	uint32_t count)
 {
-	if (addr & 0x03)
+	const struct arm_emulator_region	*region = emu->regions_count > 0
+		? _find_region(emu, addr, count)
+		: NULL;
+	if (region == NULL || !region->writable)
 	{
-		// oops.
-		uart_write_hex32("_store_data32: 32-bit store to non-aligned address 0x", addr);
+		return 0;
+	}
+	memcpy(region->memory + (addr - region->address), data, count);
+	++emu->events;
+	return 1;
+}
+
+//================================================================================================================
+/**
+ * Discard cached blocks on bytes written in the data region. The range is
+ * at most 36 bytes, aligned, so it covers at most two pages.
+ */
+static void
+_data_written(
+	struct arm_emulator_state *emu,
+	uint32_t data_offset,
+	uint32_t count)
+{
+	const uint32_t	first = data_offset >> emu->code_page_shift;
+	const uint32_t	last = (data_offset + count - 1) >> emu->code_page_shift;
+	if (count > 0
+		&& ((emu->code_pages[first / 32] >> (first % 32) & 1) != 0
+			|| (emu->code_pages[last / 32] >> (last % 32) & 1) != 0))
+	{
+		arm_emulator_invalidate_code(emu, emu->data_address + data_offset, count);
+	}
+}
+
+//================================================================================================================
+static enum arm_emulator_result
+_store_data32(
+	struct arm_emulator_state *emu,
+	uint32_t addr,
+	uint32_t data)
+{
+	if (addr & 0x03)
+	{
+		// oops.
+		uart_write_hex32("_store_data32: 32-bit store to non-aligned address 0x", addr);
+		uart_write_crlf();
+		return ARM_EMULATOR_ERROR;
+	}
+	else
+	{
+		const uint32_t	data_offset = addr-emu->data_address;
+		if (data_offset < emu->data_size)
+		{
+			*((uint32_t*)(emu->data + data_offset)) = data;
+			_data_written(emu, data_offset, 4);
+			++emu->events;
+			return ARM_EMULATOR_OK;
+		}
+		if (_store_region(emu, addr, &data, 4))
+		{
+			return ARM_EMULATOR_OK;
+		}
+	}
+	uart_write_hex32("_store_data32: 32-bit store to invalid address 0x", addr);
+	uart_write_hex32(", data=0x", data);
+	uart_write_crlf();
+	return ARM_EMULATOR_ERROR;
+}
+
+//================================================================================================================
+static enum arm_emulator_result
+_store_data16(
+	struct arm_emulator_state *emu,
+	uint32_t addr,
+	uint32_t data)
+{
+	if (addr & 0x01)
+	{
+		uart_write_hex32("_store_data16: 16-bit store to non-aligned address 0x", addr);
+		uart_write_crlf();
+		return ARM_EMULATOR_ERROR;
+	}
+	else
+	{
+		const size_t data_offset = addr - emu->data_address;
+		if (data_offset < emu->data_size)
+		{
+			*((uint16_t *)(emu->data + data_offset)) = data;
+			_data_written(emu, (uint32_t)data_offset, 2);
+			++emu->events;
+			return ARM_EMULATOR_OK;
+		}
+		else
+		{
+			const uint16_t	x = (uint16_t)data;
+			if (_store_region(emu, addr, &x, 2))
+			{
+				return ARM_EMULATOR_OK;
+			}
+		}
+	}
+	uart_write_hex32("_store_data16: 16-bit store to invalid address 0x", addr);
+	uart_write_hex16(", data=0x", data & 0xFFFF);
+	uart_write_crlf();
+	return ARM_EMULATOR_ERROR;
+}
+
+//================================================================================================================
+static enum arm_emulator_result
+_store_data8(
+	struct arm_emulator_state *emu,
+	uint32_t addr,
+	uint32_t data)
+{
+	const size_t data_offset = addr - emu->data_address;
+	const uint8_t x = (uint8_t)data;
+	if (data_offset < emu->data_size)
+	{
+		*((uint8_t *)(emu->data + data_offset)) = data;
+		_data_written(emu, (uint32_t)data_offset, 1);
+		++emu->events;
+		return ARM_EMULATOR_OK;
+	}
+	else if (_store_region(emu, addr, &x, 1))
+	{
+		return ARM_EMULATOR_OK;
+	}
+	else
+	{
+		uart_write_hex32("_store_data8: 8-bit store to invalid address 0x", addr);
+		uart_write_hex(", data=0x", data & 0xFF);
+		uart_write_crlf();
+		return ARM_EMULATOR_ERROR;
+	}
+}
+
+//================================================================================================================
+/** Cycles left until cycles_limit. */
+static uint64_t
+_cycles_left(const struct arm_emulator_state *emu)
+{
+	return emu->cycles < emu->cycles_limit ? emu->cycles_limit - emu->cycles : 0;
+}
+
+//================================================================================================================
+static uint8_t
+_bit_count(uint8_t x)
+{
+	uint8_t n = 0;
+	for (; x != 0; x &= x - 1)
+	{
+		++n;
+	}
+	return n;
+}
+
+//================================================================================================================
+/**
+ * Validate a range against the data region.
+ * @param emu Emulator state.
+ * @param addr Start address.
+ * @param count Number of bytes.
+ * @return Pointer to the first byte, or NULL if the range is not entirely
+ *         in the data region.
+ */
+static uint8_t *
+_data_bytes(
+	struct arm_emulator_state *emu,
+	uint32_t addr,
+	uint32_t count)
+{
+	const uint32_t	data_offset = addr - emu->data_address;
+	if (data_offset <= emu->data_size && count <= emu->data_size - data_offset)
+	{
+		return emu->data + data_offset;
+	}
+	return NULL;
+}
+
+//================================================================================================================
+/**
+ * Validate a range against the data and program regions.
+ * @return Pointer to the first byte, or NULL.
+ */
+static const uint8_t *
+_readable_bytes(
+	struct arm_emulator_state *emu,
+	uint32_t addr,
+	uint32_t count)
+{
+	const uint32_t	program_offset = addr - emu->program_address;
+	if (program_offset <= emu->program_size && count <= emu->program_size - program_offset)
+	{
+		return emu->program + program_offset;
+	}
+	return _data_bytes(emu, addr, count);
+}
+
+//================================================================================================================
+/**
+ * Validate a block transfer against the data region.
+ * @param emu Emulator state.
+ * @param addr Start address.
+ * @param nwords Number of words.
+ * @return Pointer to the first word, or NULL if the range is unaligned or
+ *         not entirely in the data region.
+ */
+static uint32_t *
+_data_words(
+	struct arm_emulator_state *emu,
+	uint32_t addr,
+	uint32_t nwords)
+{
+	return (addr & 0x03) == 0
+		? (uint32_t *)_data_bytes(emu, addr, 4*nwords)
+		: NULL;
+}
+
+//================================================================================================================
+/**
+ * Exception entry: push R0-R3, R12, LR, PC and xPSR on an 8-byte aligned
+ * frame and branch to the handler with LR = EXC_RETURN.
+ * @param emu Emulator state, at an instruction boundary.
+ * @param exception Exception number, with a handler.
+ */
+static enum arm_emulator_result
+_exception_entry(
+	struct arm_emulator_state *emu,
+	uint8_t exception)
+{
+	const uint32_t	align = SP & 0x04;
+	const uint32_t	frame_address = (SP - 32) & ~(uint32_t)0x04;
+	uint32_t		*frame = _data_words(emu, frame_address, 8);
+	if (frame == NULL)
+	{
+		uart_write_hex32("_exception_entry: unable to push frame at 0x", frame_address);
 		uart_write_crlf();
 		return ARM_EMULATOR_ERROR;
 	}
-	else
+	frame[0] = emu->R[0];
+	frame[1] = emu->R[1];
+	frame[2] = emu->R[2];
+	frame[3] = emu->R[3];
+	frame[4] = emu->R[12];
+	frame[5] = LR;
+	frame[6] = PC;
+	frame[7] = (emu->APSR & 0xF0000000) | (1 << 24) | (align << 7) | emu->exception;
+	_data_written(emu, frame_address - emu->data_address, 32);
+	SP = frame_address;
+	LR = emu->exception != 0 ? 0xFFFFFFF1 : 0xFFFFFFF9;
+	PC = emu->vectors[exception] & 0xFFFFFFFE;
+	emu->exception = exception;
+	emu->pending &= ~((uint32_t)1 << exception);
+	emu->cycles += 16;
+	++emu->events;
+	return ARM_EMULATOR_OK;
+}
+
+//================================================================================================================
+/**
+ * Run due timers and take the highest priority pending exception.
+ * @param emu Emulator state, at an instruction boundary.
+ */
+static enum arm_emulator_result
+_run_timers(struct arm_emulator_state *emu)
+{
+	while (emu->timers_count > 0 && emu->timers[0].when <= emu->clock_ticks)
+	{
+		const struct arm_emulator_timer	t = emu->timers[0];
+		_timer_remove(emu, 0);
+		t.function(emu, t.id, t.when);
+	}
+	emu->next_check = emu->timers_count > 0 ? emu->timers[0].when : UINT64_MAX;
+	if (emu->pending != 0 && emu->exception == 0 && !emu->primask)
+	{
+		uint8_t	n = 0;
+		while ((emu->pending & ((uint32_t)1 << n)) == 0)
+		{
+			++n;
+		}
+		return _exception_entry(emu, n);
+	}
+	return ARM_EMULATOR_OK;
+}
+
+//================================================================================================================
+/** Instructions that may be skipped before the next timer is due, at most budget. */
+static unsigned int
+_skip_budget(
+	const struct arm_emulator_state *emu,
+	unsigned int budget)
+{
+	const uint64_t	left = emu->next_check > emu->clock_ticks ? emu->next_check - emu->clock_ticks : 0;
+	return left < budget ? (unsigned int)left : budget;
+}
+
+//================================================================================================================
+/** Element size of a register-offset STR/STRH/STRB (store) or LDR/LDRH/LDRB, 0 otherwise. */
+static uint8_t
+_element_size(
+	const uint16_t	x,
+	const uint8_t	store)
+{
+	switch (x >> 9)
+	{
+	case 0x28: return store ? 4 : 0;	// STR
+	case 0x29: return store ? 2 : 0;	// STRH
+	case 0x2A: return store ? 1 : 0;	// STRB
+	case 0x2C: return store ? 0 : 4;	// LDR
+	case 0x2D: return store ? 0 : 2;	// LDRH
+	case 0x2E: return store ? 0 : 1;	// LDRB
+	default: return 0;
+	}
+}
+
+//================================================================================================================
+/**
+ * Copy and fill loop idioms, checked when a backward BNE has been taken:
+ *
+ *   L: LDR{B,H} Rt, [Rs, Ri]        ; copy only
+ *      STR{B,H} Rt, [Rd, Ri]        ; Rv instead of Rt for fill
+ *      ADDS     Ri, #size
+ *      CMP      Ri, Rlim            ; or CMP Rlim, Ri
+ *      BNE      L
+ *
+ * The remaining iterations are run as one memmove/memset when the trip
+ * count is exact, the ranges are valid and do not overlap. Registers,
+ * flags and PC are left as if the loop had run.
+ *
+ * @param emu Emulator state, PC already set to the loop start.
+ * @param branch_pc Address of the BNE.
+ * @param budget Maximum number of instructions to consume.
+ * @return Number of instructions consumed, 0 if not recognised.
+ */
+static unsigned int
+_loop_idiom(
+	struct arm_emulator_state *emu,
+	uint32_t branch_pc,
+	unsigned int budget)
+{
+	const uint32_t	target = PC;
+	const unsigned int	length = (branch_pc - target) / 2 + 1;
+	uint16_t		body[4];
+	uint16_t		add, cmp, store;
+	uint8_t			Ri, Rlim, Rd, Rv, Rs = 0;
+	uint8_t			size;
+	uint32_t		n, k, bytes, dst_addr;
+	uint32_t		iteration_cycles;
+	uint8_t			*dst;
+
+	if (length != 4 && length != 5)
+	{
+		return 0;
+	}
+	if (arm_emulator_read_memory(emu, (uint8_t *)body, target, 2*(length - 1)) != 0)
+	{
+		return 0;
+	}
+	store = body[length - 4];
+	add = body[length - 3];
+	cmp = body[length - 2];
+
+	// ADDS Ri, #size; Encoding T2 or T1 with Rn==Rd.
+	if ((add & 0xF800) == 0x3000)
+	{
+		Ri = (add >> 8) & 0x07;
+		size = add & 0xFF;
+	}
+	else if ((add & 0xFE00) == 0x1C00 && ((add >> 3) & 0x07) == (add & 0x07))
+	{
+		Ri = add & 0x07;
+		size = (add >> 6) & 0x07;
+	}
+	else
+	{
+		return 0;
+	}
+	if (size != _element_size(store, 1))
+	{
+		return 0;
+	}
+
+	// CMP Ri, Rlim
+	if ((cmp & 0xFFC0) != 0x4280)
+	{
+		return 0;
+	}
+	Rlim = (cmp & 0x07) == Ri ? (cmp >> 3) & 0x07 : cmp & 0x07;
+	if (Rlim == Ri || (((cmp >> 3) & 0x07) != Ri && (cmp & 0x07) != Ri))
+	{
+		return 0;
+	}
+
+	// STR Rv, [Rd, Ri]
+	Rv = store & 0x07;
+	Rd = ((store >> 3) & 0x07) == Ri ? (store >> 6) & 0x07 : (store >> 3) & 0x07;
+	if (Rd == Ri || Rv == Ri || (((store >> 3) & 0x07) != Ri && ((store >> 6) & 0x07) != Ri))
+	{
+		return 0;
+	}
+
+	if (length == 5)
+	{
+		// LDR Rt, [Rs, Ri] with Rt==Rv.
+		const uint16_t	load = body[0];
+		if (_element_size(load, 0) != size || (load & 0x07) != Rv)
+		{
+			return 0;
+		}
+		Rs = ((load >> 3) & 0x07) == Ri ? (load >> 6) & 0x07 : (load >> 3) & 0x07;
+		if (Rs == Ri || Rv == Rs || Rv == Rd || Rv == Rlim
+			|| (((load >> 3) & 0x07) != Ri && ((load >> 6) & 0x07) != Ri))
+		{
+			return 0;
+		}
+	}
+
+	// Trip count.
+	if ((emu->R[Rlim] - emu->R[Ri]) % size != 0)
+	{
+		return 0;
+	}
+	n = (emu->R[Rlim] - emu->R[Ri]) / size;
+	k = n < budget / length ? n : budget / length;
+	// Each iteration takes 2*length-1 cycles: two per memory access, three
+	// for the taken BNE, and the wait states of the words fetched from flash.
+	iteration_cycles = 2 * length - 1;
+	if (target - emu->program_address < emu->program_size)
+	{
+		iteration_cycles += emu->flash_wait_states * ((length + ((target & 2) == 0)) / 2);
+	}
+	if (k > _cycles_left(emu) / iteration_cycles)
+	{
+		k = (uint32_t)(_cycles_left(emu) / iteration_cycles);
+	}
+	if (k == 0 || k > emu->data_size / size)
+	{
+		return 0;
+	}
+	bytes = k * size;
+	dst_addr = emu->R[Rd] + emu->R[Ri];
+	dst = (dst_addr & (size - 1)) == 0 ? _data_bytes(emu, dst_addr, bytes) : NULL;
+	if (dst == NULL)
+	{
+		return 0;
+	}
+	arm_emulator_invalidate_code(emu, dst_addr, bytes);
+
+	if (length == 5)
+	{
+		const uint32_t	src_addr = emu->R[Rs] + emu->R[Ri];
+		const uint8_t	*src = (src_addr & (size - 1)) == 0 ? _readable_bytes(emu, src_addr, bytes) : NULL;
+		if (src == NULL || (src_addr < dst_addr + bytes && dst_addr < src_addr + bytes))
+		{
+			return 0;
+		}
+		memmove(dst, src, bytes);
+		// Last element loaded.
+		emu->R[Rv] = 0;
+		memcpy(&emu->R[Rv], dst + bytes - size, size);
+	}
+	else if (size == 1)
+	{
+		memset(dst, (uint8_t)emu->R[Rv], bytes);
+	}
+	else
+	{
+		uint32_t	i;
+		for (i = 0; i < bytes; i += size)
+		{
+			memcpy(dst + i, &emu->R[Rv], size);
+		}
+	}
+	iprintf(("%04x:	<loop x%u>\n", target, k));
+	++emu->events;
+	emu->cycles += (uint64_t)k * iteration_cycles;
+
+	emu->R[Ri] += bytes;
+	_AddWithCarryDiscard(emu, emu->R[cmp & 0x07], ~emu->R[(cmp >> 3) & 0x07], 1);
+	if (k == n)
+	{
+		// The last BNE is not taken.
+		emu->cycles -= 2;
+		PC = branch_pc + 2;
+	}
+	return k * length;
+}
+
+/** Maximum size of an idle loop, in bytes. */
+#define	IDLE_LOOP_MAX_SIZE		64
+/** Iterations before an idle loop check. Keeps busy loops fast. */
+#define	IDLE_LOOP_THRESHOLD		64
+
+//================================================================================================================
+/**
+ * Idle loop detection, checked when a short backward branch has been
+ * taken. An iteration without events that ends in the same registers and
+ * flags as the previous one will repeat identically: memory cannot change
+ * until arm_emulator_execute() returns, and the virtual clock until the
+ * next millisecond. The remaining iterations up to that point are skipped,
+ * in whole iterations, with the virtual clock advanced as if they had run.
+ *
+ * @param emu Emulator state, PC already set to the loop start.
+ * @param branch_pc Address of the branch.
+ * @param budget Maximum number of instructions to skip.
+ * @return Number of instructions skipped.
+ */
+static unsigned int
+_idle_loop(
+	struct arm_emulator_state *emu,
+	uint32_t branch_pc,
+	unsigned int budget)
+{
+	uint64_t	n = budget;
+	uint32_t	length;
+	uint64_t	cycles;
+	if (branch_pc != emu->idle_branch)
+	{
+		emu->idle_branch = branch_pc;
+		emu->idle_taken = 0;
+		emu->idle_valid = 0;
+		return 0;
+	}
+	if (emu->idle_taken < IDLE_LOOP_THRESHOLD)
+	{
+		++emu->idle_taken;
+		return 0;
+	}
+	if (!emu->idle_valid
+		|| emu->events != emu->idle_events
+		|| emu->APSR != emu->idle_APSR
+		|| memcmp(emu->R, emu->idle_R, sizeof(emu->R)) != 0)
+	{
+		memcpy(emu->idle_R, emu->R, sizeof(emu->R));
+		emu->idle_APSR = emu->APSR;
+		emu->idle_events = emu->events;
+		emu->idle_clock_reads = emu->clock_reads;
+		emu->idle_ticks = emu->clock_ticks;
+		emu->idle_cycles = emu->cycles;
+		emu->idle_valid = 1;
+		return 0;
+	}
+
+	length = (uint32_t)(emu->clock_ticks - emu->idle_ticks);
+	cycles = emu->cycles - emu->idle_cycles;
+	if (n / length > _cycles_left(emu) / cycles)
+	{
+		n = _cycles_left(emu) / cycles * length;
+	}
+	if (emu->clock_reads != emu->idle_clock_reads)
+	{
+		// Skipped iterations must not reach the next millisecond.
+		const uint64_t	next = emu->clock_rate - (emu->clock_ticks - emu->clock_origin) % emu->clock_rate;
+		if (next - 1 < n)
+		{
+			n = next - 1;
+		}
+	}
+	n -= n % length;
+	iprintf(("%04x:	<idle x%u>\n", PC, (unsigned int)(n / length)));
+
+	emu->clock_ticks += n;
+	emu->cycles += n / length * cycles;
+	emu->idle_skipped += n;
+	emu->idle_clock_reads = emu->clock_reads;
+	emu->idle_ticks = emu->clock_ticks;
+	emu->idle_cycles = emu->cycles;
+	return (unsigned int)n;
+}
+
+//================================================================================================================
+int
+arm_emulator_native_mem_copy(struct arm_emulator_state *emu)
+{
+	const uint32_t count = emu->R[2];
+	uint8_t *dst = _data_bytes(emu, emu->R[0], count);
+	const uint8_t *src = _readable_bytes(emu, emu->R[1], count);
+	if (dst == NULL || src == NULL)
+	{
+		return -1;
+	}
+	arm_emulator_invalidate_code(emu, emu->R[0], count);
+	memmove(dst, src, count);
+	/* emu->R[0] = dst already. */
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_native_mem_set(struct arm_emulator_state *emu)
+{
+	const uint32_t count = emu->R[2];
+	uint8_t *dst = _data_bytes(emu, emu->R[0], count);
+	if (dst == NULL)
+	{
+		return -1;
+	}
+	arm_emulator_invalidate_code(emu, emu->R[0], count);
+	memset(dst, (uint8_t)emu->R[1], count);
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_native_mem_compare(struct arm_emulator_state *emu)
+{
+	const uint32_t count = emu->R[2];
+	const uint8_t *a = _readable_bytes(emu, emu->R[0], count);
+	const uint8_t *b = _readable_bytes(emu, emu->R[1], count);
+	uint32_t i;
+	if (a == NULL || b == NULL)
+	{
+		return -1;
+	}
+	emu->R[0] = 0;
+	for (i = 0; i < count; ++i)
+	{
+		if (a[i] != b[i])
+		{
+			emu->R[0] = (uint32_t)((int32_t)a[i] - (int32_t)b[i]);
+			break;
+		}
+	}
+	return 0;
+}
+
+//================================================================================================================
+/** CRC-32 of one nibble, reflected polynomial 0xEDB88320. */
+static const uint32_t _crc32_nibble[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+//================================================================================================================
+int
+arm_emulator_native_crc32(struct arm_emulator_state *emu)
+{
+	const uint32_t count = emu->R[2];
+	const uint8_t *p = _readable_bytes(emu, emu->R[1], count);
+	uint32_t crc = ~emu->R[0];
+	uint32_t i;
+	if (p == NULL)
+	{
+		return -1;
+	}
+	for (i = 0; i < count; ++i)
+	{
+		crc ^= p[i];
+		crc = (crc >> 4) ^ _crc32_nibble[crc & 0x0F];
+		crc = (crc >> 4) ^ _crc32_nibble[crc & 0x0F];
+	}
+	emu->R[0] = ~crc;
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_call_native(
+	struct arm_emulator_state *emu,
+	uint32_t address)
+{
+	const arm_emulator_native_t native = emu->natives_count > 0
+		? _find_native(emu, address & 0xFFFFFFFE)
+		: NULL;
+	if (native != NULL)
+	{
+		const int r = native(emu);
+		if (r >= 0)
+		{
+			return r;
+		}
+	}
+	return arm_emulator_callback_functioncall(emu, address) == 0 ? 0 : -1;
+}
+
+//================================================================================================================
+void
+arm_emulator_set_svc_table(
+	struct arm_emulator_state *emu,
+	const arm_emulator_native_t *table,
+	unsigned int count)
+{
+	emu->svc_table = table;
+	emu->svc_count = table != NULL ? count : 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_call_svc(
+	struct arm_emulator_state *emu,
+	uint8_t number)
+{
+	if (number >= emu->svc_count || emu->svc_table[number] == NULL)
+	{
+		return -1;
+	}
+	++emu->events;
+	return emu->svc_table[number](emu);
+}
+
+//================================================================================================================
+int
+arm_emulator_set_block_cache(
+	struct arm_emulator_state *emu,
+	struct arm_emulator_block *blocks,
+	unsigned int blocks_count)
+{
+	if (blocks != NULL && (blocks_count == 0 || (blocks_count & (blocks_count - 1)) != 0))
+	{
+		uart_write_hex32("arm_emulator_set_block_cache: size not a power of two: 0x", blocks_count);
+		uart_write_crlf();
+		return -1;
+	}
+	emu->blocks = blocks;
+	emu->blocks_count = blocks != NULL ? blocks_count : 0;
+	arm_emulator_flush_block_cache(emu);
+	return 0;
+}
+
+//================================================================================================================
+void
+arm_emulator_flush_block_cache(struct arm_emulator_state *emu)
+{
+	unsigned int i;
+	for (i = 0; i < emu->blocks_count; ++i)
+	{
+		emu->blocks[i].address = ARM_BLOCK_UNUSED;
+		emu->blocks[i].hits = 0;
+	}
+	memset(emu->code_pages, 0, sizeof(emu->code_pages));
+	emu->code_stale = 1;
+}
+
+//================================================================================================================
+/* Discard the blocks on one page of the data region. */
+static void
+_invalidate_page(
+	struct arm_emulator_state *emu,
+	uint32_t page)
+{
+	const uint32_t	start = emu->data_address + (page << emu->code_page_shift);
+	const uint32_t	end = start + ((uint32_t)1 << emu->code_page_shift);
+	unsigned int	i;
+	emu->code_pages[page / 32] &= ~((uint32_t)1 << (page % 32));
+	for (i = 0; i < emu->blocks_count; ++i)
+	{
+		struct arm_emulator_block *block = &emu->blocks[i];
+		if (block->address != ARM_BLOCK_UNUSED && block->address < end && block->address + block->size > start)
+		{
+			block->address = ARM_BLOCK_UNUSED;
+		}
+	}
+	emu->code_stale = 1;
+}
+
+//================================================================================================================
+void
+arm_emulator_invalidate_code(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t size)
+{
+	const uint32_t	data_offset = address - emu->data_address;
+	uint32_t		page;
+	uint32_t		last;
+	if (size == 0 || data_offset >= emu->data_size)
+	{
+		return;
+	}
+	last = (size > emu->data_size - data_offset ? (uint32_t)emu->data_size - 1 : data_offset + size - 1)
+		>> emu->code_page_shift;
+	for (page = data_offset >> emu->code_page_shift; page <= last; ++page)
+	{
+		if ((emu->code_pages[page / 32] >> (page % 32) & 1) != 0)
+		{
+			_invalidate_page(emu, page);
+		}
+	}
+}
+
+//================================================================================================================
+/** Check whether the instruction at pc was verified by arm_verify(). */
+static int
+_is_verified(
+	const struct arm_emulator_state *emu,
+	uint32_t pc)
+{
+	const uint32_t	offset = pc - emu->program_address;
+	return emu->verified != NULL
+		&& offset < emu->program_size
+		&& (emu->verified[offset / 64] >> ((offset / 2) % 32) & 1) != 0;
+}
+
+//================================================================================================================
+void
+arm_emulator_set_verified(
+	struct arm_emulator_state *emu,
+	const uint32_t *bitmap)
+{
+	emu->verified = bitmap;
+}
+
+//================================================================================================================
+/**
+ * Memory holding code at pc, in the program or data region.
+ * @param size Set to the number of bytes from pc to the end of the region.
+ * @return Pointer to the code, or NULL if pc is in neither region.
+ */
+static const uint8_t *
+_code_memory(
+	const struct arm_emulator_state *emu,
+	uint32_t pc,
+	uint32_t *size)
+{
+	const uint32_t	program_offset = pc - emu->program_address;
+	const uint32_t	data_offset = pc - emu->data_address;
+	if (program_offset < emu->program_size)
+	{
+		*size = (uint32_t)emu->program_size - program_offset;
+		return emu->program + program_offset;
+	}
+	if (data_offset < emu->data_size)
+	{
+		*size = (uint32_t)emu->data_size - data_offset;
+		return emu->data + data_offset;
+	}
+	return NULL;
+}
+
+//================================================================================================================
+/**
+ * Find the extent of the block starting at pc and the flag updates in it
+ * that are dead. Only the flags_dead mask is kept; the interpreter decodes
+ * the instructions again on every execution. Pages of the data region
+ * holding the block are tracked for writes.
+ * @return Number of instructions, 0 if no block could be built.
+ */
+static uint8_t
+_build_block(
+	struct arm_emulator_state *emu,
+	uint32_t pc,
+	struct arm_emulator_block *block)
+{
+	uint8_t			written[ARM_BLOCK_MAX_INSTRUCTIONS];
+	uint8_t			killed[ARM_BLOCK_MAX_INSTRUCTIONS];
+	uint8_t			read[ARM_BLOCK_MAX_INSTRUCTIONS];
+	uint8_t			live = ARM_FLAGS_ALL;
+	uint8_t			n = 0;
+	uint32_t		offset = 0;
+	uint32_t		size = 0;
+	const uint8_t	*code = _code_memory(emu, pc, &size);
+	int				i;
+
+	block->address = ARM_BLOCK_UNUSED;
+	while (code != NULL && n < ARM_BLOCK_MAX_INSTRUCTIONS && offset + 2 <= size)
+	{
+		const uint16_t	instruction = code[offset] | (code[offset + 1] << 8);
+		uint16_t		instruction2 = 0;
+		struct arm_insn	insn;
+		if (arm_decode_is_32bit(instruction))
+		{
+			if (offset + 4 > size)
+			{
+				break;
+			}
+			instruction2 = code[offset + 2] | (code[offset + 3] << 8);
+		}
+		arm_decode(pc + offset, instruction, instruction2, &insn);
+		if (insn.kind == ARM_INSN_INVALID)
+		{
+			break;
+		}
+		written[n] = insn.flags_written;
+		killed[n] = insn.flags_killed;
+		// Memory accesses may reach a callback, where the flags are exact.
+		read[n] = insn.access
+			|| (insn.kind == ARM_INSN_LOAD_LITERAL && insn.target - emu->program_address >= emu->program_size)
+			? ARM_FLAGS_ALL
+			: insn.flags_read;
+		++n;
+		offset += insn.size;
+		if (insn.kind >= ARM_INSN_BRANCH)
+		{
+			break;
+		}
+	}
+	if (n == 0)
+	{
+		return 0;
+	}
+
+	// Flags are live at the block exit.
+	block->flags_dead = 0;
+	for (i = n - 1; i >= 0; --i)
+	{
+		if (written[i] != 0 && (written[i] & live) == 0)
+		{
+			block->flags_dead |= 1UL << i;
+		}
+		live = (live & ~killed[i]) | read[i];
+	}
+	block->address = pc;
+	block->count = n;
+	block->size = (uint8_t)offset;
+	if (pc - emu->data_address < emu->data_size)
+	{
+		uint32_t	page;
+		for (page = (pc - emu->data_address) >> emu->code_page_shift;
+			page <= (pc - emu->data_address + offset - 1) >> emu->code_page_shift;
+			++page)
+		{
+			emu->code_pages[page / 32] |= (uint32_t)1 << (page % 32);
+		}
+	}
+	return n;
+}
+
+//================================================================================================================
+/** Tier that blocks starting at pc are pinned to, or ARM_TIER_AUTO. */
+static uint8_t
+_pinned_tier(
+	const struct arm_emulator_state *emu,
+	uint32_t pc)
+{
+	unsigned int i;
+	for (i = 0; i < emu->tier_pins_count; ++i)
+	{
+		if (pc - emu->tier_pins[i].address < emu->tier_pins[i].size)
+		{
+			return emu->tier_pins[i].tier;
+		}
+	}
+	return ARM_TIER_AUTO;
+}
+
+//================================================================================================================
+/** Translation of the function at address, or NULL. */
+static arm_emulator_native_t
+_find_translation(
+	const struct arm_emulator_state *emu,
+	uint32_t address)
+{
+	unsigned int i;
+	for (i = 0; i < emu->translations_count; ++i)
+	{
+		if ((emu->translations[i].address & 0xFFFFFFFE) == address)
+		{
+			return emu->translations[i].function;
+		}
+	}
+	return NULL;
+}
+
+//================================================================================================================
+/** Bind the translation of the function at address, if there is one and the native table has room. */
+static void
+_bind_translation(
+	struct arm_emulator_state *emu,
+	uint32_t address)
+{
+	const arm_emulator_native_t	function = _find_translation(emu, address);
+	if (function != NULL && _find_native(emu, address) == NULL)
+	{
+		arm_emulator_register_native(emu, address, function);
+	}
+}
+
+//================================================================================================================
+void
+arm_emulator_set_tier_thresholds(
+	struct arm_emulator_state *emu,
+	uint16_t liveness_threshold,
+	uint16_t translate_threshold)
+{
+	emu->liveness_threshold = liveness_threshold == 0 ? 1
+		: liveness_threshold < 0xFFFF ? liveness_threshold
+		: 0xFFFE;
+	// Executions are counted on in the block cache, so translation comes later.
+	emu->translate_threshold = translate_threshold == 0 || translate_threshold > emu->liveness_threshold
+		? translate_threshold
+		: emu->liveness_threshold + 1;
+}
+
+//================================================================================================================
+void
+arm_emulator_set_translations(
+	struct arm_emulator_state *emu,
+	const struct arm_emulator_native_function *translations,
+	unsigned int count)
+{
+	emu->translations = translations;
+	emu->translations_count = translations != NULL ? count : 0;
+}
+
+//================================================================================================================
+int
+arm_emulator_pin_tier(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t size,
+	uint8_t tier)
+{
+	unsigned int i;
+	for (i = 0; i < emu->tier_pins_count; ++i)
+	{
+		if (emu->tier_pins[i].address == address && emu->tier_pins[i].size == size)
+		{
+			break;
+		}
+	}
+	if (tier == ARM_TIER_AUTO)
+	{
+		if (i < emu->tier_pins_count)
+		{
+			emu->tier_pins[i] = emu->tier_pins[--emu->tier_pins_count];
+		}
+		return 0;
+	}
+	if (i == emu->tier_pins_count)
+	{
+		if (emu->tier_pins_count >= ARM_TIER_PINS_MAX)
+		{
+			uart_write_hex32("arm_emulator_pin_tier: table full, dropping 0x", address);
+			uart_write_crlf();
+			return -1;
+		}
+		++emu->tier_pins_count;
+	}
+	emu->tier_pins[i].address = address;
+	emu->tier_pins[i].size = size;
+	emu->tier_pins[i].tier = tier;
+	arm_emulator_flush_tiers(emu, address, size);
+	if (tier == ARM_TIER_TRANSLATED)
+	{
+		for (i = 0; i < emu->translations_count; ++i)
+		{
+			const uint32_t	x = emu->translations[i].address & 0xFFFFFFFE;
+			if (x - address < size)
+			{
+				_bind_translation(emu, x);
+			}
+		}
+	}
+	return 0;
+}
+
+//================================================================================================================
+void
+arm_emulator_flush_tiers(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t size)
+{
+	unsigned int i;
+	for (i = 0; i < emu->blocks_count; ++i)
+	{
+		struct arm_emulator_block *block = &emu->blocks[i];
+		if (block->address != ARM_BLOCK_UNUSED && block->address - address < size)
+		{
+			block->address = ARM_BLOCK_UNUSED;
+			block->hits = 0;
+		}
+	}
+	for (i = 0; i < emu->translations_count; ++i)
 	{
-		const uint32_t	data_offset = addr-emu->data_address;
-		if (data_offset < emu->data_size)
+		const uint32_t	x = emu->translations[i].address & 0xFFFFFFFE;
+		if (x - address < size && _find_native(emu, x) == emu->translations[i].function)
 		{
-			*((uint32_t*)(emu->data + data_offset)) = data;
-			return ARM_EMULATOR_OK;
+			arm_emulator_register_native(emu, x, NULL);
 		}
 	}
-	uart_write_hex32("_store_data32: 32-bit store to invalid address 0x", addr);
-	uart_write_hex32(", data=0x", data);
-	uart_write_crlf();
-	return ARM_EMULATOR_ERROR;
+	emu->code_stale = 1;
 }
 
 //================================================================================================================
-static enum arm_emulator_result
-_store_data16(
-	struct arm_emulator_state *emu,
-	uint32_t addr,
-	uint32_t data)
+void
+arm_emulator_inspect_tiers(
+	const struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t size,
+	struct arm_emulator_tier_stats *stats)
 {
-	if (addr & 0x01)
+	unsigned int i;
+	stats->counting = 0;
+	stats->flag_liveness = 0;
+	stats->translated = 0;
+	for (i = 0; i < emu->blocks_count; ++i)
 	{
-		uart_write_hex32("_store_data16: 16-bit store to non-aligned address 0x", addr);
-		uart_write_crlf();
-		return ARM_EMULATOR_ERROR;
+		const struct arm_emulator_block *block = &emu->blocks[i];
+		if (block->address != ARM_BLOCK_UNUSED && block->address - address < size)
+		{
+			if (block->count > 0)
+			{
+				++stats->flag_liveness;
+			}
+			else
+			{
+				++stats->counting;
+			}
+		}
 	}
-	else
+	for (i = 0; i < emu->translations_count; ++i)
 	{
-		const size_t data_offset = addr - emu->data_address;
-		if (data_offset < emu->data_size)
+		const uint32_t	x = emu->translations[i].address & 0xFFFFFFFE;
+		if (x - address < size && _find_native(emu, x) == emu->translations[i].function)
 		{
-			*((uint16_t *)(emu->data + data_offset)) = data;
-			return ARM_EMULATOR_OK;
+			++stats->translated;
 		}
 	}
-	uart_write_hex32("_store_data16: 16-bit store to invalid address 0x", addr);
-	uart_write_hex16(", data=0x", data & 0xFFFF);
-	uart_write_crlf();
-	return ARM_EMULATOR_ERROR;
 }
 
 //================================================================================================================
-static enum arm_emulator_result
-_store_data8(
+/**
+ * Look up the block starting at pc, building it if necessary.
+ * @return Block, or NULL if pc is outside the program and data regions.
+ */
+static const struct arm_emulator_block *
+_get_block(
 	struct arm_emulator_state *emu,
-	uint32_t addr,
-	uint32_t data)
+	uint32_t pc)
 {
-	const size_t data_offset = addr - emu->data_address;
-	if (data_offset < emu->data_size)
+	struct arm_emulator_block	*block = &emu->blocks[(pc >> 1) & (emu->blocks_count - 1)];
+	uint16_t					hits;
+	if (block->address == pc && block->count > 0)
 	{
-		*((uint8_t *)(emu->data + data_offset)) = data;
-		return ARM_EMULATOR_OK;
+		if (block->hits < 0xFFFF)
+		{
+			++block->hits;
+		}
+		if (block->hits == emu->translate_threshold && emu->translations_count > 0
+			&& _pinned_tier(emu, pc) == ARM_TIER_AUTO)
+		{
+			_bind_translation(emu, pc);
+		}
+		return block;
 	}
-	else
+	if (pc - emu->program_address >= emu->program_size && pc - emu->data_address >= emu->data_size)
 	{
-		uart_write_hex32("_store_data8: 8-bit store to invalid address 0x", addr);
-		uart_write_hex(", data=0x", data & 0xFF);
-		return ARM_EMULATOR_ERROR;
+		return NULL;
+	}
+	if (emu->liveness_threshold > 1 || emu->tier_pins_count > 0)
+	{
+		const uint8_t	tier = _pinned_tier(emu, pc);
+		if (tier == ARM_TIER_INTERPRETER)
+		{
+			return NULL;
+		}
+		if (tier == ARM_TIER_AUTO && emu->liveness_threshold > 1)
+		{
+			// Count executions; a competing block ages the entry first.
+			if (block->address != pc)
+			{
+				block->hits >>= 1;
+				if (block->hits > 0)
+				{
+					return NULL;
+				}
+				block->address = pc;
+				block->count = 0;
+				block->size = 0;
+			}
+			if (block->hits < 0xFFFF)
+			{
+				++block->hits;
+			}
+			if (block->hits < emu->liveness_threshold)
+			{
+				return NULL;
+			}
+		}
+	}
+	hits = block->address == pc ? block->hits : 1;
+	if (_build_block(emu, pc, block) == 0)
+	{
+		return NULL;
 	}
+	block->hits = hits;
+	return block;
 }
 
+//================================================================================================================
+// Flag updates, skipped when the block analysis found the flags dead.
+#define	_AddWithCarry_live(Rd, x1, x2, carry) \
+	do { \
+		if (flags_dead) { \
+			emu->R[Rd] = (x1) + (x2) + (carry); \
+		} else { \
+			_AddWithCarry(emu, Rd, x1, x2, carry); \
+		} \
+	} while (0)
+#define	_AddWithCarryDiscard_live(x1, x2, carry) \
+	do { if (!flags_dead) { _AddWithCarryDiscard(emu, x1, x2, carry); } } while (0)
+#define	_set_APSR_of_NZC_live(x, c) \
+	do { if (!flags_dead) { _set_APSR_of_NZC(x, c); } } while (0)
+#define	_set_APSR_of_NZ_live(x) \
+	do { if (!flags_dead) { _set_APSR_of_NZ(x); } } while (0)
+#define	_shift_processing_immediate_live(op_C, op, Rd, Rm, shift_n) \
+	do { \
+		if (flags_dead) { \
+			emu->R[Rd] = op(emu->R[Rm], shift_n); \
+		} else { \
+			_shift_processing_immediate(emu, op_C, Rd, Rm, shift_n); \
+		} \
+	} while (0)
+#define	_shift_processing_live(op_C, op, Rdn, Rm) \
+	do { \
+		if (flags_dead) { \
+			emu->R[Rdn] = op(emu->R[Rdn], (uint8_t)emu->R[Rm]); \
+		} else { \
+			_shift_processing(emu, op_C, Rdn, Rm); \
+		} \
+	} while (0)
+
 //================================================================================================================
 enum arm_emulator_result
 arm_emulator_execute(
@@ -802,12 +2788,88 @@ arm_emulator_execute(
 	unsigned int max_instructions)
 {
 	unsigned int instruction_count;
+	uint8_t		block_remaining = 0;
+	uint32_t	block_next = 0;
+	uint32_t	dead_mask = 0;
+	uint8_t		cold = 0;
+	// Address of the instruction following a verified one, odd if none.
+	uint32_t	verified_next = 1;
+	// Memory may have changed since the last call.
+	emu->idle_valid = 0;
+	if (emu->waiting == ARM_EMULATOR_WAIT_FOR_EVENT)
+	{
+		// The WFE wakes up and consumes the event.
+		emu->event = 0;
+	}
+	emu->waiting = ARM_EMULATOR_NOT_WAITING;
+	if (emu->call_pending)
+	{
+		// Calls into a native function do not need the interpreter.
+		emu->call_pending = 0;
+		if (emu->natives_count > 0 && _find_native(emu, PC) != NULL)
+		{
+			set_PC(PC);
+		}
+	}
 	for (instruction_count = 0; instruction_count < max_instructions; ++instruction_count)
 	{
 		uint16_t		instruction;
-		if (arm_emulator_read_memory(emu, (uint8_t *)(&instruction), PC, 2) == 0)
+		int				fetched;
+		if (emu->cycles >= emu->cycles_limit && block_remaining == 0)
+		{
+			break;
+		}
+		if (emu->clock_ticks >= emu->next_check && block_remaining == 0)
+		{
+			const enum arm_emulator_result	r = _run_timers(emu);
+			// An exception may have been taken.
+			verified_next = 1;
+			if (r != ARM_EMULATOR_OK)
+			{
+				return r;
+			}
+		}
+		++emu->clock_ticks;
+		if (PC == verified_next || _is_verified(emu, PC))
+		{
+			// Verified code: in the program region and decodable.
+			const uint32_t	offset = PC - emu->program_address;
+			instruction = emu->program[offset] | (emu->program[offset + 1] << 8);
+			verified_next = PC + (arm_decode_is_32bit(instruction) ? 4 : 2);
+			fetched = 0;
+		}
+		else
+		{
+			fetched = arm_emulator_read_memory(emu, (uint8_t *)(&instruction), PC, 2);
+			verified_next = 1;
+		}
+		if (fetched == 0)
 		{
 			const uint32_t	prev_pc = PC;
+			uint8_t			flags_dead = 0;
+			if (emu->blocks != NULL)
+			{
+				if ((block_remaining == 0 && !cold) || prev_pc != block_next || emu->code_stale)
+				{
+					const struct arm_emulator_block	*block;
+					emu->code_stale = 0;
+					block = _get_block(emu, prev_pc);
+					block_remaining = block != NULL ? block->count : 0;
+					// Cold code is not looked up again until the next branch.
+					cold = block == NULL;
+					// Stale flags are allowed only if the whole block runs.
+					dead_mask = (block != NULL && max_instructions - instruction_count >= block->count)
+						? block->flags_dead
+						: 0;
+				}
+				if (block_remaining > 0)
+				{
+					flags_dead = dead_mask & 1;
+					dead_mask >>= 1;
+					--block_remaining;
+				}
+				block_next = prev_pc + (arm_decode_is_32bit(instruction) ? 4 : 2);
+			}
 			// Little-Endian?
 #define	i_l	((uint8_t)instruction)
 #define	i_h	((uint8_t)(instruction >> 8))
@@ -816,6 +2878,11 @@ arm_emulator_execute(
 			const uint8_t	opcode3bits = i_h & 0xE0;
 			const uint8_t	opcode4bits = i_h & 0xF0;
 			const uint8_t	opcode5bits = i_h & 0xF8;
+			emu->cycles += arm_decode_cycles[i_h >> 3];
+			if ((prev_pc & 2) == 0 && prev_pc - emu->program_address < emu->program_size)
+			{
+				emu->cycles += emu->flash_wait_states;
+			}
 			PC += 2;
 			if (opcode2bits==0)
 			{
@@ -832,21 +2899,21 @@ arm_emulator_execute(
 					// pp00 0xxp
 					// LSL (Logical Shift Left, immediate)
 					_print_RRx("LSLS", Rdn, Rm, imm5);
-					_shift_processing_immediate(emu, _LSL_C, Rdn, Rm, imm5);
+					_shift_processing_immediate_live(_LSL_C, _LSL, Rdn, Rm, imm5);
 				}
 				else if (scode3bits==0x08)
 				{
 					// pp00 1xxp
 					// LSR (Logical Shift Right, immediate)
 					_print_RRx("LSR", Rdn, Rm, imm5==0 ? 32 : imm5);
-					_shift_processing_immediate(emu, _LSR_C, Rdn, Rm, imm5==0 ? 32 : imm5);
+					_shift_processing_immediate_live(_LSR_C, _LSR, Rdn, Rm, imm5==0 ? 32 : imm5);
 				}
 				else if (scode3bits==0x10)
 				{
 					// pp01 0xxp
 					// ASR (Arithmetic Shift Right)
 					_print_RRx("ASR", Rdn, Rm, imm5==0 ? 32 : imm5);
-					_shift_processing_immediate(emu, _ASR_C, Rdn, Rm, imm5==0 ? 32 : imm5);
+					_shift_processing_immediate_live(_ASR_C, _ASR, Rdn, Rm, imm5==0 ? 32 : imm5);
 				}
 				else if (scode==0x18)
 				{
@@ -854,28 +2921,28 @@ arm_emulator_execute(
 					// Add register (ADD)
 					// Encoding T1
 					_print_RRR("ADD", Rdn, Rm, Rm2);
-					_AddWithCarry(emu, Rdn, emu->R[Rm], emu->R[Rm2], 0);
+					_AddWithCarry_live(Rdn, emu->R[Rm], emu->R[Rm2], 0);
 				}
 				else if (scode==0x1A)
 				{
 					// pp01 101p
 					// SUB (Subtract register)
 					_print_RRR("SUB", Rdn, Rm, Rm2);
-					_AddWithCarry(emu, Rdn, emu->R[Rm], ~emu->R[Rm2], 1);
+					_AddWithCarry_live(Rdn, emu->R[Rm], ~emu->R[Rm2], 1);
 				}
 				else if (scode==0x1C)
 				{
 					// pp01 110p
 					// ADD (Add 3-bit, immediate)
 					_print_RRx("ADD", Rdn, Rm, imm3);
-					_AddWithCarry(emu, Rdn, emu->R[Rm], imm3, 0);
+					_AddWithCarry_live(Rdn, emu->R[Rm], imm3, 0);
 				}
 				else if (scode==0x1E)
 				{
 					// pp01 111p
 					// SUB (Subtract 3-bit, immediate)
 					_print_RRx("SUB", Rdn, Rm, imm3);
-					_AddWithCarry(emu, Rdn, emu->R[Rm], ~((uint32_t)imm3), 1);
+					_AddWithCarry_live(Rdn, emu->R[Rm], ~((uint32_t)imm3), 1);
 				}
 				else
 				{
@@ -886,14 +2953,14 @@ arm_emulator_execute(
 						// MOV (Move, immediate)
 						_print_Rx("MOV", Rd2, i_l);
 						emu->R[Rd2] = i_l;
-						_set_APSR_of_NZ(i_l);
+						_set_APSR_of_NZ_live(i_l);
 					}
 					else if (scode3bits==0x28)
 					{
 						// pp10 1xxp
 						// CMP (Compare, immediate)
 						_print_Rx("CMP", Rd2, i_l);
-						_AddWithCarryDiscard(emu, emu->R[Rd2], ~((uint32_t)(i_l)), 1);
+						_AddWithCarryDiscard_live(emu->R[Rd2], ~((uint32_t)(i_l)), 1);
 					}
 					else if (scode3bits==0x30)
 					{
@@ -901,14 +2968,14 @@ arm_emulator_execute(
 						// ADD (Add 8-bit, immediate)
 						// Encoding: T2.
 						_print_Rx("ADD", Rd2, i_l);
-						_AddWithCarry(emu, Rd2, emu->R[Rd2], i_l, 0);
+						_AddWithCarry_live(Rd2, emu->R[Rd2], i_l, 0);
 					}
 					else if (scode3bits==0x38)
 					{
 						// pp11 1xxp
 						// SUB (Subtract 8-bit, immediate)
 						_print_Rx("SUB", Rd2, i_l);
-						_AddWithCarry(emu, Rd2, emu->R[Rd2], ~((uint32_t)(i_l)), 1);
+						_AddWithCarry_live(Rd2, emu->R[Rd2], ~((uint32_t)(i_l)), 1);
 					}
 					else
 					{
@@ -929,91 +2996,91 @@ arm_emulator_execute(
 					// AND (Bitwise AND)
 					_print_RR("AND", Rdn, Rm);
 					emu->R[Rdn] = emu->R[Rdn] & emu->R[Rm];
-					_set_APSR_of_NZC(emu->R[Rdn], 0);
+					_set_APSR_of_NZC_live(emu->R[Rdn], 0);
 					break;
 				case 0x10:
 					// EOR (Exclusive OR)
 					_print_RR("EOR", Rdn, Rm);
 					emu->R[Rdn] = emu->R[Rdn] ^ emu->R[Rm];
-					_set_APSR_of_NZC(emu->R[Rdn], 0);
+					_set_APSR_of_NZC_live(emu->R[Rdn], 0);
 					break;
 				case 0x20:
 					// LSL (Logical Shift Left)
 					_print_RR("LSL", Rdn, Rm);
-					_shift_processing(emu, _LSL_C, Rdn, Rm);
+					_shift_processing_live(_LSL_C, _LSL, Rdn, Rm);
 					break;
 				case 0x30:
 					// LSR (Logical Shift Right)
 					_print_RR("LSR", Rdn, Rm);
-					_shift_processing(emu, _LSR_C, Rdn, Rm);
+					_shift_processing_live(_LSR_C, _LSR, Rdn, Rm);
 					break;
 				case 0x40:
 					// ASR (Arithmetic Shift Right)
 					_print_RR("ASR", Rdn, Rm);
-					_shift_processing(emu, _ASR_C, Rdn, Rm);
+					_shift_processing_live(_ASR_C, _ASR, Rdn, Rm);
 					break;
 				case 0x50:
 					// ADC (Add with Carry)
 					_print_RR("ADC", Rdn, Rm);
-					_AddWithCarry(emu, Rdn, emu->R[Rdn], emu->R[Rm], APSR_C);
+					_AddWithCarry_live(Rdn, emu->R[Rdn], emu->R[Rm], APSR_C);
 					break;
 				case 0x60:
 					// SBC (Subtract with Carry)
 					_print_RR("SBC", Rdn, Rm);
-					_AddWithCarry(emu, Rdn, emu->R[Rdn], ~emu->R[Rm], APSR_C);
+					_AddWithCarry_live(Rdn, emu->R[Rdn], ~emu->R[Rm], APSR_C);
 					break;
 				case 0x70:
 					// ROR (Rotate Right). Note: ARMv6-M doesn't support RRX.
 					_print_RR("ROR", Rdn, Rm);
-					_shift_processing(emu, _ROR_C, Rdn, Rm);
+					_shift_processing_live(_ROR_C, _ROR, Rdn, Rm);
 					break;
 				case 0x80:
 					// TST (Set flags on bitwise AND)
 					_print_RR("TST", Rdn, Rm);
 					{
 						const uint32_t	x = emu->R[Rdn] & emu->R[Rm];
-						_set_APSR_of_NZC(x, 0);
+						_set_APSR_of_NZC_live(x, 0);
 					}
 					break;
 				case 0x90:
 					// RSB (Reverse Subtract from 0)
 					_print_RR("RSB", Rdn, Rm);
-					_AddWithCarry(emu, Rdn, ~emu->R[Rm], 0, 1);
+					_AddWithCarry_live(Rdn, ~emu->R[Rm], 0, 1);
 					break;
 				case 0xA0:
 					// CMP (Compare Registers)
 					// Encoding T1:
 					_print_RR("CMP", Rdn, Rm);
-					_AddWithCarryDiscard(emu, emu->R[Rdn], ~emu->R[Rm], 1);
+					_AddWithCarryDiscard_live(emu->R[Rdn], ~emu->R[Rm], 1);
 					break;
 				case 0xB0:
 					// CMN (Compare Negative)
 					_print_RR("CMN", Rdn, Rm);
-					_AddWithCarryDiscard(emu, emu->R[Rdn], emu->R[Rm], 0);
+					_AddWithCarryDiscard_live(emu->R[Rdn], emu->R[Rm], 0);
 					break;
 				case 0xC0:
 					// ORR (Logical OR)
 					_print_RR("ORR", Rdn, Rm);
 					emu->R[Rdn] = emu->R[Rdn] | emu->R[Rm];
-					_set_APSR_of_NZC(emu->R[Rdn], 0);
+					_set_APSR_of_NZC_live(emu->R[Rdn], 0);
 					break;
 				case 0xD0:
 					// MUL (Multiply Two Registers)
 					_print_RR("MUL", Rdn, Rm);
 					emu->R[Rdn] = emu->R[Rdn] * emu->R[Rm];
-					_set_APSR_of_NZ(emu->R[Rdn]);
+					_set_APSR_of_NZ_live(emu->R[Rdn]);
 					break;
 				case 0xE0:
 					// BIC (Bit Clear)
 					_print_RR("BIC", Rdn, Rm);
 					emu->R[Rdn] = emu->R[Rdn] & (~emu->R[Rm]);
-					_set_APSR_of_NZC(emu->R[Rdn], 0);
+					_set_APSR_of_NZC_live(emu->R[Rdn], 0);
 					break;
 				case 0xF0:
 					// MVN (Bitwise NOT)
 					_print_RR("MVN", Rdn, Rm);
 					emu->R[Rdn] = ~emu->R[Rm];
-					_set_APSR_of_NZC(emu->R[Rdn], 0);
+					_set_APSR_of_NZC_live(emu->R[Rdn], 0);
 					break;
 				default:
 					error_unknown_instruction();
@@ -1034,10 +3101,11 @@ arm_emulator_execute(
 					// Encoding T2
 					const uint32_t	prev_APSR = emu->APSR;
 					_print_RR("ADD", Rdn, Rm);
-					_AddWithCarry(emu, Rdn, emu->R[Rdn], emu->R[Rm], 0);
+					_AddWithCarry_live(Rdn, emu->R[Rdn], emu->R[Rm], 0);
 					if (Rdn == INDEX_PC)
 					{
 						emu->APSR = prev_APSR;
+						emu->cycles += 2;
 						set_PC(PC);
 					}
 					else if (Rdn == INDEX_SP)
@@ -1055,7 +3123,7 @@ arm_emulator_execute(
 					// CMP (Compare registers).
 					// Encoding: T2
 					_print_RR("CMP", Rdn, Rm);
-					_AddWithCarryDiscard(emu, emu->R[Rdn], ~emu->R[Rm], 1);
+					_AddWithCarryDiscard_live(emu->R[Rdn], ~emu->R[Rm], 1);
 				}
 				else if (scode2bits==0x80)
 				{
@@ -1063,9 +3131,10 @@ arm_emulator_execute(
 					// Encoding: T1
 					_print_RR("MOV", Rdn, Rm);
 					emu->R[Rdn] = emu->R[Rm];
-					// not in encoding T1: _set_APSR_of_NZ(emu->R[Rdn]);
+					// not in encoding T1: _set_APSR_of_NZ_live(emu->R[Rdn]);
 					if (Rdn==INDEX_PC)
 					{
+						emu->cycles += 2;
 						set_PC(emu->R[Rdn]);
 					}
 				}
@@ -1082,6 +3151,7 @@ arm_emulator_execute(
 						}
 						else
 						{
+							emu->cycles += 2;
 							set_PC(emu->R[Rm2]);
 						}
 					}
@@ -1097,6 +3167,8 @@ arm_emulator_execute(
 						{
 							const uint32_t	target = emu->R[Rm2];
 							LR = PC | 1;
+							_push_return(emu, LR);
+							emu->cycles += 2;
 							set_PC(target);
 						}
 					}
@@ -1113,6 +3185,10 @@ arm_emulator_execute(
 				const uint8_t				Rt = (instruction >> 8) & 0x07;
 				enum arm_emulator_result	r;
 				_print_Rx("LDR", Rt, i_l * 4);
+				if (PC - emu->program_address < emu->program_size)
+				{
+					emu->cycles += emu->flash_wait_states;
+				}
 				r = _fetch_data32(emu, Rt, _Align4Down(PC+2) + i_l*4);
 				if (r != ARM_EMULATOR_OK)
 				{
@@ -1345,21 +3421,45 @@ arm_emulator_execute(
 				{
 					// PUSH (Push Multiple Registers)
 					const uint16_t	list = (i_h & 1)*0x4000 | i_l;
+					const uint8_t	n = _bit_count(i_l) + (i_h & 1);
+					uint32_t		*p = _data_words(emu, SP - 4*n, n);
 					int8_t			i;
 
 					_print_PUSH(prev_pc, i_h & 1, i_l);
-					for (i=14; i>=0; --i)
+					emu->cycles += n;
+					if (p != NULL)
 					{
-						if (list & (1 << i))
+						// Fast path: whole range validated at once.
+						for (i=0; i<8; ++i)
 						{
-							const enum arm_emulator_result	r = _store_data32(emu, SP-4, emu->R[i]);
-							if (r==ARM_EMULATOR_OK)
+							if (i_l & (1 << i))
 							{
-								SP -= 4;
+								*p++ = emu->R[i];
 							}
-							else
+						}
+						if (i_h & 1)
+						{
+							*p = LR;
+						}
+						SP -= 4*n;
+						_data_written(emu, SP - emu->data_address, 4*n);
+						++emu->events;
+					}
+					else
+					{
+						for (i=14; i>=0; --i)
+						{
+							if (list & (1 << i))
 							{
-								return r;
+								const enum arm_emulator_result	r = _store_data32(emu, SP-4, emu->R[i]);
+								if (r==ARM_EMULATOR_OK)
+								{
+									SP -= 4;
+								}
+								else
+								{
+									return r;
+								}
 							}
 						}
 					}
@@ -1367,8 +3467,13 @@ arm_emulator_execute(
 				else if (scode==0x66)
 				{
 					// CPS (Change Processor State)
-					_print_x(((opcode >> 4) & 1) ? "CPSIM" : "CPSI0", 0);
-					// Not needed.
+					_print((i_l & 0x10) ? "CPSID i" : "CPSIE i");
+					emu->primask = (i_l >> 4) & 1;
+					if (!emu->primask)
+					{
+						// Take pending exceptions.
+						emu->next_check = 0;
+					}
 				}
 				else if (scode6bits==0xA0)
 				{
@@ -1399,35 +3504,58 @@ arm_emulator_execute(
 				{
 					// POP (Pop Multiple Registers.
 					const uint8_t	p = (instruction >> 8) & 1;
+					const uint8_t	n = _bit_count(i_l) + p;
+					const uint32_t	*words = _data_words(emu, SP, n);
 					uint8_t			i;
 
 					_print_POP(prev_pc, p, i_l);
-					for (i=0; i<8; ++i)
+					// 1+N, 4+N with PC.
+					emu->cycles += n + 2*p;
+					if (words != NULL)
 					{
-						if (i_l & (1<<i))
+						// Fast path: whole range validated at once.
+						for (i=0; i<8; ++i)
 						{
-							const enum arm_emulator_result	r = _fetch_data32(emu, i, SP);
-							if (r==ARM_EMULATOR_OK)
-							{
-								SP += 4;
-							}
-							else
+							if (i_l & (1<<i))
 							{
-								return r;
+								emu->R[i] = *words++;
 							}
 						}
+						SP += 4*n;
+						if (p)
+						{
+							set_PC(*words);
+						}
 					}
-					if (p)
+					else
 					{
-						const enum arm_emulator_result	r = _fetch_data32(emu, INDEX_PC, SP);
-						if (r==ARM_EMULATOR_OK)
+						for (i=0; i<8; ++i)
 						{
-							SP += 4;
-							set_PC(PC);
+							if (i_l & (1<<i))
+							{
+								const enum arm_emulator_result	r = _fetch_data32(emu, i, SP);
+								if (r==ARM_EMULATOR_OK)
+								{
+									SP += 4;
+								}
+								else
+								{
+									return r;
+								}
+							}
 						}
-						else
+						if (p)
 						{
-							return r;
+							const enum arm_emulator_result	r = _fetch_data32(emu, INDEX_PC, SP);
+							if (r==ARM_EMULATOR_OK)
+							{
+								SP += 4;
+								set_PC(PC);
+							}
+							else
+							{
+								return r;
+							}
 						}
 					}
 				}
@@ -1445,6 +3573,54 @@ arm_emulator_execute(
 					{
 						// NOP
 					}
+					else if (scode == 0x10)
+					{
+						// YIELD
+						_print("YIELD");
+					}
+					else if (scode == 0x20 && emu->event)
+					{
+						// WFE (Wait For Event), event pending.
+						_print("WFE");
+						emu->event = 0;
+					}
+					else if ((scode == 0x20 || scode == 0x30) && emu->next_check != UINT64_MAX)
+					{
+						// WFE (Wait For Event), WFI (Wait For Interrupt).
+						// Sleep until the next timer, in virtual time.
+						uint64_t	n = _skip_budget(emu, max_instructions - instruction_count - 1);
+						_print(scode == 0x20 ? "WFE" : "WFI");
+						if (n > _cycles_left(emu))
+						{
+							n = _cycles_left(emu);
+						}
+						emu->clock_ticks += n;
+						emu->cycles += n;
+						emu->idle_skipped += n;
+						instruction_count += (unsigned int)n;
+						if (emu->clock_ticks < emu->next_check)
+						{
+							// Still asleep when the budget ends.
+							PC = prev_pc;
+						}
+					}
+					else if (scode == 0x20 || scode == 0x30)
+					{
+						// WFE (Wait For Event), WFI (Wait For Interrupt).
+						// Nothing scheduled: the host waits, the next call
+						// resumes after this.
+						_print(scode == 0x20 ? "WFE" : "WFI");
+						emu->waiting = scode == 0x20
+							? ARM_EMULATOR_WAIT_FOR_EVENT
+							: ARM_EMULATOR_WAIT_FOR_INTERRUPT;
+						return ARM_EMULATOR_WAIT;
+					}
+					else if (scode == 0x40)
+					{
+						// SEV (Send Event)
+						_print("SEV");
+						emu->event = 1;
+					}
 					else
 					{
 						// NOT IMPLEMENTED :)
@@ -1461,21 +3637,41 @@ arm_emulator_execute(
 			{
 				// Store multiple registers (STM, STMIA, STMEA)
 				const uint8_t	Rn = i_h & 0x07;
+				const uint8_t	n = _bit_count(i_l);
+				uint32_t		*p = _data_words(emu, emu->R[Rn], n);
 				int8_t			i;
 
 				_print_STM(prev_pc, Rn, i_l);
-				for (i=0; i<8; ++i)
+				emu->cycles += n;
+				if (p != NULL)
 				{
-					if (i_l & (1 << i))
+					// Fast path: whole range validated at once.
+					for (i=0; i<8; ++i)
 					{
-						const enum arm_emulator_result	r = _store_data32(emu, emu->R[Rn], emu->R[i]);
-						if (r==ARM_EMULATOR_OK)
+						if (i_l & (1 << i))
 						{
-							emu->R[Rn] += 4;
+							*p++ = emu->R[i];
 						}
-						else
+					}
+					_data_written(emu, emu->R[Rn] - emu->data_address, 4*n);
+					emu->R[Rn] += 4*n;
+					++emu->events;
+				}
+				else
+				{
+					for (i=0; i<8; ++i)
+					{
+						if (i_l & (1 << i))
 						{
-							return r;
+							const enum arm_emulator_result	r = _store_data32(emu, emu->R[Rn], emu->R[i]);
+							if (r==ARM_EMULATOR_OK)
+							{
+								emu->R[Rn] += 4;
+							}
+							else
+							{
+								return r;
+							}
 						}
 					}
 				}
@@ -1484,41 +3680,75 @@ arm_emulator_execute(
 			{
 				// Load multiple registers (LDM, LDMIA, LDMFD)
 				// ! modifier always present.
+				// No writeback if Rn is in the list.
 				const uint8_t	Rn = i_h & 0x07;
-				const uint8_t	writeback = i_l & (1<<Rn);
-				uint32_t		addr = emu->R[Rn];
+				const uint8_t	writeback = (i_l & (1<<Rn)) == 0;
+				const uint8_t	n = _bit_count(i_l);
+				const uint32_t	base = emu->R[Rn];
+				const uint32_t	*p = _data_words(emu, base, n);
 				int8_t			i;
 
 				_print_LDM(prev_pc, Rn, i_l);
-				for (i=0; i<8; ++i)
+				emu->cycles += n;
+				if (p != NULL)
 				{
-					if (i_l & (1 << i))
+					// Fast path: whole range validated at once.
+					for (i=0; i<8; ++i)
 					{
-						const enum arm_emulator_result	r = _fetch_data32(emu, i, addr);
-						if (r==ARM_EMULATOR_OK)
+						if (i_l & (1 << i))
 						{
-							addr += 4;
-							if (writeback)
-							{
-								emu->R[Rn] = addr;
-							}
+							emu->R[i] = *p++;
 						}
-						else
+					}
+				}
+				else
+				{
+					uint32_t	addr = base;
+					for (i=0; i<8; ++i)
+					{
+						if (i_l & (1 << i))
 						{
-							return r;
+							const enum arm_emulator_result	r = _fetch_data32(emu, i, addr);
+							if (r==ARM_EMULATOR_OK)
+							{
+								addr += 4;
+							}
+							else
+							{
+								return r;
+							}
 						}
 					}
 				}
-				emu->R[Rn] = addr;
+				if (writeback)
+				{
+					emu->R[Rn] = base + 4*n;
+				}
 			}
 			else if (opcode4bits==0xD0)
 			{
 				// Conditional branch, and Supervisor Call.
 				const uint8_t	cond = i_h & 0x0F;
 				// 1101 opcode
-				if (cond==0x0E || cond==0x0F)
+				if (cond==0x0F)
+				{
+					// SVC (Supervisor Call): host handler indexed by imm8.
+					int	r;
+					_print_x("SVC", i_l);
+					r = arm_emulator_call_svc(emu, i_l);
+					if (r < 0)
+					{
+						error_unknown_instruction();
+					}
+					else if (r > 0)
+					{
+						emu->cycles += 2;
+						set_PC(PC);
+					}
+				}
+				else if (cond==0x0E)
 				{
-					// SVC (Supervisor Call) - NOT IMPLEMENTED.
+					// UDF (Permanently Undefined)
 					error_unknown_instruction();
 				}
 				else
@@ -1530,7 +3760,24 @@ arm_emulator_execute(
 					if (_ConditionPassed(emu, cond))
 					{
 						// do the branch...
+						emu->cycles += 2;
 						set_PC(addr);
+						if (imm32 < 0)
+						{
+							const unsigned int	budget = _skip_budget(emu, max_instructions - instruction_count - 1);
+							unsigned int	n = cond == 0x01
+								? _loop_idiom(emu, prev_pc, budget)
+								: 0;
+							if (n == 0 && -imm32 <= IDLE_LOOP_MAX_SIZE)
+							{
+								n = _idle_loop(emu, prev_pc, budget);
+							}
+							else
+							{
+								emu->clock_ticks += n;
+							}
+							instruction_count += n;
+						}
 					}
 				}
 			}
@@ -1540,14 +3787,25 @@ arm_emulator_execute(
 				const uint16_t	imm11 = 2*(instruction & 0x7FF);
 				const uint32_t	new_pc = PC + 2 + _SignExtendTo32(imm11, 11);
 				_print_x("B", new_pc);
+				emu->cycles += 2;
 				set_PC(new_pc);
+				if (new_pc < prev_pc && prev_pc - new_pc <= IDLE_LOOP_MAX_SIZE)
+				{
+					instruction_count += _idle_loop(emu, prev_pc, _skip_budget(emu, max_instructions - instruction_count - 1));
+				}
 			}
 			else if ((opcode3bits == 0xE0) && (opcode5bits!=0xE0))
 			{
 				// 32-bit Thumb instruction
 				// Little-Endian?
 				uint16_t	instruction2;
-				if (arm_emulator_callback_read_program_memory(emu, (uint8_t*)(&instruction2), PC, 2) == 0)
+				if (verified_next == PC + 2)
+				{
+					const uint32_t	offset = PC - emu->program_address;
+					instruction2 = emu->program[offset] | (emu->program[offset + 1] << 8);
+					PC += 2;
+				}
+				else if (arm_emulator_callback_read_program_memory(emu, (uint8_t*)(&instruction2), PC, 2) == 0)
 				{
 					PC += 2;
 				}
@@ -1561,7 +3819,7 @@ arm_emulator_execute(
 				if ((opcode5bits== 0xF0) && ((i2_h & 0x80) == 0x80))
 				{
 					// Branch and miscellaneous control
-					const uint8_t	op1 = ((i_h << 3) & 0xE0) | ((i_l>>3) & 0x1E);
+					const uint8_t	op1 = ((i_h << 5) & 0xE0) | ((i_l>>3) & 0x1E);
 					const uint8_t	op2 = (i2_h << 1) & 0xE0;
 					const uint8_t	op16bits = op1 & 0xFC;
 					if ((op2 & 0xA0) == 0)
@@ -1569,13 +3827,19 @@ arm_emulator_execute(
 						if (op16bits == 0x70)
 						{
 							// MSR (Move to Special Register)
-							// Only APSR supported.
+							// APSR and PRIMASK supported.
+							const uint8_t	Rn = instruction & 0x0F;
 							if (i2_l ==0)
 							{
-								const uint8_t	Rn = instruction & 0x07;
 								_print_R("MSR APSR, ", Rn);
 								emu->APSR = emu->R[Rn] & 0xF8000000;
 							}
+							else if (i2_l == 0x10)
+							{
+								_print_R("MSR PRIMASK, ", Rn);
+								emu->primask = emu->R[Rn] & 1;
+								emu->next_check = 0;
+							}
 							else
 							{
 								// Not implemented.
@@ -1592,12 +3856,22 @@ arm_emulator_execute(
 						else if (op16bits==0x7C)
 						{
 							// MRS (Move from Special Register)
-							// Only APSR supported.
+							// APSR, IPSR and PRIMASK supported.
+							const uint8_t	Rd = (instruction2 >> 8) & 0x0F;
 							if (i2_l ==0)
 							{
-								const uint8_t	Rn = instruction & 0x07;
-								iprintf(("MRS %s, APSR\n", _rnames[Rn]));
-								emu->R[Rn] = emu->APSR;
+								iprintf(("MRS %s, APSR\n", _rnames[Rd]));
+								emu->R[Rd] = emu->APSR;
+							}
+							else if (i2_l == 0x05)
+							{
+								iprintf(("MRS %s, IPSR\n", _rnames[Rd]));
+								emu->R[Rd] = emu->exception;
+							}
+							else if (i2_l == 0x10)
+							{
+								iprintf(("MRS %s, PRIMASK\n", _rnames[Rd]));
+								emu->R[Rd] = emu->primask;
 							}
 							else
 							{
@@ -1637,6 +3911,7 @@ arm_emulator_execute(
 							| (s * (1<<24));
 						const uint32_t	new_PC = PC + _SignExtendTo32(x, 24);
 						LR = PC | 1;
+						_push_return(emu, LR);
 						_print_x("BL", new_PC);
 						set_PC(new_PC);
 					}
@@ -1666,6 +3941,20 @@ arm_emulator_execute(
 	return ARM_EMULATOR_OK;
 }
 
+//================================================================================================================
+enum arm_emulator_result
+arm_emulator_execute_cycles(
+	struct arm_emulator_state *emu,
+	unsigned int max_cycles)
+{
+	enum arm_emulator_result	r;
+	// Each instruction takes at least one cycle.
+	emu->cycles_limit = emu->cycles + max_cycles;
+	r = arm_emulator_execute(emu, max_cycles);
+	emu->cycles_limit = ARM_CYCLES_UNLIMITED;
+	return r;
+}
+
 //================================================================================================================
 uint32_t
 arm_emulator_get_function_return_value(struct arm_emulator_state *emu)
@@ -1673,12 +3962,94 @@ arm_emulator_get_function_return_value(struct arm_emulator_state *emu)
 	return emu->R[0];
 }
 
+//================================================================================================================
+int
+arm_emulator_push_frame(
+	struct arm_emulator_state *emu,
+	struct arm_emulator_frame *frame)
+{
+	if (emu->call_depth >= ARM_CALL_DEPTH_MAX)
+	{
+		return -1;
+	}
+	memcpy(frame->R, emu->R, sizeof(frame->R));
+	frame->APSR = emu->APSR;
+	frame->call_sp = emu->call_sp;
+	frame->call_result = emu->call_result;
+	frame->call_result_size = emu->call_result_size;
+	frame->cycles_limit = emu->cycles_limit;
+	frame->call_pending = emu->call_pending;
+	frame->exception = emu->exception;
+	frame->waiting = emu->waiting;
+	// The nested call starts below the caller's stack.
+	emu->call_sp = SP;
+	++emu->call_depth;
+	emu->return_address = EMULATOR_RETURN_ADDRESS + 2*emu->call_depth;
+	return 0;
+}
+
+//================================================================================================================
+void
+arm_emulator_pop_frame(
+	struct arm_emulator_state *emu,
+	const struct arm_emulator_frame *frame)
+{
+	memcpy(emu->R, frame->R, sizeof(emu->R));
+	emu->APSR = frame->APSR;
+	emu->call_sp = frame->call_sp;
+	emu->call_result = frame->call_result;
+	emu->call_result_size = frame->call_result_size;
+	emu->cycles_limit = frame->cycles_limit;
+	emu->call_pending = frame->call_pending;
+	emu->exception = frame->exception;
+	emu->waiting = frame->waiting;
+	if (emu->call_depth > 0)
+	{
+		--emu->call_depth;
+	}
+	emu->return_address = EMULATOR_RETURN_ADDRESS + 2*emu->call_depth;
+	// The idle loop snapshot of the caller is stale.
+	emu->idle_valid = 0;
+}
+
+//================================================================================================================
+uint64_t
+arm_emulator_get_function_return_value64(const struct arm_emulator_state *emu)
+{
+	return emu->R[0] | ((uint64_t)emu->R[1] << 32);
+}
+
+//================================================================================================================
+int
+arm_emulator_get_call_result(
+	const struct arm_emulator_state *emu,
+	void *result,
+	uint32_t size)
+{
+	const uint8_t	*p;
+	if (size <= 4)
+	{
+		memcpy(result, &emu->R[0], size);
+		return 0;
+	}
+	p = size <= emu->call_result_size
+		? arm_emulator_host_pointer(emu, emu->call_result, size)
+		: NULL;
+	if (p == NULL)
+	{
+		return -1;
+	}
+	memcpy(result, p, size);
+	return 0;
+}
+
 //================================================================================================================
 void
 arm_emulator_dump(struct arm_emulator_state *emu)
 {
 	const uint32_t apsr = emu->APSR;
 	uint8_t i;
+	(void)apsr;	// unused with COMM_NO_OUTPUT
 	for (i = 0; i < 16; ++i)
 	{
 		uart_write(_rnames[i]);
@@ -15,6 +15,210 @@ extern "C" {
 /** Number of ARM registers. */
 #define ARM_NREGISTERS 16
 
+/** Maximum number of native (host-implemented) guest functions. */
+#ifndef ARM_NATIVE_FUNCTIONS_MAX
+#define ARM_NATIVE_FUNCTIONS_MAX 16
+#endif
+
+/** Maximum number of regions mapped with arm_emulator_map_region(). */
+#ifndef ARM_REGIONS_MAX
+#define ARM_REGIONS_MAX 4
+#endif
+
+/** Entries in the branch target cache, a power of two. */
+#ifndef ARM_BRANCH_CACHE_SIZE
+#define ARM_BRANCH_CACHE_SIZE 64
+#endif
+
+/** Entries in the return address stack, a power of two. */
+#ifndef ARM_RETURN_STACK_SIZE
+#define ARM_RETURN_STACK_SIZE 8
+#endif
+
+struct arm_emulator_state;
+struct arm_i2c_bus;
+struct arm_services;
+
+/**
+ * Host implementation of a guest function.
+ * Arguments are in R0-R3, results are returned in R0-R1.
+ *
+ * @param emu Emulator state.
+ * @return 0 if handled (execution continues at LR), negative to fall back
+ *         to emulating the guest code, positive if partially handled
+ *         (execution continues with a branch to the address in PC).
+ */
+typedef int (*arm_emulator_native_t)(struct arm_emulator_state *emu);
+
+/**
+ * Guest function address bound to a host implementation.
+ */
+struct arm_emulator_native_function {
+	uint32_t address;
+	arm_emulator_native_t function;
+};
+
+/**
+ * Host buffer mapped into the guest address space.
+ */
+struct arm_emulator_region {
+	uint8_t *memory;
+	uint32_t address;
+	uint32_t size;
+	uint8_t writable;
+};
+
+/**
+ * Argument of arm_emulator_start_call(): a 32-bit value (integers,
+ * pointers, float, structs of up to 4 bytes) or a 64-bit value
+ * (int64_t, uint64_t, double, 8-byte structs with 8-byte alignment).
+ */
+struct arm_emulator_arg {
+	uint64_t value;
+	/** 4 or 8. */
+	uint8_t size;
+};
+
+#define ARM_ARG32(x) { (uint32_t)(x), 4 }
+#define ARM_ARG64(x) { (uint64_t)(x), 8 }
+
+/** Maximum nesting depth of arm_emulator_push_frame(). */
+#ifndef ARM_CALL_DEPTH_MAX
+#define ARM_CALL_DEPTH_MAX 8
+#endif
+
+/**
+ * Caller state saved by arm_emulator_push_frame(). Storage is provided
+ * by the host, typically on its own stack.
+ */
+struct arm_emulator_frame {
+	uint32_t R[ARM_NREGISTERS];
+	uint32_t APSR;
+	uint32_t call_sp;
+	uint32_t call_result;
+	uint32_t call_result_size;
+	uint64_t cycles_limit;
+	uint8_t call_pending;
+	uint8_t exception;
+	uint8_t waiting;
+};
+
+/** arm_emulator_start_call() flags. */
+enum {
+	/** Keep registers and the stack pointer of the previous call instead
+	    of resetting them. */
+	ARM_CALL_WARM = 0x01
+};
+
+/** Default virtual clock rate: 48 MHz, one instruction per cycle. */
+#define ARM_CLOCK_INSTRUCTIONS_PER_MS 48000
+
+/** arm_emulator_state.cycles_limit outside arm_emulator_execute_cycles(). */
+#define ARM_CYCLES_UNLIMITED UINT64_MAX
+
+/** Maximum number of pending timers. */
+#ifndef ARM_TIMERS_MAX
+#define ARM_TIMERS_MAX 8
+#endif
+
+/** Number of exceptions: SysTick is 15, external interrupt n is 16+n. */
+#define ARM_EXCEPTIONS_MAX 32
+#define ARM_EXCEPTION_SYSTICK 15
+#define ARM_EXCEPTION_IRQ(n) (16 + (n))
+
+/**
+ * Host function run by the scheduler.
+ *
+ * @param emu Emulator state.
+ * @param id Identifier given to arm_emulator_add_timer().
+ * @param when Clock tick the timer was due at.
+ */
+typedef void (*arm_emulator_timer_t)(struct arm_emulator_state *emu, uint32_t id, uint64_t when);
+
+/**
+ * Scheduled timer.
+ */
+struct arm_emulator_timer {
+	uint64_t when;
+	arm_emulator_timer_t function;
+	uint32_t id;
+};
+
+/** Maximum number of instructions in a cached block. */
+#define ARM_BLOCK_MAX_INSTRUCTIONS 32
+
+/** Address of an unused block cache entry. */
+#define ARM_BLOCK_UNUSED 0xFFFFFFFFu
+
+/** Number of write-tracked pages the data region is divided into. */
+#define ARM_CODE_PAGES 256
+
+/** Smallest write-tracked page, as a power of two. */
+#define ARM_CODE_PAGE_SHIFT_MIN 5
+
+/**
+ * Cached basic block. Storage is provided by the user, see
+ * arm_emulator_set_block_cache().
+ */
+struct arm_emulator_block {
+	/** Start address, ARM_BLOCK_UNUSED if the entry is free. */
+	uint32_t address;
+	/** Bit i set: condition flags written by instruction i are
+	    overwritten within the block before being read. */
+	uint32_t flags_dead;
+	/** Number of instructions, 0 while the entry only counts executions
+	    of a block that is not hot yet. */
+	uint8_t count;
+	/** Size in bytes. */
+	uint8_t size;
+	/** Executions from the start address, saturating; halved when
+	    another block competes for the entry. */
+	uint16_t hits;
+};
+
+/**
+ * Execution tiers, see arm_emulator_set_tier_thresholds().
+ */
+enum arm_emulator_tier {
+	/** Plain interpreter. */
+	ARM_TIER_INTERPRETER = 0,
+	/** Block cache: flag liveness analysed once per block, dead flag
+	    updates skipped. Instructions are still decoded on every
+	    execution. */
+	ARM_TIER_FLAG_LIVENESS = 1,
+	/** Translated host function bound as a native function. */
+	ARM_TIER_TRANSLATED = 2,
+	/** No pin: the thresholds decide, for arm_emulator_pin_tier(). */
+	ARM_TIER_AUTO = 0xFF,
+};
+
+/** Maximum number of ranges pinned with arm_emulator_pin_tier(). */
+#ifndef ARM_TIER_PINS_MAX
+#define ARM_TIER_PINS_MAX 4
+#endif
+
+/**
+ * Address range pinned to a tier.
+ */
+struct arm_emulator_tier_pin {
+	uint32_t address;
+	uint32_t size;
+	/** enum arm_emulator_tier. */
+	uint8_t tier;
+};
+
+/**
+ * Code in an address range by tier, see arm_emulator_inspect_tiers().
+ */
+struct arm_emulator_tier_stats {
+	/** Blocks whose executions are counted. */
+	unsigned int counting;
+	/** Blocks in the block cache, with their flag liveness. */
+	unsigned int flag_liveness;
+	/** Translated functions bound. */
+	unsigned int translated;
+};
+
 /**
  * Emulator state. Allocate one of these and pass to all API functions.
  */
@@ -34,9 +238,128 @@ struct arm_emulator_state {
 	uint32_t service_address;
 	size_t service_size;
 
+	/* Host buffers mapped at runtime, for data access only. */
+	struct arm_emulator_region regions[ARM_REGIONS_MAX];
+	unsigned int regions_count;
+
 	/* Registers */
 	uint32_t R[ARM_NREGISTERS];
 	uint32_t APSR;
+
+	/* Native functions, sorted by address. */
+	struct arm_emulator_native_function natives[ARM_NATIVE_FUNCTIONS_MAX];
+	unsigned int natives_count;
+	/* Branch targets known to be neither native functions nor handled by
+	   the function call callback, direct-mapped by address. */
+	uint32_t branch_cache[ARM_BRANCH_CACHE_SIZE];
+	/* Return addresses of the last BL and BLX instructions, circular;
+	   returns to them are not looked up. Empty slots are 0xFFFFFFFF. */
+	uint32_t return_stack[ARM_RETURN_STACK_SIZE];
+	uint8_t return_stack_top;
+	/* Set by arm_emulator_set_branch_cache(); the two above are only
+	   consulted while set. */
+	uint8_t branch_cache_enabled;
+	/* Set by arm_emulator_start_function_call() until the entry point
+	   has been checked for a native function. */
+	uint8_t call_pending;
+	/* SP before the arguments of the last call, where a warm call starts
+	   from, and the address of its result in memory (0 if none). */
+	uint32_t call_sp;
+	uint32_t call_result;
+	uint32_t call_result_size;
+	/* Nested frames pushed, and the return address that ends the call at
+	   this level. */
+	uint8_t call_depth;
+	uint32_t return_address;
+
+	/* Event register, set by SEV and arm_emulator_signal_event(). */
+	uint8_t event;
+	/* enum arm_emulator_wait, set when execution stopped at WFE/WFI. */
+	uint8_t waiting;
+
+	/* Virtual clock, in instructions. Advances with every instruction
+	   executed and on arm_emulator_advance_clock(). */
+	uint64_t clock_ticks;
+	/* clock_ticks at which the uptime was clock_uptime. */
+	uint64_t clock_origin;
+	uint32_t clock_uptime;
+	uint32_t clock_rate;
+
+	/* Cycle counter, Cortex-M0 instruction timings. */
+	uint64_t cycles;
+	/* Execution stops when cycles reaches this, see
+	   arm_emulator_execute_cycles(). */
+	uint64_t cycles_limit;
+	/* Wait states per word fetched from the program region. */
+	uint8_t flash_wait_states;
+
+	/* Timers, a min-heap on when. */
+	struct arm_emulator_timer timers[ARM_TIMERS_MAX];
+	unsigned int timers_count;
+	/* clock_ticks at which the execution loop runs due timers and
+	   delivers pending exceptions. 0 forces a check. */
+	uint64_t next_check;
+
+	/* Exceptions. Bit n of pending is exception n. */
+	uint32_t vectors[ARM_EXCEPTIONS_MAX];
+	uint32_t pending;
+	/* Active exception (IPSR), 0 in thread mode. */
+	uint8_t exception;
+	uint8_t primask;
+	uint32_t systick_reload;
+
+	/* Idle loop detection. events counts stores, host function calls and
+	   reads through the memory callback; clock_reads counts calls to
+	   arm_emulator_native_get_uptime. */
+	uint32_t events;
+	uint32_t clock_reads;
+	/* Last backward branch taken and how often in a row. */
+	uint32_t idle_branch;
+	uint32_t idle_taken;
+	/* State at idle_branch one iteration ago, if idle_valid. */
+	uint8_t idle_valid;
+	uint32_t idle_R[ARM_NREGISTERS];
+	uint32_t idle_APSR;
+	uint32_t idle_events;
+	uint32_t idle_clock_reads;
+	uint64_t idle_ticks;
+	uint64_t idle_cycles;
+	/* Instructions skipped in idle loops. Counted by clock_ticks and
+	   against the arm_emulator_execute() budget like executed ones. */
+	uint64_t idle_skipped;
+
+	/* Host services for the service API natives (optional), see
+	   arm_i2c.h and arm_services.h. */
+	struct arm_i2c_bus *i2c;
+	struct arm_services *services;
+
+	/* SVC handlers by immediate (optional). */
+	const arm_emulator_native_t *svc_table;
+	unsigned int svc_count;
+
+	/* Block cache (optional). */
+	struct arm_emulator_block *blocks;
+	unsigned int blocks_count;
+	/* Pages of the data region holding cached blocks; a store to one
+	   discards the blocks on it. */
+	uint32_t code_pages[ARM_CODE_PAGES / 32];
+	uint8_t code_page_shift;
+	/* Set when blocks were discarded, for the running block. */
+	uint8_t code_stale;
+
+	/* Tiering: executions of a block before its flag liveness is
+	   analysed, and before the translation of a function starting there
+	   is bound (0 for never). Translations are supplied by the user. */
+	uint16_t liveness_threshold;
+	uint16_t translate_threshold;
+	const struct arm_emulator_native_function *translations;
+	unsigned int translations_count;
+	struct arm_emulator_tier_pin tier_pins[ARM_TIER_PINS_MAX];
+	unsigned int tier_pins_count;
+
+	/* Verified instructions in the program region (optional), one bit
+	   per halfword, see arm_verify.h. */
+	const uint32_t *verified;
 };
 
 /**
@@ -46,6 +369,19 @@ enum arm_emulator_result {
 	ARM_EMULATOR_OK = 0,
 	ARM_EMULATOR_ERROR = -1,
 	ARM_EMULATOR_FUNCTION_RETURNED = 1,
+	/** Stopped at WFE or WFI, see arm_emulator_state.waiting. */
+	ARM_EMULATOR_WAIT = 2,
+};
+
+/**
+ * Reason for ARM_EMULATOR_WAIT.
+ */
+enum arm_emulator_wait {
+	ARM_EMULATOR_NOT_WAITING = 0,
+	/** WFE with the event register clear. */
+	ARM_EMULATOR_WAIT_FOR_EVENT = 1,
+	/** WFI. */
+	ARM_EMULATOR_WAIT_FOR_INTERRUPT = 2,
 };
 
 /**
@@ -82,6 +418,70 @@ void arm_emulator_init(
  */
 void arm_emulator_reset(struct arm_emulator_state *emu);
 
+/**
+ * Map a host buffer into the guest address space, without copying. Loads
+ * and stores reach it like the data region (stores only if writable);
+ * code cannot be executed from it. Mapping at the address of a mapped
+ * region replaces that region, e.g. to swap input buffers between calls.
+ * The buffer must stay valid until it is unmapped or replaced.
+ *
+ * @param emu Emulator state.
+ * @param address Guest address.
+ * @param memory Host buffer, not written to if read-only.
+ * @param size Size in bytes.
+ * @param writable Non-zero to allow guest stores.
+ * @return 0 on success, negative if the range overlaps another region or
+ *         ARM_REGIONS_MAX regions are mapped.
+ */
+int arm_emulator_map_region(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint8_t *memory,
+	uint32_t size,
+	int writable);
+
+/**
+ * Unmap a region mapped with arm_emulator_map_region().
+ *
+ * @param emu Emulator state.
+ * @param address Guest address the region was mapped at.
+ * @return 0 on success, negative if no region is mapped there.
+ */
+int arm_emulator_unmap_region(
+	struct arm_emulator_state *emu,
+	uint32_t address);
+
+/**
+ * Translate a guest range to a host pointer, without copying. The range
+ * must lie entirely in one region (program, data, service or mapped);
+ * ranges in no region or spanning regions fail. The memory callback is
+ * not used.
+ *
+ * @param emu Emulator state.
+ * @param address Guest address.
+ * @param length Number of bytes.
+ * @return Host pointer to the first byte, NULL if out of bounds.
+ */
+const uint8_t *arm_emulator_host_pointer(
+	const struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t length);
+
+/**
+ * Translate a guest range in the data region or a writable mapped region
+ * to a writable host pointer.
+ *
+ * @param emu Emulator state.
+ * @param address Guest address.
+ * @param length Number of bytes.
+ * @return Host pointer to the first byte, NULL if the range is not
+ *         entirely in one writable region.
+ */
+uint8_t *arm_emulator_host_data_pointer(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t length);
+
 /**
  * Read memory from any region (program, data, or service).
  * Calls arm_emulator_callback_read_program_memory for addresses outside
@@ -114,18 +514,172 @@ int arm_emulator_start_function_call(
 	const uint32_t *arguments,
 	unsigned int arguments_count);
 
+/**
+ * Start a function call following the AAPCS: arguments go to R0-R3 and
+ * then to the stack, 64-bit arguments to an even register pair or an
+ * 8-byte aligned stack slot. Results of up to 4 bytes are returned in R0,
+ * 64-bit results in R0-R1 (see arm_emulator_get_function_return_value64()).
+ * For larger structure results the caller reserves memory on the guest
+ * stack and passes its address in R0, see arm_emulator_get_call_result().
+ *
+ * A cold call resets the registers like arm_emulator_start_function_call().
+ * A warm call (ARM_CALL_WARM) keeps R4-R11 and starts from the stack
+ * pointer of the previous call, releasing its stack arguments.
+ *
+ * @param emu Emulator state.
+ * @param function_address Function entry point (Thumb bit is ignored).
+ * @param arguments Arguments, may be NULL if arguments_count is 0.
+ * @param arguments_count Number of arguments.
+ * @param result_size Size of the result in bytes if it is a structure
+ *        returned in memory (more than 4 bytes), otherwise 0.
+ * @param flags ARM_CALL_* flags.
+ * @return 0 on success, negative if an argument size is invalid or the
+ *         stack does not fit in the data region.
+ */
+int arm_emulator_start_call(
+	struct arm_emulator_state *emu,
+	uint32_t function_address,
+	const struct arm_emulator_arg *arguments,
+	unsigned int arguments_count,
+	uint32_t result_size,
+	unsigned int flags);
+
+/**
+ * Save the state of the running call so that a host callback (a native
+ * function, timer or memory callback) can call back into the guest on
+ * the same instance. Start the nested call with arm_emulator_start_call()
+ * or arm_emulator_start_function_call(), run it with arm_emulator_execute()
+ * until ARM_EMULATOR_FUNCTION_RETURNED, collect its result and restore
+ * the caller with arm_emulator_pop_frame(). The nested call uses the
+ * guest stack below the caller's stack pointer, and returns to a
+ * level-specific address so that each level ends at its own return.
+ *
+ * @param emu Emulator state.
+ * @param frame Storage for the caller state.
+ * @return 0 on success, negative if ARM_CALL_DEPTH_MAX frames are pushed.
+ */
+int arm_emulator_push_frame(
+	struct arm_emulator_state *emu,
+	struct arm_emulator_frame *frame);
+
+/**
+ * Restore the caller state saved by the matching arm_emulator_push_frame().
+ *
+ * @param emu Emulator state.
+ * @param frame Caller state.
+ */
+void arm_emulator_pop_frame(
+	struct arm_emulator_state *emu,
+	const struct arm_emulator_frame *frame);
+
 /**
  * Execute instructions.
  *
  * @param emu Emulator state.
  * @param max_instructions Maximum number of instructions to execute.
  * @return ARM_EMULATOR_OK if still running, ARM_EMULATOR_FUNCTION_RETURNED
- *         if function returned, ARM_EMULATOR_ERROR on error.
+ *         if function returned, ARM_EMULATOR_WAIT if stopped at WFE or
+ *         WFI with no timer pending (call again to resume after it),
+ *         ARM_EMULATOR_ERROR on error.
  */
 enum arm_emulator_result arm_emulator_execute(
 	struct arm_emulator_state *emu,
 	unsigned int max_instructions);
 
+/**
+ * Execute instructions until a cycle budget is used up. With the block
+ * cache enabled, execution stops at the end of a block and may overrun
+ * the budget by up to one block.
+ *
+ * @param emu Emulator state.
+ * @param max_cycles Maximum number of cycles to execute.
+ * @return As arm_emulator_execute().
+ */
+enum arm_emulator_result arm_emulator_execute_cycles(
+	struct arm_emulator_state *emu,
+	unsigned int max_cycles);
+
+/**
+ * Set the flash wait states of the program region. Each word of
+ * instructions and each literal fetched from it costs this many extra
+ * cycles. arm_emulator_init() sets 0.
+ *
+ * @param emu Emulator state.
+ * @param wait_states Wait states per access.
+ */
+void arm_emulator_set_flash_wait_states(
+	struct arm_emulator_state *emu,
+	uint8_t wait_states);
+
+/**
+ * Run a host function when the virtual clock reaches a tick. Timers run
+ * between instructions, at the end of a cached block at the latest.
+ *
+ * @param emu Emulator state.
+ * @param when Clock tick (arm_emulator_state.clock_ticks) to run at.
+ * @param function Function to run.
+ * @param id Passed to the function.
+ * @return 0 on success, negative if ARM_TIMERS_MAX timers are pending.
+ */
+int arm_emulator_add_timer(
+	struct arm_emulator_state *emu,
+	uint64_t when,
+	arm_emulator_timer_t function,
+	uint32_t id);
+
+/**
+ * Cancel a pending timer.
+ *
+ * @param emu Emulator state.
+ * @param function Function given to arm_emulator_add_timer().
+ * @param id Identifier given to arm_emulator_add_timer().
+ * @return 0 on success, negative if no such timer is pending.
+ */
+int arm_emulator_remove_timer(
+	struct arm_emulator_state *emu,
+	arm_emulator_timer_t function,
+	uint32_t id);
+
+/**
+ * Set the handler of an exception, as in the vector table. Exceptions
+ * without a handler are never taken.
+ *
+ * @param emu Emulator state.
+ * @param exception ARM_EXCEPTION_SYSTICK or ARM_EXCEPTION_IRQ(n).
+ * @param handler Handler address, 0 to disable.
+ * @return 0 on success, negative if exception is out of range.
+ */
+int arm_emulator_set_vector(
+	struct arm_emulator_state *emu,
+	unsigned int exception,
+	uint32_t handler);
+
+/**
+ * Make an exception pending. It is taken in thread mode with PRIMASK
+ * clear; exceptions do not preempt each other and lower numbers are taken
+ * first.
+ *
+ * @param emu Emulator state.
+ * @param exception ARM_EXCEPTION_SYSTICK or ARM_EXCEPTION_IRQ(n).
+ * @return 0 on success, negative if exception is out of range or has no
+ *         handler.
+ */
+int arm_emulator_set_pending(
+	struct arm_emulator_state *emu,
+	unsigned int exception);
+
+/**
+ * Start or stop SysTick. The SysTick exception becomes pending every
+ * reload clock ticks.
+ *
+ * @param emu Emulator state.
+ * @param reload Period in clock ticks, 0 to stop.
+ * @return 0 on success, negative if no timer is free.
+ */
+int arm_emulator_set_systick(
+	struct arm_emulator_state *emu,
+	uint32_t reload);
+
 /**
  * Get function return value (R0).
  *
@@ -135,6 +689,314 @@ enum arm_emulator_result arm_emulator_execute(
 uint32_t arm_emulator_get_function_return_value(
 	struct arm_emulator_state *emu);
 
+/**
+ * Get a 64-bit return value (R0 low, R1 high word).
+ *
+ * @param emu Emulator state.
+ * @return Return value.
+ */
+uint64_t arm_emulator_get_function_return_value64(
+	const struct arm_emulator_state *emu);
+
+/**
+ * Copy the result of a call started with arm_emulator_start_call(): from
+ * R0 if size is at most 4, otherwise from the memory reserved for the
+ * structure result.
+ *
+ * @param emu Emulator state, after ARM_EMULATOR_FUNCTION_RETURNED.
+ * @param result Buffer receiving the result.
+ * @param size Size of the result in bytes.
+ * @return 0 on success, negative if size exceeds the reserved memory.
+ */
+int arm_emulator_get_call_result(
+	const struct arm_emulator_state *emu,
+	void *result,
+	uint32_t size);
+
+/**
+ * Bind a guest function address to a host implementation.
+ * Branches to the address call the native function instead of emulating
+ * the guest code. Binding an already bound address replaces the function,
+ * binding NULL removes it.
+ *
+ * @param emu Emulator state.
+ * @param address Guest function address (Thumb bit is ignored).
+ * @param function Native implementation, or NULL.
+ * @return 0 on success, negative if the table is full.
+ */
+int arm_emulator_register_native(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	arm_emulator_native_t function);
+
+/**
+ * Run the native function or host callback bound to an address, as if
+ * the guest branched to it. Used by translated code for calls.
+ *
+ * @param emu Emulator state, with LR set to the return address.
+ * @param address Guest function address.
+ * @return 0 if handled (execution continues at LR), negative if the guest
+ *         code must be emulated, positive if partially handled (execution
+ *         continues with a branch to the address in PC).
+ */
+int arm_emulator_call_native(
+	struct arm_emulator_state *emu,
+	uint32_t address);
+
+/**
+ * Set the event register, e.g. from the host when an instance stopped with
+ * ARM_EMULATOR_WAIT should wake up. A WFE resumed by the next
+ * arm_emulator_execute() consumes the event. Not thread-safe: call with
+ * the instance parked or under the lock that guards it.
+ *
+ * @param emu Emulator state.
+ */
+void arm_emulator_signal_event(struct arm_emulator_state *emu);
+
+/**
+ * Configure the virtual clock. The clock is derived from the number of
+ * executed instructions, so runs are reproducible. It is not affected by
+ * arm_emulator_reset(). arm_emulator_init() sets
+ * ARM_CLOCK_INSTRUCTIONS_PER_MS and an uptime of 0.
+ *
+ * @param emu Emulator state.
+ * @param instructions_per_ms Instructions per millisecond, non-zero.
+ * @param uptime_ms Current uptime in milliseconds.
+ * @return 0 on success, negative if instructions_per_ms is 0.
+ */
+int arm_emulator_set_clock(
+	struct arm_emulator_state *emu,
+	uint32_t instructions_per_ms,
+	uint32_t uptime_ms);
+
+/**
+ * Get the virtual uptime, for service_get_uptime_t implementations.
+ *
+ * @param emu Emulator state.
+ * @return Uptime in milliseconds.
+ */
+uint32_t arm_emulator_get_uptime(const struct arm_emulator_state *emu);
+
+/**
+ * Fast-forward the virtual clock, e.g. while the guest is waiting.
+ *
+ * @param emu Emulator state.
+ * @param ms Milliseconds to skip.
+ */
+void arm_emulator_advance_clock(
+	struct arm_emulator_state *emu,
+	uint32_t ms);
+
+/**
+ * Native implementation of service_get_uptime_t on the virtual clock.
+ * Bind it to the GetUptime address with arm_emulator_register_native().
+ *
+ * @param emu Emulator state.
+ * @return 0.
+ */
+int arm_emulator_native_get_uptime(struct arm_emulator_state *emu);
+
+/**
+ * Native implementations of the service API 1.1 functions MemCopy,
+ * MemSet, MemCompare and Crc32. Bind them to the addresses published in
+ * struct service_api with arm_emulator_register_native(). Destinations
+ * must be in the data region, sources in the data or program region;
+ * other ranges are not handled and the call is passed on to
+ * arm_emulator_callback_functioncall().
+ *
+ * @param emu Emulator state.
+ * @return 0, negative if a range is out of bounds.
+ */
+int arm_emulator_native_mem_copy(struct arm_emulator_state *emu);
+int arm_emulator_native_mem_set(struct arm_emulator_state *emu);
+int arm_emulator_native_mem_compare(struct arm_emulator_state *emu);
+int arm_emulator_native_crc32(struct arm_emulator_state *emu);
+
+/**
+ * Set the SVC handler table. SVC #n calls table[n]: arguments and results
+ * are in R0-R3, execution continues after the SVC when the handler
+ * returns 0, with a branch to PC when it returns a positive value. SVCs
+ * without a handler stop execution with ARM_EMULATOR_ERROR.
+ *
+ * @param emu Emulator state.
+ * @param table Handlers, entries may be NULL. NULL to disable SVC.
+ * @param count Number of entries, at most 256.
+ */
+void arm_emulator_set_svc_table(
+	struct arm_emulator_state *emu,
+	const arm_emulator_native_t *table,
+	unsigned int count);
+
+/**
+ * Run the SVC handler for an immediate. Used by translated code.
+ *
+ * @param emu Emulator state, with PC after the SVC.
+ * @param number SVC immediate.
+ * @return Result of the handler, negative if there is none.
+ */
+int arm_emulator_call_svc(
+	struct arm_emulator_state *emu,
+	uint8_t number);
+
+/**
+ * Enable the block cache. Blocks of code in the program and data regions
+ * are analysed once, and condition flag updates that are overwritten
+ * within the block are skipped. Blocks in the data region are discarded
+ * when the pages they are on are written. Flags are exact whenever
+ * control leaves a block, a callback for a function call runs or
+ * arm_emulator_execute() returns.
+ * The memory read callback may observe flags from before a skipped update.
+ *
+ * @param emu Emulator state.
+ * @param blocks Cache storage, NULL to disable the cache.
+ * @param blocks_count Number of entries, must be a power of two.
+ * @return 0 on success, negative if blocks_count is not a power of two.
+ */
+int arm_emulator_set_block_cache(
+	struct arm_emulator_state *emu,
+	struct arm_emulator_block *blocks,
+	unsigned int blocks_count);
+
+/**
+ * Set the tiering thresholds. Code starts in the interpreter; with the
+ * block cache enabled, the flag liveness of a block is analysed once it
+ * has started liveness_threshold times from a branch, and its dead flag
+ * updates are skipped from then on. The instructions are still decoded
+ * on every execution. A block in the cache that starts a function with a
+ * translation (see arm_emulator_set_translations()) has the translation
+ * bound as a native function once it reached translate_threshold
+ * executions. The defaults, 1 and 0, analyse every block at once and
+ * bind no translations.
+ *
+ * @param emu Emulator state.
+ * @param liveness_threshold Executions before the analysis, at least 1.
+ * @param translate_threshold Executions before binding a translation,
+ *        0 for never; raised to liveness_threshold + 1 if lower.
+ */
+void arm_emulator_set_tier_thresholds(
+	struct arm_emulator_state *emu,
+	uint16_t liveness_threshold,
+	uint16_t translate_threshold);
+
+/**
+ * Supply translated functions for tiering, for instance the functions
+ * table generated by tools/arm_translate. They are bound as native
+ * functions only when hot, which leaves the native function table to
+ * the code that matters.
+ *
+ * @param emu Emulator state.
+ * @param translations Translated functions, must stay valid while set.
+ * @param count Number of functions, 0 to stop binding translations.
+ */
+void arm_emulator_set_translations(
+	struct arm_emulator_state *emu,
+	const struct arm_emulator_native_function *translations,
+	unsigned int count);
+
+/**
+ * Pin blocks starting in an address range to a tier, regardless of the
+ * thresholds. ARM_TIER_TRANSLATED binds the translations in the range at
+ * once. Pinning flushes the range first, see arm_emulator_flush_tiers().
+ * Pinning a range again replaces its tier; ARM_TIER_AUTO removes the pin.
+ *
+ * @param emu Emulator state.
+ * @param address Start address.
+ * @param size Size in bytes.
+ * @param tier enum arm_emulator_tier.
+ * @return 0 on success, negative if the pin table is full.
+ */
+int arm_emulator_pin_tier(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t size,
+	uint8_t tier);
+
+/**
+ * Return code in an address range to the interpreter: discard the cached
+ * blocks and execution counts starting there, and unbind the
+ * translations bound by tiering.
+ *
+ * @param emu Emulator state.
+ * @param address Start address.
+ * @param size Size in bytes.
+ */
+void arm_emulator_flush_tiers(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t size);
+
+/**
+ * Count the code starting in an address range by tier.
+ *
+ * @param emu Emulator state.
+ * @param address Start address.
+ * @param size Size in bytes.
+ * @param stats Result.
+ */
+void arm_emulator_inspect_tiers(
+	const struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t size,
+	struct arm_emulator_tier_stats *stats);
+
+/**
+ * Enable the branch cache. Branch targets that the function call callback
+ * declines are then remembered and not passed to it again, and returns
+ * to the instruction after a BL or BLX are not passed at all. Only enable
+ * it if the callback declines the same addresses every time and never
+ * handles a return address. Disabled by default.
+ *
+ * @param emu Emulator state.
+ * @param enable Nonzero to enable, 0 to pass every target to the callback.
+ */
+void arm_emulator_set_branch_cache(
+	struct arm_emulator_state *emu,
+	int enable);
+
+/**
+ * Forget the branch targets that the function call callback did not
+ * handle. Call when the callback starts handling an address it declined
+ * before. Registering a native function, arm_emulator_reset() and
+ * arm_emulator_set_branch_cache() do this already.
+ *
+ * @param emu Emulator state.
+ */
+void arm_emulator_flush_branch_cache(struct arm_emulator_state *emu);
+
+/**
+ * Discard all cached blocks. Call after modifying program memory.
+ *
+ * @param emu Emulator state.
+ */
+void arm_emulator_flush_block_cache(struct arm_emulator_state *emu);
+
+/**
+ * Discard the cached blocks on the pages of the data region that overlap
+ * a range. Stores by the guest and writes through
+ * arm_emulator_host_data_pointer() do this already; call it after
+ * writing to data memory by other means.
+ *
+ * @param emu Emulator state.
+ * @param address Start address.
+ * @param size Size in bytes.
+ */
+void arm_emulator_invalidate_code(
+	struct arm_emulator_state *emu,
+	uint32_t address,
+	uint32_t size);
+
+/**
+ * Install the result of arm_verify(). Instructions marked in the bitmap
+ * are fetched from the program region without bounds checks.
+ *
+ * @param emu Emulator state.
+ * @param bitmap Bitmap of verified instructions, NULL to check every
+ *        instruction fetch. Must stay valid while installed.
+ */
+void arm_emulator_set_verified(
+	struct arm_emulator_state *emu,
+	const uint32_t *bitmap);
+
 /**
  * Dump register state to UART.
  *
@@ -145,8 +1007,11 @@ void arm_emulator_dump(struct arm_emulator_state *emu);
 /**
  * Callback for external function calls. Implemented by user.
  *
- * Called when the emulator encounters a BL/BLX to an address outside
- * defined memory regions.
+ * Called when the emulator branches to an address that is not a native
+ * function. With the branch cache enabled (see
+ * arm_emulator_set_branch_cache()), a target that is not handled is not
+ * passed again until arm_emulator_flush_branch_cache(), and returns to
+ * the instruction after a BL or BLX are not passed.
  *
  * @param emu Emulator state (may be modified by callback).
  * @param function_address Address of the function being called.
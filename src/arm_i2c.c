@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: MIT
+/** \file I2C bus and reference device model. */
+#include "arm_i2c.h"
+#include <string.h>	// memcpy
+#include "plugin_api.h"	// struct service_i2c_op layout.
+
+//================================================================================================================
+/* Device and register file offset for a combined address, or NULL. */
+static struct arm_i2c_device *
+_find_device(
+	struct arm_i2c_bus *bus,
+	uint32_t address_page_register,
+	uint8_t **page)
+{
+	const uint8_t address = (uint8_t)(address_page_register >> 16);
+	const uint8_t page_number = (uint8_t)(address_page_register >> 8);
+	unsigned int i;
+	for (i = 0; i < bus->devices_count; ++i)
+	{
+		struct arm_i2c_device *device = &bus->devices[i];
+		if (device->address == address)
+		{
+			if (page_number >= device->pages)
+			{
+				return NULL;
+			}
+			*page = device->registers + 256 * (size_t)page_number;
+			return device;
+		}
+	}
+	return NULL;
+}
+
+//================================================================================================================
+int
+arm_i2c_write(
+	struct arm_i2c_bus *bus,
+	uint32_t address_page_register,
+	const uint8_t *data,
+	uint32_t nbytes)
+{
+	uint8_t *page;
+	struct arm_i2c_device *device = _find_device(bus, address_page_register, &page);
+	uint8_t reg = (uint8_t)address_page_register;
+	uint32_t i;
+	++bus->transfers;
+	if (device == NULL)
+	{
+		return -1;
+	}
+	for (i = 0; i < nbytes; ++i)
+	{
+		page[reg++] = data[i];
+	}
+	device->bytes_written += nbytes;
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_i2c_read(
+	struct arm_i2c_bus *bus,
+	uint8_t *buffer,
+	uint32_t address_page_register,
+	uint32_t count)
+{
+	uint8_t *page;
+	struct arm_i2c_device *device = _find_device(bus, address_page_register, &page);
+	uint8_t reg = (uint8_t)address_page_register;
+	uint32_t i;
+	++bus->transfers;
+	if (device == NULL)
+	{
+		return -1;
+	}
+	for (i = 0; i < count; ++i)
+	{
+		buffer[i] = page[reg++];
+	}
+	device->bytes_read += count;
+	return 0;
+}
+
+//================================================================================================================
+void
+arm_i2c_attach(
+	struct arm_emulator_state *emu,
+	struct arm_i2c_bus *bus)
+{
+	emu->i2c = bus;
+}
+
+//================================================================================================================
+/* One transfer on the attached bus, from or to guest memory. */
+static int
+_transfer(
+	struct arm_emulator_state *emu,
+	uint8_t direction,
+	uint32_t address_page_register,
+	uint32_t data,
+	uint32_t nbytes)
+{
+	if (direction == SERVICE_I2C_READ)
+	{
+		uint8_t *buffer = arm_emulator_host_data_pointer(emu, data, nbytes);
+		return buffer != NULL
+			? arm_i2c_read(emu->i2c, buffer, address_page_register, nbytes)
+			: -1;
+	}
+	else
+	{
+		const uint8_t *buffer = arm_emulator_host_pointer(emu, data, nbytes);
+		return buffer != NULL
+			? arm_i2c_write(emu->i2c, address_page_register, buffer, nbytes)
+			: -1;
+	}
+}
+
+//================================================================================================================
+int
+arm_i2c_native_write(struct arm_emulator_state *emu)
+{
+	/* R0 = address_page_register, R1 = data, R2 = nbytes. */
+	emu->R[0] = emu->i2c != NULL
+		? (uint32_t)_transfer(emu, SERVICE_I2C_WRITE, emu->R[0], emu->R[1], emu->R[2])
+		: (uint32_t)-1;
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_i2c_native_read(struct arm_emulator_state *emu)
+{
+	/* R0 = buffer, R1 = address_page_register, R2 = count. */
+	emu->R[0] = emu->i2c != NULL
+		? (uint32_t)_transfer(emu, SERVICE_I2C_READ, emu->R[1], emu->R[0], emu->R[2])
+		: (uint32_t)-1;
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_i2c_native_transaction(struct arm_emulator_state *emu)
+{
+	/* R0 = ops, R1 = count. */
+	const uint32_t count = emu->R[1];
+	const uint8_t *op = count <= 0xFFFFFFFFu / SERVICE_I2C_OP_SIZE
+		? arm_emulator_host_pointer(emu, emu->R[0], count * SERVICE_I2C_OP_SIZE)
+		: NULL;
+	uint32_t i;
+	if (emu->i2c == NULL || op == NULL)
+	{
+		emu->R[0] = (uint32_t)-1;
+		return 0;
+	}
+	for (i = 0; i < count; ++i, op += SERVICE_I2C_OP_SIZE)
+	{
+		uint32_t address_page_register;
+		uint32_t data;
+		uint16_t nbytes;
+		memcpy(&address_page_register, op, 4);
+		memcpy(&data, op + 4, 4);
+		memcpy(&nbytes, op + 8, 2);
+		if (_transfer(emu, op[10], address_page_register, data, nbytes) != 0)
+		{
+			emu->R[0] = (uint32_t)(-1 - (int32_t)i);
+			return 0;
+		}
+	}
+	emu->R[0] = 0;
+	return 0;
+}
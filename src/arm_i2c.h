@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Host-side I2C bus with a reference register-file device model, and
+ * native implementations of the service API I2C functions on top of it.
+ */
+#ifndef ARM_I2C_H
+#define ARM_I2C_H
+
+#include "arm_emulator.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+ * Reference I2C device: pages of 256 registers. A transfer starts at the
+ * addressed register and auto-increments, wrapping within the page.
+ */
+struct arm_i2c_device {
+	/** Device address, as in MAKE_ADDRESS_PAGE_REGISTER. */
+	uint8_t address;
+	/** Number of pages, at least 1. */
+	uint8_t pages;
+	/** Register contents, pages * 256 bytes. */
+	uint8_t *registers;
+	/** Bytes transferred, for statistics. */
+	uint32_t bytes_written;
+	uint32_t bytes_read;
+};
+
+/**
+ * I2C bus. Storage for the devices is provided by the user.
+ */
+struct arm_i2c_bus {
+	struct arm_i2c_device *devices;
+	unsigned int devices_count;
+	/** Transfers started (one per write or read), for statistics. */
+	uint32_t transfers;
+};
+
+/**
+ * Write bytes to a device on the bus.
+ *
+ * @param bus Bus.
+ * @param address_page_register Combined address.
+ * @param data Data to write.
+ * @param nbytes Number of bytes.
+ * @return 0 on success, negative if no device acknowledges the address
+ *         or the page does not exist.
+ */
+int arm_i2c_write(
+	struct arm_i2c_bus *bus,
+	uint32_t address_page_register,
+	const uint8_t *data,
+	uint32_t nbytes);
+
+/**
+ * Read bytes from a device on the bus.
+ *
+ * @param bus Bus.
+ * @param buffer Buffer to read into.
+ * @param address_page_register Combined address.
+ * @param count Number of bytes.
+ * @return 0 on success, negative if no device acknowledges the address
+ *         or the page does not exist.
+ */
+int arm_i2c_read(
+	struct arm_i2c_bus *bus,
+	uint8_t *buffer,
+	uint32_t address_page_register,
+	uint32_t count);
+
+/**
+ * Attach a bus to an emulator instance for the natives below.
+ *
+ * @param emu Emulator state.
+ * @param bus Bus, or NULL to detach.
+ */
+void arm_i2c_attach(
+	struct arm_emulator_state *emu,
+	struct arm_i2c_bus *bus);
+
+/**
+ * Native implementations of service_write_i2c_t, service_read_i2c_t and
+ * service_i2c_transaction_t on the attached bus. Bind them to the
+ * addresses published in struct service_api with
+ * arm_emulator_register_native(). Buffers that are read from may be in
+ * any region, buffers that are written to must be in the data region;
+ * other buffers, or no bus attached, fail the call with -1 in R0.
+ *
+ * @param emu Emulator state.
+ * @return 0.
+ */
+int arm_i2c_native_write(struct arm_emulator_state *emu);
+int arm_i2c_native_read(struct arm_emulator_state *emu);
+int arm_i2c_native_transaction(struct arm_emulator_state *emu);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* ARM_I2C_H */
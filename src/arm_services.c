@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: MIT
+/** \file Host implementation of the service API. */
+#include "arm_services.h"
+#include <stddef.h>	// NULL
+#include "arm_i2c.h"	// I2C natives.
+
+//================================================================================================================
+static void
+_flush_timer(
+	struct arm_emulator_state *emu,
+	uint32_t id,
+	uint64_t when)
+{
+	struct arm_services *services = emu->services;
+	if (services != NULL && services->flush_ticks > 0)
+	{
+		arm_services_flush(services);
+		arm_emulator_add_timer(emu, when + services->flush_ticks, _flush_timer, id);
+	}
+}
+
+//================================================================================================================
+int
+arm_services_attach(
+	struct arm_emulator_state *emu,
+	struct arm_services *services,
+	uint32_t flush_interval_ms)
+{
+	arm_emulator_remove_timer(emu, _flush_timer, 0);
+	emu->services = services;
+	if (services == NULL)
+	{
+		return 0;
+	}
+	services->dirty_top = services->rows;
+	services->dirty_left = services->columns;
+	services->dirty_bottom = 0;
+	services->dirty_right = 0;
+	services->flush_ticks = (uint64_t)flush_interval_ms * emu->clock_rate;
+	return services->flush_ticks == 0
+		? 0
+		: arm_emulator_add_timer(emu, emu->clock_ticks + services->flush_ticks, _flush_timer, 0);
+}
+
+//================================================================================================================
+void
+arm_services_flush(struct arm_services *services)
+{
+	if (services->dirty_top >= services->dirty_bottom)
+	{
+		return;
+	}
+	if (services->flush != NULL)
+	{
+		services->flush(services->context, services);
+	}
+	services->dirty_top = services->rows;
+	services->dirty_left = services->columns;
+	services->dirty_bottom = 0;
+	services->dirty_right = 0;
+}
+
+//================================================================================================================
+/* Bind one function address, unless it is not published. */
+static int
+_bind(
+	struct arm_emulator_state *emu,
+	const struct service_api *api,
+	unsigned int index,
+	const void *function,
+	arm_emulator_native_t native)
+{
+	if (index >= api->function_count || function == NULL)
+	{
+		return 0;
+	}
+	return arm_emulator_register_native(emu, (uint32_t)(uintptr_t)function, native);
+}
+
+//================================================================================================================
+int
+arm_services_bind(
+	struct arm_emulator_state *emu,
+	const struct service_api *api)
+{
+	int r = 0;
+	r |= _bind(emu, api, 0, (const void *)api->GetUptime, arm_emulator_native_get_uptime);
+	r |= _bind(emu, api, 1, (const void *)api->DebugWriteLine, arm_services_native_debug_writeln);
+	r |= _bind(emu, api, 2, (const void *)api->DebugWriteLineHex32, arm_services_native_debug_writeln_hex32);
+	r |= _bind(emu, api, 3, (const void *)api->WriteScreen, arm_services_native_write_screen);
+	r |= _bind(emu, api, 4, (const void *)api->WriteScreenDecimal, arm_services_native_write_screen_decimal);
+	r |= _bind(emu, api, 5, (const void *)api->WriteI2C, arm_i2c_native_write);
+	r |= _bind(emu, api, 6, (const void *)api->ReadI2C, arm_i2c_native_read);
+	r |= _bind(emu, api, 7, (const void *)api->MemCopy, arm_emulator_native_mem_copy);
+	r |= _bind(emu, api, 8, (const void *)api->MemSet, arm_emulator_native_mem_set);
+	r |= _bind(emu, api, 9, (const void *)api->MemCompare, arm_emulator_native_mem_compare);
+	r |= _bind(emu, api, 10, (const void *)api->Crc32, arm_emulator_native_crc32);
+	r |= _bind(emu, api, 11, (const void *)api->I2CTransaction, arm_i2c_native_transaction);
+	return r < 0 ? -1 : 0;
+}
+
+//================================================================================================================
+static void
+_debug(
+	struct arm_emulator_state *emu,
+	const uint32_t *x)
+{
+	const struct arm_services *services = emu->services;
+	const uint16_t length = (uint16_t)emu->R[1];
+	const uint8_t *s = arm_emulator_host_pointer(emu, emu->R[0], length);
+	if (services != NULL && services->debug != NULL && s != NULL)
+	{
+		services->debug(services->context, (const char *)s, length, x);
+	}
+}
+
+//================================================================================================================
+int
+arm_services_native_debug_writeln(struct arm_emulator_state *emu)
+{
+	/* R0 = s, R1 = length. */
+	_debug(emu, NULL);
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_services_native_debug_writeln_hex32(struct arm_emulator_state *emu)
+{
+	/* R0 = s, R1 = length, R2 = x. */
+	const uint32_t x = emu->R[2];
+	_debug(emu, &x);
+	return 0;
+}
+
+//================================================================================================================
+/* Write text at yx, clipped to the framebuffer; only changed cells are dirty. */
+static void
+_write_screen(
+	struct arm_services *services,
+	uint32_t yx,
+	const char *s,
+	uint32_t length)
+{
+	const uint16_t row = (uint16_t)(yx >> 16);
+	const uint16_t column = (uint16_t)yx;
+	char *cells;
+	uint32_t i;
+	uint32_t first;
+	uint32_t last = 0;
+	if (services->cells == NULL || row >= services->rows || column >= services->columns)
+	{
+		return;
+	}
+	if (length > (uint32_t)(services->columns - column))
+	{
+		length = services->columns - column;
+	}
+	first = length;
+	cells = services->cells + (size_t)row * services->columns + column;
+	for (i = 0; i < length; ++i)
+	{
+		if (cells[i] != s[i])
+		{
+			cells[i] = s[i];
+			if (first == length)
+			{
+				first = i;
+			}
+			last = i + 1;
+		}
+	}
+	if (first == length)
+	{
+		return;
+	}
+	if (row < services->dirty_top)
+	{
+		services->dirty_top = row;
+	}
+	if (row + 1 > services->dirty_bottom)
+	{
+		services->dirty_bottom = row + 1;
+	}
+	if (column + first < services->dirty_left)
+	{
+		services->dirty_left = (uint16_t)(column + first);
+	}
+	if (column + last > services->dirty_right)
+	{
+		services->dirty_right = (uint16_t)(column + last);
+	}
+}
+
+//================================================================================================================
+int
+arm_services_native_write_screen(struct arm_emulator_state *emu)
+{
+	/* R0 = yx, R1 = s, R2 = length. */
+	const uint16_t length = (uint16_t)emu->R[2];
+	const uint8_t *s = arm_emulator_host_pointer(emu, emu->R[1], length);
+	if (emu->services != NULL && s != NULL)
+	{
+		_write_screen(emu->services, emu->R[0], (const char *)s, length);
+	}
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_services_native_write_screen_decimal(struct arm_emulator_state *emu)
+{
+	/* R0 = yx, R1 = number, R2 = nspaces. */
+	const int32_t number = (int32_t)emu->R[1];
+	const uint16_t nspaces = (uint16_t)emu->R[2];
+	uint32_t u = number < 0 ? 0 - (uint32_t)number : (uint32_t)number;
+	char buffer[16];
+	unsigned int n = sizeof(buffer);
+	if (emu->services == NULL)
+	{
+		return 0;
+	}
+	do
+	{
+		buffer[--n] = (char)('0' + u % 10);
+		u /= 10;
+	} while (u != 0);
+	if (number < 0)
+	{
+		buffer[--n] = '-';
+	}
+	while (n > 0 && sizeof(buffer) - n < nspaces)
+	{
+		buffer[--n] = ' ';
+	}
+	_write_screen(emu->services, emu->R[0], buffer + n, sizeof(buffer) - n);
+	return 0;
+}
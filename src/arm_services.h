@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Reusable host side of struct service_api: debug output, a text
+ * framebuffer for WriteScreen with dirty-rectangle tracking and periodic
+ * flushes on the virtual clock, and binding of all service functions to
+ * their native implementations.
+ */
+#ifndef ARM_SERVICES_H
+#define ARM_SERVICES_H
+
+#include "arm_emulator.h"
+#include "plugin_api.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct arm_services;
+
+/**
+ * Receives a DebugWriteLine or DebugWriteLineHex32 line. The text points
+ * into guest memory and is not NUL-terminated.
+ *
+ * @param context User context.
+ * @param s Text.
+ * @param length Length of text in bytes.
+ * @param x Number for DebugWriteLineHex32, NULL for DebugWriteLine.
+ */
+typedef void (*arm_services_debug_t)(
+	void *context,
+	const char *s,
+	uint16_t length,
+	const uint32_t *x);
+
+/**
+ * Receives the framebuffer when part of it changed. The changed cells are
+ * rows dirty_top...dirty_bottom-1, columns dirty_left...dirty_right-1.
+ *
+ * @param context User context.
+ * @param services Services with the framebuffer.
+ */
+typedef void (*arm_services_flush_t)(
+	void *context,
+	const struct arm_services *services);
+
+/**
+ * Host services for one emulator instance. Fill in the public fields and
+ * call arm_services_attach().
+ */
+struct arm_services {
+	/** Text framebuffer, rows * columns characters, row-major. NULL if
+	    the plugin is not permitted to write to the screen. */
+	char *cells;
+	uint16_t rows;
+	uint16_t columns;
+	/** Dirty rectangle, empty if dirty_top >= dirty_bottom. */
+	uint16_t dirty_top;
+	uint16_t dirty_left;
+	uint16_t dirty_bottom;
+	uint16_t dirty_right;
+	/** Output, either may be NULL. */
+	arm_services_debug_t debug;
+	arm_services_flush_t flush;
+	void *context;
+	/** Flush period in clock ticks, 0 to flush only on request. */
+	uint64_t flush_ticks;
+};
+
+/**
+ * Attach services to an emulator instance for the natives below, and
+ * start periodic flushes of the framebuffer on the virtual clock.
+ *
+ * @param emu Emulator state.
+ * @param services Services, or NULL to detach.
+ * @param flush_interval_ms Flush period in virtual milliseconds, 0 to
+ *        flush only on arm_services_flush().
+ * @return 0 on success, negative if the timer queue is full.
+ */
+int arm_services_attach(
+	struct arm_emulator_state *emu,
+	struct arm_services *services,
+	uint32_t flush_interval_ms);
+
+/**
+ * Pass the dirty part of the framebuffer to the flush callback, if any,
+ * and mark the framebuffer clean.
+ *
+ * @param services Services.
+ */
+void arm_services_flush(struct arm_services *services);
+
+/**
+ * Bind the functions published in a service API structure to their
+ * native implementations: the natives below, arm_emulator_native_get_uptime,
+ * the service API 1.1 memory natives and the arm_i2c natives, as far as
+ * function_count covers them. Function addresses must differ with the
+ * Thumb bit cleared; NULL entries are skipped.
+ *
+ * @param emu Emulator state.
+ * @param api Service API as published to the guest.
+ * @return 0 on success, negative if the native function table is full.
+ */
+int arm_services_bind(
+	struct arm_emulator_state *emu,
+	const struct service_api *api);
+
+/**
+ * Native implementations of DebugWriteLine, DebugWriteLineHex32,
+ * WriteScreen and WriteScreenDecimal on the attached services. Text is
+ * read in place, see arm_emulator_host_pointer(). Text out of bounds, or
+ * no services attached, is ignored. Screen writes are clipped to the
+ * framebuffer and do not wrap.
+ *
+ * @param emu Emulator state.
+ * @return 0.
+ */
+int arm_services_native_debug_writeln(struct arm_emulator_state *emu);
+int arm_services_native_debug_writeln_hex32(struct arm_emulator_state *emu);
+int arm_services_native_write_screen(struct arm_emulator_state *emu);
+int arm_services_native_write_screen_decimal(struct arm_emulator_state *emu);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* ARM_SERVICES_H */
@@ -0,0 +1,556 @@
+// SPDX-License-Identifier: MIT
+/** \file Signature-based detection of runtime helpers. */
+#include "arm_signatures.h"
+#include <string.h>	// memcpy, memmove, memset, strcmp
+#include "arm_decode.h"
+
+/* Wildcards for the variable fields of common instructions. */
+#define	W_EXACT(x)	{ (x), 0xFFFF }
+#define	W_BCOND(c)	{ 0xD000 | ((c) << 8), 0xFF00 }
+#define	W_BL_HI		{ 0xF000, 0xF800 }
+#define	W_BL_LO		{ 0xD000, 0xD000 }
+#define	W_CMP_REG	{ 0x4280, 0xFFC0 }
+#define	W_ANY		{ 0x0000, 0x0000 }
+
+//================================================================================================================
+static float
+_float_of(uint32_t x)
+{
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+//================================================================================================================
+static int
+_native_udivsi3(struct arm_emulator_state *emu)
+{
+	if (emu->R[1] == 0)
+	{
+		/* Let the guest handle division by zero. */
+		return -1;
+	}
+	emu->R[0] = emu->R[0] / emu->R[1];
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_divsi3(struct arm_emulator_state *emu)
+{
+	const int32_t n = (int32_t)emu->R[0];
+	const int32_t d = (int32_t)emu->R[1];
+	if (d == 0)
+	{
+		return -1;
+	}
+	emu->R[0] = (d == -1) ? 0 - emu->R[0] : (uint32_t)(n / d);
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_uidivmod(struct arm_emulator_state *emu)
+{
+	const uint32_t n = emu->R[0];
+	const uint32_t d = emu->R[1];
+	if (d == 0)
+	{
+		return -1;
+	}
+	emu->R[0] = n / d;
+	emu->R[1] = n % d;
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_idivmod(struct arm_emulator_state *emu)
+{
+	const int32_t n = (int32_t)emu->R[0];
+	const int32_t d = (int32_t)emu->R[1];
+	if (d == 0)
+	{
+		return -1;
+	}
+	if (d == -1)
+	{
+		/* INT_MIN / -1 wraps on the target. */
+		emu->R[0] = 0 - emu->R[0];
+		emu->R[1] = 0;
+	}
+	else
+	{
+		emu->R[0] = (uint32_t)(n / d);
+		emu->R[1] = (uint32_t)(n % d);
+	}
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_memcpy(struct arm_emulator_state *emu)
+{
+	const uint32_t count = emu->R[2];
+	uint8_t *dst = arm_emulator_host_data_pointer(emu, emu->R[0], count);
+	const uint8_t *src = arm_emulator_host_data_pointer(emu, emu->R[1], count);
+	if (dst == NULL)
+	{
+		return -1;
+	}
+	if (src != NULL)
+	{
+		memmove(dst, src, count);
+	}
+	else if (count > 0 && arm_emulator_read_memory(emu, dst, emu->R[1], count) != 0)
+	{
+		return -1;
+	}
+	/* R0 = dst already. */
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_memset(struct arm_emulator_state *emu)
+{
+	const uint32_t count = emu->R[2];
+	uint8_t *dst = arm_emulator_host_data_pointer(emu, emu->R[0], count);
+	if (dst == NULL)
+	{
+		return -1;
+	}
+	memset(dst, (uint8_t)emu->R[1], count);
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_fcmpeq(struct arm_emulator_state *emu)
+{
+	emu->R[0] = _float_of(emu->R[0]) == _float_of(emu->R[1]);
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_fcmplt(struct arm_emulator_state *emu)
+{
+	emu->R[0] = _float_of(emu->R[0]) < _float_of(emu->R[1]);
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_fcmple(struct arm_emulator_state *emu)
+{
+	emu->R[0] = _float_of(emu->R[0]) <= _float_of(emu->R[1]);
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_fcmpge(struct arm_emulator_state *emu)
+{
+	emu->R[0] = _float_of(emu->R[0]) >= _float_of(emu->R[1]);
+	return 0;
+}
+
+//================================================================================================================
+static int
+_native_fcmpgt(struct arm_emulator_state *emu)
+{
+	emu->R[0] = _float_of(emu->R[0]) > _float_of(emu->R[1]);
+	return 0;
+}
+
+//================================================================================================================
+/*
+ * Patterns.
+ * Division: libgcc lib1funcs.S, Thumb-1 variant.
+ * Float comparison: libgcc bpabi-v6m.S COMPARISON macro, told apart from
+ * the double comparisons by the arguments of the helper they call.
+ * memcpy/memset: newlib PREFER_SIZE_OVER_SPEED build with GCC -Os.
+ *
+ * __aeabi_fadd and the other soft-float arithmetic are compiled from C
+ * (soft-fp) and differ between compiler versions; pass a table with
+ * patterns of your toolchain to arm_signatures_scan() for those.
+ */
+static const struct arm_signature_word _udivsi3[] = {
+	W_EXACT(0x2900),	// cmp r1, #0
+	W_BCOND(0x0),		// beq .Ldiv0
+	W_EXACT(0x2301),	// movs r3, #1
+	W_EXACT(0x2200),	// movs r2, #0
+	W_EXACT(0xB410),	// push {r4}
+	W_EXACT(0x4288),	// cmp r0, r1
+	W_BCOND(0x3),		// bcc .Lgot_result
+};
+
+static const struct arm_signature_word _divsi3[] = {
+	W_EXACT(0x2900),	// cmp r1, #0
+	W_BCOND(0x0),		// beq .Ldiv0
+	W_EXACT(0xB410),	// push {r4}
+	W_ANY,				// mov r4, r0
+	W_EXACT(0x404C),	// eors r4, r1
+	W_EXACT(0x46A4),	// mov ip, r4
+	W_EXACT(0x2301),	// movs r3, #1
+	W_EXACT(0x2200),	// movs r2, #0
+	W_EXACT(0x2900),	// cmp r1, #0
+	W_BCOND(0x5),		// bpl .Lover10
+	W_EXACT(0x4249),	// negs r1, r1
+};
+
+static const struct arm_signature_word _divmod[] = {
+	W_EXACT(0x2900),	// cmp r1, #0
+	W_BCOND(0x0),		// beq .Ldiv0
+	W_EXACT(0xB503),	// push {r0, r1, lr}
+	W_BL_HI,			// bl __udivsi3 / __divsi3
+	W_BL_LO,
+	W_EXACT(0xBC0E),	// pop {r1, r2, r3}
+	W_EXACT(0x4342),	// muls r2, r0
+	W_EXACT(0x1A89),	// subs r1, r1, r2
+	W_EXACT(0x4718),	// bx r3
+};
+
+static const struct arm_signature_word _memcpy[] = {
+	W_EXACT(0x2300),	// movs r3, #0
+	W_EXACT(0xB510),	// push {r4, lr}
+	W_CMP_REG,			// cmp r3, r2
+	W_EXACT(0xD100),	// bne .L3
+	W_EXACT(0xBD10),	// pop {r4, pc}
+	W_EXACT(0x5CCC),	// ldrb r4, [r1, r3]
+	W_EXACT(0x54C4),	// strb r4, [r0, r3]
+	W_EXACT(0x3301),	// adds r3, #1
+	W_EXACT(0xE7F8),	// b .L2
+};
+
+static const struct arm_signature_word _memset[] = {
+	W_EXACT(0x1882),	// adds r2, r0, r2
+	W_EXACT(0x0003),	// movs r3, r0
+	W_CMP_REG,			// cmp r3, r2
+	W_EXACT(0xD100),	// bne .L3
+	W_EXACT(0x4770),	// bx lr
+	W_EXACT(0x7019),	// strb r1, [r3]
+	W_EXACT(0x3301),	// adds r3, #1
+	W_EXACT(0xE7F9),	// b .L2
+};
+
+#define	FCMP_PATTERN(cond) { \
+	W_EXACT(0xB510),		/* push {r4, lr} */ \
+	W_BL_HI,				/* bl __cmpsf2 variant */ \
+	W_BL_LO, \
+	W_EXACT(0x2800),		/* cmp r0, #0 */ \
+	W_EXACT(0xD001 | ((cond) << 8)),	/* b<cond> 1f */ \
+	W_EXACT(0x2000),		/* movs r0, #0 */ \
+	W_EXACT(0xBD10),		/* pop {r4, pc} */ \
+	W_EXACT(0x2001),		/* 1: movs r0, #1 */ \
+	W_EXACT(0xBD10),		/* pop {r4, pc} */ \
+}
+
+static const struct arm_signature_word _fcmpeq[] = FCMP_PATTERN(0x0);
+static const struct arm_signature_word _fcmplt[] = FCMP_PATTERN(0xB);
+static const struct arm_signature_word _fcmple[] = FCMP_PATTERN(0xD);
+static const struct arm_signature_word _fcmpge[] = FCMP_PATTERN(0xA);
+static const struct arm_signature_word _fcmpgt[] = FCMP_PATTERN(0xC);
+
+#define	PATTERN(x)	(x), (sizeof(x) / sizeof((x)[0]))
+
+const struct arm_signature arm_signatures_default[] = {
+	{ "__udivsi3", PATTERN(_udivsi3), _native_udivsi3, NULL, 0, 0, 0 },
+	{ "__divsi3", PATTERN(_divsi3), _native_divsi3, NULL, 0, 0, 0 },
+	/* The BL goes to the *_skip_div0_test label after cmp r1, #0; beq. */
+	{ "__aeabi_uidivmod", PATTERN(_divmod), _native_uidivmod, "__udivsi3", 3, 4, 0 },
+	{ "__aeabi_idivmod", PATTERN(_divmod), _native_idivmod, "__divsi3", 3, 4, 0 },
+	{ "memcpy", PATTERN(_memcpy), _native_memcpy, NULL, 0, 0, 0 },
+	{ "memset", PATTERN(_memset), _native_memset, NULL, 0, 0, 0 },
+};
+
+const unsigned int arm_signatures_default_count =
+	sizeof(arm_signatures_default) / sizeof(arm_signatures_default[0]);
+
+/* __aeabi_dcmp* have the same code and call the df2 helpers, which read R2-R3. */
+const struct arm_signature arm_signatures_float[] = {
+	{ "__aeabi_fcmpeq", PATTERN(_fcmpeq), _native_fcmpeq, NULL, 1, 0, 2 },
+	{ "__aeabi_fcmplt", PATTERN(_fcmplt), _native_fcmplt, NULL, 1, 0, 2 },
+	{ "__aeabi_fcmple", PATTERN(_fcmple), _native_fcmple, NULL, 1, 0, 2 },
+	{ "__aeabi_fcmpge", PATTERN(_fcmpge), _native_fcmpge, NULL, 1, 0, 2 },
+	{ "__aeabi_fcmpgt", PATTERN(_fcmpgt), _native_fcmpgt, NULL, 1, 0, 2 },
+};
+
+const unsigned int arm_signatures_float_count =
+	sizeof(arm_signatures_float) / sizeof(arm_signatures_float[0]);
+
+//================================================================================================================
+/* Halfword of the program region; offset must be in range. */
+static uint16_t
+_halfword(
+	const struct arm_emulator_state *emu,
+	size_t offset)
+{
+	return (uint16_t)(emu->program[offset] | (emu->program[offset + 1] << 8));
+}
+
+//================================================================================================================
+/* Program offset of the BL target at the given offset. */
+static size_t
+_bl_target_offset(
+	const struct arm_emulator_state *emu,
+	size_t offset)
+{
+	const uint16_t instruction = _halfword(emu, offset);
+	const uint16_t instruction2 = _halfword(emu, offset + 2);
+	const uint32_t s = (instruction >> 10) & 1;
+	const uint32_t j1 = (instruction2 >> 13) & 1;
+	const uint32_t j2 = (instruction2 >> 11) & 1;
+	const uint32_t x =
+		  ((instruction2 & 0x7FF) << 1)
+		| ((instruction & 0x3FF) << 12)
+		| ((1 - (j2 ^ s)) << 22)
+		| ((1 - (j1 ^ s)) << 23)
+		| (s << 24);
+	const uint32_t imm = (x & 0x01000000) ? (x | 0xFE000000) : x;
+	// In 32 bits, so that backward calls wrap like the target address.
+	return (uint32_t)offset + 4 + imm;
+}
+
+//================================================================================================================
+/* Registers R0-R7 read (low byte) and written (high byte) by a 16-bit instruction. */
+static uint16_t
+_registers_used(uint16_t instruction)
+{
+	const uint16_t	rd = 1 << (instruction & 7);
+	const uint16_t	rn = 1 << ((instruction >> 3) & 7);
+	const uint16_t	rm = 1 << ((instruction >> 6) & 7);
+	const uint16_t	rt8 = 1 << ((instruction >> 8) & 7);
+	switch (instruction >> 12)
+	{
+	case 0x0:
+	case 0x1:
+		if ((instruction & 0xF800) != 0x1800)
+		{
+			return rn | (rd << 8);	// shift by immediate
+		}
+		return (instruction & 0x0400) ? rn | (rd << 8) : rn | rm | (rd << 8);
+	case 0x2:
+	case 0x3:
+		switch ((instruction >> 11) & 3)
+		{
+		case 0: return rt8 << 8;		// MOVS
+		case 1: return rt8;				// CMP
+		default: return rt8 | (rt8 << 8);
+		}
+	case 0x4:
+		if ((instruction & 0xFC00) == 0x4000)
+		{
+			const unsigned int	op = (instruction >> 6) & 0xF;
+			if (op == 0x8 || op == 0xA || op == 0xB)
+			{
+				return rd | rn;			// TST, CMP, CMN
+			}
+			return (op == 0x9 || op == 0xF) ? rn | (rd << 8) : rd | rn | (rd << 8);
+		}
+		if ((instruction & 0xFC00) == 0x4400)
+		{
+			const uint16_t	rdn = (instruction & 0x80) ? 0 : rd;
+			const uint16_t	rm4 = (instruction & 0x40) ? 0 : rn;
+			switch ((instruction >> 8) & 3)
+			{
+			case 0: return rdn | rm4 | (rdn << 8);
+			case 1: return rdn | rm4;
+			case 2: return rm4 | (rdn << 8);
+			default: return rm4;
+			}
+		}
+		return rt8 << 8;				// LDR literal
+	case 0x5:
+		return ((instruction >> 9) & 7) >= 3 ? rm | rn | (rd << 8) : rm | rn | rd;	// loads from LDRSB on
+	case 0x6:
+	case 0x7:
+	case 0x8:
+		return (instruction & 0x0800) ? rn | (rd << 8) : rn | rd;
+	case 0x9:
+		return (instruction & 0x0800) ? rt8 << 8 : rt8;
+	case 0xA:
+		return rt8 << 8;
+	case 0xB:
+		if ((instruction & 0x0600) == 0x0400)
+		{
+			return (instruction & 0x0800) ? (instruction & 0xFF) << 8 : instruction & 0xFF;
+		}
+		if ((instruction & 0x0F00) == 0x0200 || (instruction & 0x0F00) == 0x0A00)
+		{
+			return rn | (rd << 8);		// extend, reverse
+		}
+		return 0;
+	case 0xC:
+		return (instruction & 0x0800) ? rt8 | ((instruction & 0xFF) << 8) : rt8 | (instruction & 0xFF);
+	default:
+		return 0;
+	}
+}
+
+//================================================================================================================
+/**
+ * Check whether the function at the given program offset reads one of
+ * the argument registers R<arguments>...R3 before writing it, following
+ * the straight-line path from the entry. Calls count as reading R0-R3.
+ */
+static int
+_reads_arguments(
+	const struct arm_emulator_state *emu,
+	size_t offset,
+	unsigned int arguments)
+{
+	const uint16_t	unused = (uint16_t)(0x0F & ~((1u << arguments) - 1));
+	uint16_t		written = 0;
+	unsigned int	i;
+	for (i = 0; i < 32 && offset + 4 <= emu->program_size; ++i)
+	{
+		const uint16_t	instruction = _halfword(emu, offset);
+		struct arm_insn	insn;
+		uint16_t		used;
+		arm_decode(0, instruction, _halfword(emu, offset + 2), &insn);
+		used = insn.kind == ARM_INSN_CALL || insn.kind == ARM_INSN_CALL_INDIRECT
+			? 0x0F
+			: insn.size == 2 ? _registers_used(instruction) : 0;
+		if ((used & unused & ~written) != 0)
+		{
+			return 1;
+		}
+		written |= used >> 8;
+		if (insn.kind == ARM_INSN_BRANCH || insn.kind == ARM_INSN_INDIRECT
+			|| insn.kind == ARM_INSN_RETURN || insn.kind == ARM_INSN_INVALID)
+		{
+			break;
+		}
+		offset += insn.size;
+	}
+	return 0;
+}
+
+//================================================================================================================
+static const struct arm_signature *
+_find_signature(
+	const struct arm_signature *signatures,
+	unsigned int signatures_count,
+	const char *name)
+{
+	unsigned int i;
+	for (i = 0; i < signatures_count; ++i)
+	{
+		if (strcmp(signatures[i].name, name) == 0)
+		{
+			return &signatures[i];
+		}
+	}
+	return NULL;
+}
+
+//================================================================================================================
+/**
+ * Confidence of the signature matching at the given program offset.
+ * A failed callee check rejects the match. depth limits callee recursion.
+ */
+static unsigned int
+_confidence(
+	const struct arm_emulator_state *emu,
+	const struct arm_signature *signatures,
+	unsigned int signatures_count,
+	const struct arm_signature *signature,
+	size_t offset,
+	unsigned int min_confidence,
+	unsigned int depth)
+{
+	unsigned int i;
+	unsigned int significant = 0;
+	unsigned int matched = 0;
+	unsigned int confidence;
+
+	if (offset > emu->program_size || 2 * signature->length > emu->program_size - offset)
+	{
+		return 0;
+	}
+	for (i = 0; i < signature->length; ++i)
+	{
+		const struct arm_signature_word *w = &signature->pattern[i];
+		if (w->mask != 0)
+		{
+			++significant;
+			if ((_halfword(emu, offset + 2 * i) & w->mask) == w->value)
+			{
+				++matched;
+			}
+		}
+	}
+	confidence = significant > 0 ? (100 * matched) / significant : 0;
+	if (confidence >= min_confidence && signature->callee != NULL)
+	{
+		const struct arm_signature *callee =
+			_find_signature(signatures, signatures_count, signature->callee);
+		if (callee == NULL || depth == 0)
+		{
+			return 0;
+		}
+		if (_confidence(emu, signatures, signatures_count, callee,
+				_bl_target_offset(emu, offset + 2 * signature->callee_index) - signature->callee_entry,
+				min_confidence, depth - 1) < min_confidence)
+		{
+			return 0;
+		}
+	}
+	if (confidence >= min_confidence && signature->callee_arguments != 0
+		&& _reads_arguments(emu, _bl_target_offset(emu, offset + 2 * signature->callee_index),
+			signature->callee_arguments))
+	{
+		return 0;
+	}
+	return confidence;
+}
+
+//================================================================================================================
+int
+arm_signatures_scan(
+	struct arm_emulator_state *emu,
+	const struct arm_signature *signatures,
+	unsigned int signatures_count,
+	unsigned int min_confidence,
+	struct arm_signature_match *matches,
+	unsigned int max_matches)
+{
+	unsigned int s;
+	int count = 0;
+	int r = 0;
+
+	for (s = 0; s < signatures_count; ++s)
+	{
+		const struct arm_signature *signature = &signatures[s];
+		size_t offset = 0;
+		while (offset + 2 * signature->length <= emu->program_size)
+		{
+			const unsigned int confidence = _confidence(
+				emu, signatures, signatures_count, signature, offset, min_confidence, 2);
+			if (confidence > 0 && confidence >= min_confidence)
+			{
+				const uint32_t address = emu->program_address + (uint32_t)offset;
+				if (matches != NULL && (unsigned int)count < max_matches)
+				{
+					matches[count].signature = signature;
+					matches[count].address = address;
+					matches[count].confidence = confidence;
+				}
+				++count;
+				if (signature->native != NULL
+					&& arm_emulator_register_native(emu, address, signature->native) != 0)
+				{
+					r = -1;
+				}
+				offset += 2 * signature->length;
+			}
+			else
+			{
+				offset += 2;
+			}
+		}
+	}
+	return r != 0 ? r : count;
+}
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Signature-based detection of well-known runtime helpers (libgcc AEABI
+ * division and float comparison, newlib memcpy/memset) in plugins without
+ * symbols. Detected functions are bound to native implementations.
+ */
+#ifndef ARM_SIGNATURES_H
+#define ARM_SIGNATURES_H
+
+#include "arm_emulator.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+ * One halfword of a signature. Bits cleared in mask are not compared.
+ * A zero mask is a wildcard and does not count towards the confidence.
+ */
+struct arm_signature_word {
+	uint16_t value;
+	uint16_t mask;
+};
+
+/**
+ * Instruction pattern of a function.
+ */
+struct arm_signature {
+	/** Symbol name, for reporting. */
+	const char *name;
+	/** Pattern, starting at the function entry. */
+	const struct arm_signature_word *pattern;
+	/** Number of halfwords in the pattern. */
+	unsigned int length;
+	/** Native implementation, or NULL to report only. */
+	arm_emulator_native_t native;
+	/** If not NULL, the BL at callee_index must call a function matching
+	    the signature of this name. Used to tell apart helpers that differ
+	    only by callee, such as __aeabi_uidivmod and __aeabi_idivmod. */
+	const char *callee;
+	unsigned int callee_index;
+	/** Bytes from the callee's entry to the BL target, for calls to an
+	    inner label such as libgcc's udivsi3_skip_div0_test. */
+	unsigned int callee_entry;
+	/** If not 0, the function called by the BL at callee_index takes at
+	    most this many argument registers: reading a higher one of R0-R3
+	    before writing it rejects the match. Tells apart helpers taking
+	    float arguments (2) from those taking double arguments (4). */
+	unsigned int callee_arguments;
+};
+
+/**
+ * Function found by arm_signatures_scan().
+ */
+struct arm_signature_match {
+	const struct arm_signature *signature;
+	/** Function address, Thumb bit cleared. */
+	uint32_t address;
+	/** Percentage of significant halfwords matched, 0...100. */
+	unsigned int confidence;
+};
+
+/** Built-in signatures. */
+extern const struct arm_signature arm_signatures_default[];
+extern const unsigned int arm_signatures_default_count;
+
+/**
+ * Single-precision comparisons __aeabi_fcmpeq, ...lt, ...le, ...ge and
+ * ...gt. The double-precision __aeabi_dcmp* wrappers have the same code
+ * and call the df2 instead of the sf2 helpers, which are compiled from C
+ * and differ between toolchains. Each entry therefore requires the helper
+ * it calls to take two argument registers (see callee_arguments).
+ */
+extern const struct arm_signature arm_signatures_float[];
+extern const unsigned int arm_signatures_float_count;
+
+/**
+ * Scan the program region for the given signatures and bind matches
+ * at or above the confidence threshold to their native implementations.
+ *
+ * @param emu Emulator state with the program region set.
+ * @param signatures Signature table, e.g. arm_signatures_default. Callee
+ *        signatures are looked up by name in the same table.
+ * @param signatures_count Number of signatures.
+ * @param min_confidence Minimum confidence (0...100) to accept a match.
+ * @param matches Array receiving the matches, may be NULL.
+ * @param max_matches Capacity of matches.
+ * @return Number of matches found (may exceed max_matches), negative if
+ *         a native function could not be registered.
+ */
+int arm_signatures_scan(
+	struct arm_emulator_state *emu,
+	const struct arm_signature *signatures,
+	unsigned int signatures_count,
+	unsigned int min_confidence,
+	struct arm_signature_match *matches,
+	unsigned int max_matches);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* ARM_SIGNATURES_H */
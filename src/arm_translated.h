@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Runtime support for C code generated by tools/arm_translate.
+ *
+ * Translated functions follow the arm_emulator_native_t convention. They
+ * return 0 when the guest function returns (execution continues at LR),
+ * and a positive value with PC set when they stop at an instruction they
+ * do not cover, an indirect branch, a backward branch or a memory fault.
+ * The emulator then continues from PC.
+ */
+#ifndef ARM_TRANSLATED_H
+#define ARM_TRANSLATED_H
+
+#include "arm_emulator.h"
+#include <string.h>	// memcpy
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** APSR flag bits. */
+#define ARM_TRANSLATED_N 0x80000000u
+#define ARM_TRANSLATED_Z 0x40000000u
+#define ARM_TRANSLATED_C 0x20000000u
+#define ARM_TRANSLATED_V 0x10000000u
+
+/**
+ * Charge n instructions at address to the virtual clock, and cycles plus
+ * the flash wait states of words program memory accesses to the cycle
+ * counter. The translator computes them per straight-line run as
+ * arm_emulator_execute() would charge them. Timers due meanwhile run when
+ * translated code has returned to the interpreter.
+ */
+#define ARM_TRANSLATED_TICKS(address, n, cycles, words) \
+	arm_translated_ticks(emu, (address), (n), (cycles), (words), 1)
+
+/**
+ * Leave translated code before the instruction at address, taking back
+ * the charge of the n instructions from it to the end of its run. The
+ * interpreter charges them as it executes them.
+ */
+#define ARM_TRANSLATED_STOP(address, n, cycles, words) \
+	do { \
+		arm_translated_ticks(emu, (address), (n), (cycles), (words), 0); \
+		emu->R[15] = (address); \
+		return 1; \
+	} while (0)
+
+/** Leave translated code and continue emulation with a branch to address. */
+#define ARM_TRANSLATED_EXIT(address) \
+	do { \
+		emu->R[15] = (address); \
+		return 1; \
+	} while (0)
+
+/**
+ * Call a function with LR already set to return_address. Translated code
+ * continues after the call only if the callee returned there.
+ */
+#define ARM_TRANSLATED_CALL(call, target, return_address) \
+	do { \
+		const int r_ = (call); \
+		if (r_ != 0 || emu->R[14] != (return_address)) { \
+			if (r_ == 0) { \
+				emu->R[15] = emu->R[14]; \
+			} else if (r_ < 0) { \
+				emu->R[15] = (target); \
+			} \
+			return 1; \
+		} \
+	} while (0)
+
+/** Add (charge non-zero) or take back a charge, see ARM_TRANSLATED_TICKS(). */
+static inline void
+arm_translated_ticks(struct arm_emulator_state *emu, uint32_t address,
+	unsigned int n, unsigned int cycles, unsigned int words, int charge)
+{
+	uint64_t c = cycles;
+	if (address - emu->program_address < emu->program_size)
+	{
+		c += (uint64_t)words * emu->flash_wait_states;
+	}
+	if (charge)
+	{
+		emu->clock_ticks += n;
+		emu->cycles += c;
+	}
+	else
+	{
+		emu->clock_ticks -= n;
+		emu->cycles -= c;
+	}
+}
+
+static inline uint32_t
+arm_translated_carry(const struct arm_emulator_state *emu)
+{
+	return (emu->APSR >> 29) & 1;
+}
+
+static inline void
+arm_translated_nz(struct arm_emulator_state *emu, uint32_t x)
+{
+	emu->APSR = (x & ARM_TRANSLATED_N)
+		| (x == 0 ? ARM_TRANSLATED_Z : 0)
+		| (emu->APSR & 0x3FFFFFFFu);
+}
+
+static inline void
+arm_translated_nzc(struct arm_emulator_state *emu, uint32_t x, uint32_t carry)
+{
+	emu->APSR = (x & ARM_TRANSLATED_N)
+		| (x == 0 ? ARM_TRANSLATED_Z : 0)
+		| (carry << 29)
+		| (emu->APSR & 0x1FFFFFFFu);
+}
+
+/** x1 + x2 + carry, setting NZCV. */
+static inline uint32_t
+arm_translated_add(struct arm_emulator_state *emu, uint32_t x1, uint32_t x2, uint32_t carry)
+{
+	const uint64_t u = (uint64_t)x1 + x2 + carry;
+	const uint32_t r = (uint32_t)u;
+	const uint32_t v = (~(x1 ^ x2) & (x1 ^ r)) >> 31;
+	emu->APSR = (r & ARM_TRANSLATED_N)
+		| (r == 0 ? ARM_TRANSLATED_Z : 0)
+		| ((uint32_t)(u >> 32) << 29)
+		| (v << 28)
+		| (emu->APSR & 0x0FFFFFFFu);
+	return r;
+}
+
+/* Shifts without flags. */
+static inline uint32_t
+arm_translated_lsl_value(uint32_t x, uint32_t n)
+{
+	return n >= 32 ? 0 : x << n;
+}
+
+static inline uint32_t
+arm_translated_lsr_value(uint32_t x, uint32_t n)
+{
+	return n >= 32 ? 0 : x >> n;
+}
+
+static inline uint32_t
+arm_translated_asr_value(uint32_t x, uint32_t n)
+{
+	const uint32_t sign = 0 - (x >> 31);
+	if (n >= 32)
+	{
+		return sign;
+	}
+	return n == 0 ? x : (x >> n) | (sign << (32 - n));
+}
+
+static inline uint32_t
+arm_translated_ror_value(uint32_t x, uint32_t n)
+{
+	n &= 31;
+	return n == 0 ? x : (x >> n) | (x << (32 - n));
+}
+
+/* Shifts setting NZC; a shift by 0 sets NZ only. */
+static inline uint32_t
+arm_translated_lsl(struct arm_emulator_state *emu, uint32_t x, uint32_t n)
+{
+	const uint32_t r = arm_translated_lsl_value(x, n);
+	if (n == 0)
+	{
+		arm_translated_nz(emu, r);
+	}
+	else
+	{
+		arm_translated_nzc(emu, r, n > 32 ? 0 : (x >> (32 - n)) & 1);
+	}
+	return r;
+}
+
+static inline uint32_t
+arm_translated_lsr(struct arm_emulator_state *emu, uint32_t x, uint32_t n)
+{
+	const uint32_t r = arm_translated_lsr_value(x, n);
+	if (n == 0)
+	{
+		arm_translated_nz(emu, r);
+	}
+	else
+	{
+		arm_translated_nzc(emu, r, n > 32 ? 0 : (x >> (n - 1)) & 1);
+	}
+	return r;
+}
+
+static inline uint32_t
+arm_translated_asr(struct arm_emulator_state *emu, uint32_t x, uint32_t n)
+{
+	const uint32_t r = arm_translated_asr_value(x, n);
+	if (n == 0)
+	{
+		arm_translated_nz(emu, r);
+	}
+	else
+	{
+		arm_translated_nzc(emu, r, n >= 32 ? x >> 31 : (x >> (n - 1)) & 1);
+	}
+	return r;
+}
+
+static inline uint32_t
+arm_translated_ror(struct arm_emulator_state *emu, uint32_t x, uint32_t n)
+{
+	const uint32_t r = arm_translated_ror_value(x, n);
+	if (n == 0)
+	{
+		arm_translated_nz(emu, r);
+	}
+	else
+	{
+		arm_translated_nzc(emu, r, r >> 31);
+	}
+	return r;
+}
+
+/** Condition check of a conditional branch, cond = 0x0...0xD. */
+static inline int
+arm_translated_condition(const struct arm_emulator_state *emu, unsigned int cond)
+{
+	const uint32_t n = (emu->APSR >> 31) & 1;
+	const uint32_t z = (emu->APSR >> 30) & 1;
+	const uint32_t c = (emu->APSR >> 29) & 1;
+	const uint32_t v = (emu->APSR >> 28) & 1;
+	int r = 0;
+	switch (cond >> 1)
+	{
+	case 0: r = z; break;
+	case 1: r = c; break;
+	case 2: r = n; break;
+	case 3: r = v; break;
+	case 4: r = c && !z; break;
+	case 5: r = n == v; break;
+	case 6: r = n == v && !z; break;
+	}
+	return (cond & 1) ? !r : r;
+}
+
+/**
+ * Load size (1, 2 or 4) bytes, zero-extended.
+ * @return 0 on success, negative on misaligned or failed access.
+ */
+static inline int
+arm_translated_load(struct arm_emulator_state *emu, uint32_t *value, uint32_t address, unsigned int size)
+{
+	const size_t offset = address - emu->data_address;
+	uint32_t x = 0;
+	if ((address & (size - 1)) != 0)
+	{
+		return -1;
+	}
+	if (offset < emu->data_size && offset + size <= emu->data_size)
+	{
+		const uint8_t *p = emu->data + offset;
+		*value = size == 4 ? *(const uint32_t *)p
+			: size == 2 ? *(const uint16_t *)p
+			: *p;
+		return 0;
+	}
+	if (arm_emulator_read_memory(emu, (uint8_t *)&x, address, size) != 0)
+	{
+		return -1;
+	}
+	*value = x;
+	return 0;
+}
+
+/**
+ * Store size (1, 2 or 4) bytes to the data region or a writable mapped
+ * region, discarding blocks cached from the data region.
+ * @return 0 on success, negative on misaligned or invalid access.
+ */
+static inline int
+arm_translated_store(struct arm_emulator_state *emu, uint32_t address, uint32_t value, unsigned int size)
+{
+	const size_t offset = address - emu->data_address;
+	uint8_t *p;
+	if ((address & (size - 1)) != 0)
+	{
+		return -1;
+	}
+	if (offset >= emu->data_size || offset + size > emu->data_size)
+	{
+		p = emu->regions_count > 0 ? arm_emulator_host_data_pointer(emu, address, size) : NULL;
+		if (p == NULL)
+		{
+			return -1;
+		}
+		memcpy(p, &value, size);
+		++emu->events;
+		return 0;
+	}
+	p = emu->data + offset;
+	if (size == 4)
+	{
+		*(uint32_t *)p = value;
+	}
+	else if (size == 2)
+	{
+		*(uint16_t *)p = (uint16_t)value;
+	}
+	else
+	{
+		*p = (uint8_t)value;
+	}
+	if ((emu->code_pages[(offset >> emu->code_page_shift) / 32] >> ((offset >> emu->code_page_shift) % 32) & 1) != 0)
+	{
+		// Code cached by the interpreter was overwritten.
+		arm_emulator_invalidate_code(emu, address, size);
+	}
+	++emu->events;
+	return 0;
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* ARM_TRANSLATED_H */
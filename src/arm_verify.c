@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: MIT
+/** \file Load-time verifier for plugin images. */
+#include "arm_verify.h"
+#include <stddef.h>	// offsetof
+#include <string.h>	// memcpy, memset
+#include "arm_decode.h"
+#include "plugin_api.h"	// struct plugin_api layout.
+
+/** Depth of an instruction that has not been reached. */
+#define UNREACHED	0xFFFF
+
+//================================================================================================================
+static int
+_fail(
+	struct arm_verify_result *result,
+	uint8_t error,
+	uint32_t address)
+{
+	result->error = error;
+	result->error_address = address;
+	return -1;
+}
+
+//================================================================================================================
+static void
+_start(
+	const struct arm_emulator_state *emu,
+	uint16_t *depths,
+	struct arm_verify_result *result)
+{
+	size_t i;
+	for (i = 0; i < ARM_VERIFY_DEPTHS(emu->program_size); ++i)
+	{
+		depths[i] = UNREACHED;
+	}
+	result->error = ARM_VERIFY_OK;
+	result->error_address = 0;
+	result->instructions = 0;
+	result->stack_bound = 0;
+}
+
+//================================================================================================================
+static int
+_is_native(
+	const struct arm_emulator_state *emu,
+	uint32_t address)
+{
+	unsigned int i;
+	for (i = 0; i < emu->natives_count; ++i)
+	{
+		if (emu->natives[i].address == address)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//================================================================================================================
+/* Reach the instruction at offset with depth bytes of stack; non-zero if that is new. */
+static int
+_reach(
+	uint16_t *depths,
+	uint32_t offset,
+	uint16_t depth)
+{
+	uint16_t *d = &depths[offset / 2];
+	if (*d == UNREACHED || *d < depth)
+	{
+		*d = depth;
+		return 1;
+	}
+	return 0;
+}
+
+//================================================================================================================
+static int
+_add_entry(
+	const struct arm_emulator_state *emu,
+	uint32_t entry,
+	uint16_t *depths,
+	struct arm_verify_result *result)
+{
+	const uint32_t offset = (entry & 0xFFFFFFFE) - emu->program_address;
+	if (offset < emu->program_size && offset + 2 <= emu->program_size)
+	{
+		_reach(depths, offset, 0);
+		return 0;
+	}
+	if (_is_native(emu, entry & 0xFFFFFFFE))
+	{
+		return 0;
+	}
+	return _fail(result, ARM_VERIFY_ENTRY_OUT_OF_RANGE, entry);
+}
+
+//================================================================================================================
+/* Registers in a PUSH or POP list, including LR or PC. */
+static int
+_count_registers(uint16_t instruction)
+{
+	int n = 0;
+	uint16_t list = instruction & 0x01FF;
+	while (list != 0)
+	{
+		n += list & 1;
+		list >>= 1;
+	}
+	return n;
+}
+
+//================================================================================================================
+/* Change of stack usage by an instruction, in bytes; *unbounded set if SP is loaded from a register. */
+static int32_t
+_stack_delta(
+	uint16_t instruction,
+	uint16_t instruction2,
+	int *unbounded)
+{
+	if ((instruction & 0xFE00) == 0xB400)
+	{
+		// PUSH
+		return 4 * _count_registers(instruction);
+	}
+	if ((instruction & 0xFE00) == 0xBC00)
+	{
+		// POP
+		return -4 * _count_registers(instruction);
+	}
+	if ((instruction & 0xFF80) == 0xB080)
+	{
+		// SUB SP, SP, #imm
+		return 4 * (instruction & 0x7F);
+	}
+	if ((instruction & 0xFF80) == 0xB000)
+	{
+		// ADD SP, SP, #imm
+		return -4 * (instruction & 0x7F);
+	}
+	if ((instruction & 0xFF87) == 0x4485 || (instruction & 0xFF87) == 0x4685
+		|| ((instruction & 0xFFF0) == 0xF380 && (instruction2 & 0xFF00) == 0x8800
+			&& ((instruction2 & 0xFF) == 0x08 || (instruction2 & 0xFF) == 0x09)))
+	{
+		// ADD SP, Rm; MOV SP, Rm; MSR MSP/PSP, Rn
+		*unbounded = 1;
+	}
+	return 0;
+}
+
+//================================================================================================================
+/**
+ * Propagate stack depths through the reachable code until nothing changes.
+ * Depths only grow and are capped at the size of the data region, so
+ * recursion terminates as unbounded.
+ */
+static int
+_propagate(
+	const struct arm_emulator_state *emu,
+	uint16_t *depths,
+	struct arm_verify_result *result,
+	int *unbounded)
+{
+	const uint32_t	cap = emu->data_size < UNREACHED - 1 ? (uint32_t)emu->data_size : UNREACHED - 1;
+	int				changed = 1;
+	while (changed)
+	{
+		uint32_t	offset;
+		changed = 0;
+		for (offset = 0; offset + 2 <= emu->program_size; offset += 2)
+		{
+			const uint32_t	address = emu->program_address + offset;
+			const uint16_t	depth = depths[offset / 2];
+			const uint16_t	instruction = emu->program[offset] | (emu->program[offset + 1] << 8);
+			uint16_t		instruction2 = 0;
+			struct arm_insn	insn;
+			int32_t			after;
+			if (depth == UNREACHED)
+			{
+				continue;
+			}
+			if (arm_decode_is_32bit(instruction))
+			{
+				if (offset + 4 > emu->program_size)
+				{
+					return _fail(result, ARM_VERIFY_INVALID_INSTRUCTION, address);
+				}
+				instruction2 = emu->program[offset + 2] | (emu->program[offset + 3] << 8);
+			}
+			arm_decode(address, instruction, instruction2, &insn);
+			if (insn.kind == ARM_INSN_INVALID)
+			{
+				return _fail(result, ARM_VERIFY_INVALID_INSTRUCTION, address);
+			}
+
+			after = (int32_t)depth + _stack_delta(instruction, instruction2, unbounded);
+			if (after < 0)
+			{
+				after = 0;
+			}
+			else if ((uint32_t)after > cap)
+			{
+				after = (int32_t)cap;
+				*unbounded = 1;
+			}
+			if ((uint32_t)after > result->stack_bound)
+			{
+				result->stack_bound = (uint32_t)after;
+			}
+
+			if (insn.kind == ARM_INSN_BRANCH || insn.kind == ARM_INSN_BRANCH_COND || insn.kind == ARM_INSN_CALL)
+			{
+				const uint32_t	target = insn.target - emu->program_address;
+				if (target < emu->program_size && target + 2 <= emu->program_size)
+				{
+					changed |= _reach(depths, target, (uint16_t)after);
+				}
+				else if (!_is_native(emu, insn.target))
+				{
+					return _fail(result, ARM_VERIFY_BRANCH_OUT_OF_RANGE, address);
+				}
+			}
+			if (insn.kind < ARM_INSN_BRANCH || insn.kind == ARM_INSN_BRANCH_COND || insn.kind == ARM_INSN_CALL
+				|| insn.kind == ARM_INSN_CALL_INDIRECT || insn.kind == ARM_INSN_WAIT)
+			{
+				if (offset + insn.size + 2 > emu->program_size)
+				{
+					return _fail(result, ARM_VERIFY_FALLS_OFF_END, address);
+				}
+				changed |= _reach(depths, offset + insn.size, (uint16_t)after);
+			}
+		}
+	}
+	return 0;
+}
+
+//================================================================================================================
+static int
+_finish(
+	const struct arm_emulator_state *emu,
+	uint32_t *bitmap,
+	uint16_t *depths,
+	struct arm_verify_result *result)
+{
+	int		unbounded = 0;
+	size_t	i;
+	if (_propagate(emu, depths, result, &unbounded) != 0)
+	{
+		return -1;
+	}
+	memset(bitmap, 0, ARM_VERIFY_BITMAP_WORDS(emu->program_size) * sizeof(uint32_t));
+	for (i = 0; i < ARM_VERIFY_DEPTHS(emu->program_size); ++i)
+	{
+		if (depths[i] != UNREACHED)
+		{
+			bitmap[i / 32] |= (uint32_t)1 << (i % 32);
+			++result->instructions;
+		}
+	}
+	if (unbounded)
+	{
+		result->stack_bound = ARM_VERIFY_UNBOUNDED;
+	}
+	return 0;
+}
+
+//================================================================================================================
+int
+arm_verify(
+	const struct arm_emulator_state *emu,
+	const uint32_t *entries,
+	unsigned int count,
+	uint32_t *bitmap,
+	uint16_t *depths,
+	struct arm_verify_result *result)
+{
+	unsigned int i;
+	_start(emu, depths, result);
+	for (i = 0; i < count; ++i)
+	{
+		if (_add_entry(emu, entries[i], depths, result) != 0)
+		{
+			return -1;
+		}
+	}
+	return _finish(emu, bitmap, depths, result);
+}
+
+//================================================================================================================
+int
+arm_verify_plugin(
+	const struct arm_emulator_state *emu,
+	uint32_t api_address,
+	uint32_t *bitmap,
+	uint16_t *depths,
+	struct arm_verify_result *result)
+{
+	const uint8_t	*api = arm_emulator_host_pointer(emu, api_address, sizeof(struct plugin_api));
+	const uint8_t	*table;
+	uint16_t		count;
+	unsigned int	i;
+	_start(emu, depths, result);
+	if (api == NULL)
+	{
+		return _fail(result, ARM_VERIFY_ENTRY_OUT_OF_RANGE, api_address);
+	}
+	memcpy(&count, api + offsetof(struct plugin_api, function_count), 2);
+	table = arm_emulator_host_pointer(emu, api_address + offsetof(struct plugin_api, Init), 4 * (uint32_t)count);
+	if (table == NULL)
+	{
+		return _fail(result, ARM_VERIFY_ENTRY_OUT_OF_RANGE, api_address);
+	}
+	for (i = 0; i < count; ++i)
+	{
+		uint32_t entry;
+		memcpy(&entry, table + 4 * i, 4);
+		if (entry != 0 && _add_entry(emu, entry, depths, result) != 0)
+		{
+			return -1;
+		}
+	}
+	return _finish(emu, bitmap, depths, result);
+}
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Load-time verifier for plugin images. Walks every instruction reachable
+ * from the entry points, proves that it decodes and that direct branch
+ * targets stay in the program region, and computes the stack bound.
+ * Verified instructions are fetched without checks by
+ * arm_emulator_execute(), see arm_emulator_set_verified().
+ */
+#ifndef ARM_VERIFY_H
+#define ARM_VERIFY_H
+
+#include "arm_emulator.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** Words of verified bitmap needed for a program region of size bytes. */
+#define ARM_VERIFY_BITMAP_WORDS(size)	(((size) / 2 + 31) / 32)
+
+/** Entries of depth storage needed for a program region of size bytes. */
+#define ARM_VERIFY_DEPTHS(size)			((size) / 2)
+
+/** Stack bound of code that sets SP from a register, or recurses. */
+#define ARM_VERIFY_UNBOUNDED			0xFFFFFFFFu
+
+/**
+ * Reasons for rejecting an image.
+ */
+enum arm_verify_error {
+	ARM_VERIFY_OK = 0,
+	/** An instruction is not executable by the emulator, or truncated. */
+	ARM_VERIFY_INVALID_INSTRUCTION = 1,
+	/** A direct branch or call leaves the program region, and no native
+	    function is registered at the target. */
+	ARM_VERIFY_BRANCH_OUT_OF_RANGE = 2,
+	/** Execution falls through the end of the program region. */
+	ARM_VERIFY_FALLS_OFF_END = 3,
+	/** An entry point is outside the program region, and no native
+	    function is registered there. */
+	ARM_VERIFY_ENTRY_OUT_OF_RANGE = 4,
+};
+
+/**
+ * Result of a verification.
+ */
+struct arm_verify_result {
+	/** enum arm_verify_error. */
+	uint8_t error;
+	/** Address of the offending instruction or entry point. */
+	uint32_t error_address;
+	/** Reachable instructions. */
+	uint32_t instructions;
+	/** Bytes of stack used below SP at the entry points, excluding
+	    exception frames and code reached only through indirect calls;
+	    ARM_VERIFY_UNBOUNDED if unknown. */
+	uint32_t stack_bound;
+};
+
+/**
+ * Verify the code reachable from a list of entry points. Code reached
+ * through BLX, BX or MOV PC is not followed, and is fetched with the
+ * usual checks when it runs. Natives must be registered before.
+ *
+ * On success, the bitmap marks the first halfword of each reachable
+ * instruction; install it with arm_emulator_set_verified(). Verification
+ * fails at the first error, and the bitmap is then undefined.
+ *
+ * @param emu Emulator state.
+ * @param entries Entry point addresses, Thumb bit ignored.
+ * @param count Number of entry points.
+ * @param bitmap Storage, ARM_VERIFY_BITMAP_WORDS(program_size) words.
+ * @param depths Scratch storage, ARM_VERIFY_DEPTHS(program_size) entries.
+ * @param result Result.
+ * @return 0 if the code was verified, negative otherwise.
+ */
+int arm_verify(
+	const struct arm_emulator_state *emu,
+	const uint32_t *entries,
+	unsigned int count,
+	uint32_t *bitmap,
+	uint16_t *depths,
+	struct arm_verify_result *result);
+
+/**
+ * Verify the code reachable from the functions published in a struct
+ * plugin_api, as far as function_count covers them.
+ *
+ * @param emu Emulator state.
+ * @param api_address Guest address of struct plugin_api, usually
+ *        PLUGIN_API_ADDRESS.
+ * @param bitmap Storage, ARM_VERIFY_BITMAP_WORDS(program_size) words.
+ * @param depths Scratch storage, ARM_VERIFY_DEPTHS(program_size) entries.
+ * @param result Result.
+ * @return 0 if the code was verified, negative otherwise.
+ */
+int arm_verify_plugin(
+	const struct arm_emulator_state *emu,
+	uint32_t api_address,
+	uint32_t *bitmap,
+	uint16_t *depths,
+	struct arm_verify_result *result);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* ARM_VERIFY_H */
@@ -21,12 +21,115 @@
 #include "plugin_api.h" // use some functions from them, too.
 
 #if defined(_MSC_VER) || defined(DESKTOP_BUILD)
+#if defined(_MSC_VER)
+#define	THREAD_LOCAL	__declspec(thread)
+#else
+#define	THREAD_LOCAL	__thread
+#endif
+
+// Set once by whichever thread prints first.
+#if defined(__GNUC__)
+#define	_test_and_set(p)	__atomic_exchange_n((p), 1, __ATOMIC_ACQ_REL)
+#elif defined(_MSC_VER)
+#include <intrin.h>	// _InterlockedExchange
+#define	_test_and_set(p)	_InterlockedExchange((p), 1)
+#else
+#define	_test_and_set(p)	(*(p) != 0 ? 1 : (*(p) = 1, 0))
+#endif
+
+static THREAD_LOCAL struct uart_buffer	_default_buffer;
+static THREAD_LOCAL struct uart_buffer*	_buffer;
+static long								_exit_flush_registered;
+
+//============================================================
+static void
+_stdout_sink(void* context, const uint8_t* data, uint32_t length)
+{
+	(void)context;
+	fwrite(data, 1, length, stdout);
+	// Lines reach the file even if the process crashes later.
+	fflush(stdout);
+}
+
+//============================================================
+static void
+_flush_at_exit(void)
+{
+	uart_flush();
+	fflush(stdout);
+}
+
+//============================================================
+static struct uart_buffer*
+_current_buffer(void)
+{
+	if (_buffer == NULL)
+	{
+		_default_buffer.sink = _stdout_sink;
+		_buffer = &_default_buffer;
+		if (_test_and_set(&_exit_flush_registered) == 0)
+		{
+			// Output without a final CRLF would otherwise be lost.
+			atexit(_flush_at_exit);
+		}
+	}
+	return _buffer;
+}
+
+//============================================================
+void
+uart_set_sink(
+	struct uart_buffer*	buffer,
+	uart_sink_t			sink,
+	void*				context)
+{
+	uart_flush();
+	if (buffer != NULL)
+	{
+		buffer->sink = sink;
+		buffer->context = context;
+		buffer->length = 0;
+	}
+	_buffer = buffer;
+}
+
+//============================================================
+void
+uart_flush(void)
+{
+	struct uart_buffer*	b = _current_buffer();
+	if (b->length > 0)
+	{
+		b->sink(b->context, b->data, b->length);
+		b->length = 0;
+	}
+}
+
+//============================================================
+void
+uart_sink_discard(void* context, const uint8_t* data, uint32_t length)
+{
+	(void)context;
+	(void)data;
+	(void)length;
+}
+
+//============================================================
 void UARTSend(const uint8_t *BufferPtr, uint32_t Length)
 {
-	uint32_t	i;
-	for (i=0; i<Length; ++i)
+	struct uart_buffer*	b = _current_buffer();
+	while (Length > 0)
 	{
-		printf("%c", BufferPtr[i]);
+		const uint32_t	space = UART_BUFFER_SIZE - b->length;
+		const uint32_t	n = Length < space ? Length : space;
+		memcpy(b->data + b->length, BufferPtr, n);
+		b->length += n;
+		BufferPtr += n;
+		Length -= n;
+		if (b->length == UART_BUFFER_SIZE)
+		{
+			uart_flush();
+		}
 	}
 }
 #endif
@@ -189,6 +292,7 @@ _delay_us(const uint32_t us)
 }
 #endif
 
+#if !defined(COMM_NO_OUTPUT)
 //============================================================
 void
 uart_write(const char* msg)
@@ -246,7 +350,7 @@ void
 uart_writeln(const char* msg)
 {
 	uart_write(msg);
-	UARTSend((unsigned char*)"\r\n", 2);
+	uart_write_crlf();
 }
 
 #if !defined(_MSC_VER)
@@ -278,4 +382,8 @@ void
 uart_write_crlf(void)
 {
 	UARTSend((const uint8_t*)"\r\n", 2);
+#if defined(_MSC_VER) || defined(DESKTOP_BUILD)
+	uart_flush();
+#endif
 }
+#endif
@@ -47,6 +47,52 @@ uint8_of_hex2(const char* hex);
 extern void
 _delay_us(const uint32_t	us);
 
+#if defined(_MSC_VER) || defined(DESKTOP_BUILD)
+/// Size of the output buffer in struct uart_buffer.
+#define	UART_BUFFER_SIZE	256
+
+/// Receives buffered output in bulk.
+typedef void (*uart_sink_t)(void* context, const uint8_t* data, uint32_t length);
+
+/// Output buffer with its sink. One per thread, e.g. per emulator instance.
+struct uart_buffer {
+	uart_sink_t	sink;
+	void*		context;
+	uint32_t	length;
+	uint8_t		data[UART_BUFFER_SIZE];
+};
+
+/// Route the calling thread's output through buffer to sink. Output is
+/// passed on when the buffer fills up and at the end of each line.
+/// NULL buffer restores the default, buffered standard output, which is
+/// written through to the file with each line.
+extern void
+uart_set_sink(
+	struct uart_buffer*	buffer,
+	uart_sink_t			sink,
+	void*				context);
+
+/// Pass the calling thread's buffered output to its sink. The thread
+/// calling exit() is flushed automatically; other threads call this
+/// before they end.
+extern void
+uart_flush(void);
+
+/// Sink that discards everything.
+extern void
+uart_sink_discard(void* context, const uint8_t* data, uint32_t length);
+#endif
+
+#if defined(COMM_NO_OUTPUT)
+// No output at all; the formatting is compiled away.
+#define	uart_write(msg)						do { } while (0)
+#define	uart_write_hex(prefix, x)			do { } while (0)
+#define	uart_write_hex16(prefix, x)			do { } while (0)
+#define	uart_write_hex32(prefix, x)			do { } while (0)
+#define	uart_writeln(msg)					do { } while (0)
+#define	uart_write_crlf()					do { } while (0)
+#define	uart_write_buffer(prefix, b, n)		do { } while (0)
+#else
 /// uart << msg
 extern void
 uart_write(const char* msg);
@@ -77,6 +123,7 @@ uart_write_buffer(
 	const char* prefix,
 	const uint8_t* buffer,
 	const int nbytes);
+#endif
 
 #if defined(__cplusplus)
 }
@@ -124,10 +124,103 @@ typedef int (*service_read_i2c_t)(
 	uint32_t address_page_register,
 	uint32_t count);
 
+/**
+ * Copy bytes, the ranges may overlap. Version 1.1 and later.
+ *
+ * @param dst Destination, in plugin data memory.
+ * @param src Source, in plugin data or program memory.
+ * @param nbytes Number of bytes to copy.
+ * @return dst.
+ */
+typedef void *(*service_mem_copy_t)(
+	void *dst,
+	const void *src,
+	uint32_t nbytes);
+
+/**
+ * Fill bytes. Version 1.1 and later.
+ *
+ * @param dst Destination, in plugin data memory.
+ * @param value Byte value, only the low 8 bits are used.
+ * @param nbytes Number of bytes to fill.
+ * @return dst.
+ */
+typedef void *(*service_mem_set_t)(
+	void *dst,
+	int value,
+	uint32_t nbytes);
+
+/**
+ * Compare bytes as unsigned values. Version 1.1 and later.
+ *
+ * @param a First range, in plugin data or program memory.
+ * @param b Second range, in plugin data or program memory.
+ * @param nbytes Number of bytes to compare.
+ * @return 0 if equal, negative if a sorts first, positive otherwise.
+ */
+typedef int (*service_mem_compare_t)(
+	const void *a,
+	const void *b,
+	uint32_t nbytes);
+
+/**
+ * Update a CRC-32 (IEEE 802.3, as in zlib). Start with crc=0.
+ * Version 1.1 and later.
+ *
+ * @param crc CRC of the preceding data.
+ * @param data Data, in plugin data or program memory.
+ * @param nbytes Number of bytes.
+ * @return Updated CRC.
+ */
+typedef uint32_t (*service_crc32_t)(
+	uint32_t crc,
+	const void *data,
+	uint32_t nbytes);
+
+/**
+ * Operation of a batched I2C transaction, see service_i2c_transaction_t.
+ */
+struct service_i2c_op {
+	/** Combined address, use MAKE_ADDRESS_PAGE_REGISTER. */
+	uint32_t address_page_register;
+	/** Data to write, or buffer to read into. */
+	uint8_t *data;
+	/** Number of bytes. */
+	uint16_t nbytes;
+	/** SERVICE_I2C_WRITE or SERVICE_I2C_READ. */
+	uint8_t direction;
+	uint8_t reserved;
+} PACKED_ATTR;
+
+/**
+ * service_i2c_op.direction values. SERVICE_I2C_OP_SIZE is the size of an
+ * operation in plugin memory.
+ */
+enum {
+	SERVICE_I2C_WRITE = 0,
+	SERVICE_I2C_READ = 1,
+	SERVICE_I2C_OP_SIZE = 12
+};
+
+/**
+ * Run I2C reads and writes in one call, in order. Stops at the first
+ * operation that fails. Version 1.2 and later.
+ *
+ * @param ops Operations.
+ * @param count Number of operations.
+ * @return 0 on success, -1 - (index of the failed operation) on error.
+ */
+typedef int (*service_i2c_transaction_t)(
+	const struct service_i2c_op *ops,
+	uint32_t count);
+
 /**
  * Service API structure.
  * Located at SERVICE_API_ADDRESS (0x300) in memory.
  * Provides host services to plugins.
+ *
+ * Functions are only appended: a plugin may use a function if its index
+ * is below function_count. Version 1.0 has the first 7 functions.
  */
 struct service_api {
 	uint8_t version_major;
@@ -140,6 +233,13 @@ struct service_api {
 	service_write_screen_decimal_t WriteScreenDecimal;
 	service_write_i2c_t WriteI2C;
 	service_read_i2c_t ReadI2C;
+	/* Version 1.1 */
+	service_mem_copy_t MemCopy;
+	service_mem_set_t MemSet;
+	service_mem_compare_t MemCompare;
+	service_crc32_t Crc32;
+	/* Version 1.2 */
+	service_i2c_transaction_t I2CTransaction;
 } PACKED_ATTR;
 
 extern const struct service_api service_api;
@@ -152,6 +252,17 @@ enum {
 	SERVICE_API_ADDRESS = 0x300
 };
 
+/**
+ * Service API version provided by the host.
+ */
+enum {
+	SERVICE_API_VERSION_MAJOR = 1,
+	SERVICE_API_VERSION_MINOR = 2,
+	/** Functions in version 1.0. */
+	SERVICE_API_FUNCTION_COUNT_1_0 = 7,
+	SERVICE_API_FUNCTION_COUNT = 12
+};
+
 /*
  * Plugin API types and structures.
  */
@@ -0,0 +1,102 @@
+/* Generated by arm_translate from tests/flags.bin. Do not edit. */
+#include "arm_translated.h"
+
+static int flags_00006000(struct arm_emulator_state *emu);
+
+//================================================================================================================
+static int
+flags_00006000(struct arm_emulator_state *emu)
+{
+	uint32_t *const R = emu->R;
+	(void)R;
+	ARM_TRANSLATED_TICKS(0x00006000u, 7, 16, 6);
+	/* 00006000: B510 */
+	if (0
+		|| arm_translated_store(emu, R[13] - 8u + 0, R[4], 4) != 0
+		|| arm_translated_store(emu, R[13] - 8u + 4, R[14], 4) != 0)
+	{
+		ARM_TRANSLATED_STOP(0x00006000u, 7, 16, 6);
+	}
+	R[13] -= 8u;
+	/* 00006002: 4B06 */
+	R[3] = 0x80000000u;
+	/* 00006004: 4699 */
+	R[9] = R[3];
+	/* 00006006: 2101 */
+	R[1] = 1u;
+	/* 00006008: F389 8800 */
+	emu->APSR = R[9] & 0xF8000000u;
+	/* 0000600C: F3EF 8A00 */
+	R[10] = emu->APSR;
+	/* 00006010: D401 */
+	if (arm_translated_condition(emu, 4))
+	{
+		ARM_TRANSLATED_TICKS(0x00006010u, 0, 2, 0);
+		goto L_00006016;
+	}
+	ARM_TRANSLATED_TICKS(0x00006012u, 2, 6, 1);
+	/* 00006012: 2000 */
+	R[0] = 0u;
+	arm_translated_nz(emu, R[0]);
+	/* 00006014: BD10 */
+	{
+		const uint32_t b = R[13];
+		uint32_t w[9];
+		if (0
+			|| arm_translated_load(emu, &w[0], b + 0u, 4) != 0
+			|| arm_translated_load(emu, &w[1], b + 4u, 4) != 0)
+		{
+			ARM_TRANSLATED_STOP(0x00006014u, 1, 5, 1);
+		}
+		R[4] = w[0];
+		R[14] = w[1];
+		R[13] = b + 8u;
+	}
+	return 0;
+L_00006016:
+	ARM_TRANSLATED_TICKS(0x00006016u, 3, 7, 1);
+	/* 00006016: 4650 */
+	R[0] = R[10];
+	/* 00006018: 467A */
+	ARM_TRANSLATED_STOP(0x00006018u, 2, 6, 1);
+	/* 0000601A: BD10 */
+	{
+		const uint32_t b = R[13];
+		uint32_t w[9];
+		if (0
+			|| arm_translated_load(emu, &w[0], b + 0u, 4) != 0
+			|| arm_translated_load(emu, &w[1], b + 4u, 4) != 0)
+		{
+			ARM_TRANSLATED_STOP(0x0000601Au, 1, 5, 0);
+		}
+		R[4] = w[0];
+		R[14] = w[1];
+		R[13] = b + 8u;
+	}
+	return 0;
+}
+
+/** Translated functions, entry points first, for arm_emulator_set_translations(). */
+const struct arm_emulator_native_function flags_functions[] = {
+	{ 0x00006000u, flags_00006000 },
+};
+const unsigned int flags_functions_count = 1;
+
+//================================================================================================================
+/**
+ * Bind the translated functions, entry points first.
+ * @return Number of functions bound; the rest stay interpreted.
+ */
+int
+flags_register(struct arm_emulator_state *emu)
+{
+	unsigned int i;
+	for (i = 0; i < flags_functions_count; ++i)
+	{
+		if (arm_emulator_register_native(emu, flags_functions[i].address, flags_functions[i].function) != 0)
+		{
+			break;
+		}
+	}
+	return (int)i;
+}
@@ -12,6 +12,7 @@ main(
 	char**	argv)
 {
 	const struct testcase *testcase;
+	const struct testcase_program *program;
 	(void)argc;
 	(void)argv;
 
@@ -34,5 +35,13 @@ main(
 			return 1;
 		}
 	}
+	for (program=testcase_programs; program->name!=NULL; ++program)
+	{
+		printf("program = %s\n", program->name);
+		if (program->run()!=0)
+		{
+			return 1;
+		}
+	}
 	return 0;
 }
\ No newline at end of file
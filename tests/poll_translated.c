@@ -0,0 +1,76 @@
+/* Generated by arm_translate from tests/poll.bin. Do not edit. */
+#include "arm_translated.h"
+
+static int poll_00006000(struct arm_emulator_state *emu);
+
+//================================================================================================================
+static int
+poll_00006000(struct arm_emulator_state *emu)
+{
+	uint32_t *const R = emu->R;
+	(void)R;
+	ARM_TRANSLATED_TICKS(0x00006000u, 3, 8, 2);
+	/* 00006000: B510 */
+	if (0
+		|| arm_translated_store(emu, R[13] - 8u + 0, R[4], 4) != 0
+		|| arm_translated_store(emu, R[13] - 8u + 4, R[14], 4) != 0)
+	{
+		ARM_TRANSLATED_STOP(0x00006000u, 3, 8, 2);
+	}
+	R[13] -= 8u;
+	/* 00006002: 0004 */
+	R[4] = arm_translated_lsl(emu, R[0], 0);
+	/* 00006004: F7FA F87C */
+	R[14] = 0x00006009u;
+	ARM_TRANSLATED_CALL(arm_emulator_call_native(emu, 0x00000100u), 0x00000100u, 0x00006009u);
+	ARM_TRANSLATED_TICKS(0x00006008u, 2, 2, 1);
+	/* 00006008: 42A0 */
+	(void)arm_translated_add(emu, R[0], ~R[4], 1);
+	/* 0000600A: D3FB */
+	if (arm_translated_condition(emu, 3))
+	{
+		ARM_TRANSLATED_TICKS(0x0000600Au, 0, 2, 0);
+		ARM_TRANSLATED_EXIT(0x00006005u);
+	}
+	ARM_TRANSLATED_TICKS(0x0000600Cu, 1, 5, 1);
+	/* 0000600C: BD10 */
+	{
+		const uint32_t b = R[13];
+		uint32_t w[9];
+		if (0
+			|| arm_translated_load(emu, &w[0], b + 0u, 4) != 0
+			|| arm_translated_load(emu, &w[1], b + 4u, 4) != 0)
+		{
+			ARM_TRANSLATED_STOP(0x0000600Cu, 1, 5, 1);
+		}
+		R[4] = w[0];
+		R[14] = w[1];
+		R[13] = b + 8u;
+	}
+	return 0;
+}
+
+/** Translated functions, entry points first, for arm_emulator_set_translations(). */
+const struct arm_emulator_native_function poll_functions[] = {
+	{ 0x00006000u, poll_00006000 },
+};
+const unsigned int poll_functions_count = 1;
+
+//================================================================================================================
+/**
+ * Bind the translated functions, entry points first.
+ * @return Number of functions bound; the rest stay interpreted.
+ */
+int
+poll_register(struct arm_emulator_state *emu)
+{
+	unsigned int i;
+	for (i = 0; i < poll_functions_count; ++i)
+	{
+		if (arm_emulator_register_native(emu, poll_functions[i].address, poll_functions[i].function) != 0)
+		{
+			break;
+		}
+	}
+	return (int)i;
+}
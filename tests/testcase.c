@@ -7,6 +7,13 @@
 
 #include "testcase.h"
 #include "arm_emulator.h"
+#include "arm_i2c.h"
+#include "arm_signatures.h"
+#include "arm_cfg.h"
+#include "arm_decode.h"
+#include "arm_verify.h"
+#include "arm_services.h"
+#include "comm.h"
 
 /// End of register definition.
 #define	REG_END		{-1,-1}
@@ -134,6 +141,10 @@ const struct testcase testcases[] =
 	{ "asr r1, r3", INSTR_10_Rm_Rdn(0x104, 3, 1),
 	{ { 1, 0x5555FFFF }, { 3, 16 }, { INDEX_APSR, 0 }, REG_END }, NO_MEMORY,
 	{ { 1, 0x00005555 }, { INDEX_APSR, FLAG_C }, REG_END }, NO_MEMORY },
+/* ASR (register): only the bottom byte of the shift counts. */
+	{ "asr r1, r3; r3 = 0x100", INSTR_10_Rm_Rdn(0x104, 3, 1),
+	{ { 1, 0x8555FFFF }, { 3, 0x100 }, { INDEX_APSR, FLAG_C }, REG_END }, NO_MEMORY,
+	{ { 1, 0x8555FFFF }, { INDEX_APSR, FLAG_N|FLAG_C }, REG_END }, NO_MEMORY },
 /* B: Encoding T1 */
 	TESTCASE_BRANCH("eq", COND_EQ, 254, 0, 0),
 	TESTCASE_BRANCH("eq", COND_EQ, 254, FLAG_Z, 1),
@@ -188,7 +199,9 @@ const struct testcase testcases[] =
 	{ "cmp r11, r12", INSTR_8_RRm_RRn(0x45, 12, 11),
 	{ { 12, -1 }, { 11, -1}, {INDEX_APSR, 0}, REG_END}, NO_MEMORY,
 	{ { INDEX_APSR, FLAG_Z|FLAG_C}, REG_END}, NO_MEMORY},
-/* CPS: not implemented. */
+/* CPS */
+	{ "cpsid i", 0xB672, INSTRUCTION_16BIT, NO_REGISTERS, NO_MEMORY, NO_REGISTERS, NO_MEMORY },
+	{ "cpsie i", 0xB662, INSTRUCTION_16BIT, NO_REGISTERS, NO_MEMORY, NO_REGISTERS, NO_MEMORY },
 /* CPY: see MOV. */
 /* DMB: not implemented. */
 /* DSB: not implemented. */
@@ -201,6 +214,14 @@ const struct testcase testcases[] =
 	{ "ldm r6!, {r7, r0}", INSTR_5_Rn_imm8(0x19, 6, ((1<<7)|(1<<0))),
 	{ {6, TESTCASE_PLUGIN_DATA_ADDRESS}, REG_END}, { 8, TESTCASE_PLUGIN_DATA_ADDRESS, "\x04\x03\x03\x02\x08\x07\x06\x05"},
 	{ {6, TESTCASE_PLUGIN_DATA_ADDRESS+8}, {0, 0x02030304}, {7, 0x05060708}, REG_END}, NO_MEMORY},
+/* LDM: base in the list, no writeback. */
+	{ "ldm r2, {r1, r2}", INSTR_5_Rn_imm8(0x19, 2, ((1<<1)|(1<<2))),
+	{ {2, TESTCASE_PLUGIN_DATA_ADDRESS+16}, REG_END}, { 8, TESTCASE_PLUGIN_DATA_ADDRESS+16, "\x11\x11\x11\x11\x22\x22\x22\x22"},
+	{ {1, 0x11111111}, {2, 0x22222222}, REG_END}, NO_MEMORY},
+/* LDM: from program memory. */
+	{ "ldm r5!, {r0, r3}", INSTR_5_Rn_imm8(0x19, 5, ((1<<0)|(1<<3))),
+	{ {5, TESTCASE_PLUGIN_API_ADDRESS+0x100}, REG_END}, { 8, TESTCASE_PLUGIN_API_ADDRESS+0x100, "\x01\x02\x03\x04\x05\x06\x07\x08"},
+	{ {5, TESTCASE_PLUGIN_API_ADDRESS+0x108}, {0, 0x04030201}, {3, 0x08070605}, REG_END}, NO_MEMORY},
 /* LDR (immediate): Encoding T1. */
 	{ "ldr r4, r0, #16", INSTR_5_imm5_Rn_Rt(0x0D, 4, 0, 4),
 	{ { 0, TESTCASE_PLUGIN_API_ADDRESS+100}, REG_END}, { 4, TESTCASE_PLUGIN_API_ADDRESS+100+16, "\xFF\x55\xFF\x11"},
@@ -294,8 +315,17 @@ const struct testcase testcases[] =
 	{ {3, 0x87654321}, {INDEX_APSR, 0}, REG_END}, NO_MEMORY,
 	{ {2, 0x87654321}, {INDEX_APSR, FLAG_N}, REG_END}, NO_MEMORY},
 /* MOV (shifted register): Encoded as ASR, LSL, LSR and ROR. */
-/* MRS: not implemented. */
-/* MSR: not implemented. */
+/* MRS */
+	{ "mrs r2, apsr", 0xF3EF, 0x8200,
+	{ {INDEX_APSR, 0x60000000}, REG_END}, NO_MEMORY,
+	{ {2, 0x60000000}, REG_END}, NO_MEMORY},
+	{ "mrs r1, primask", 0xF3EF, 0x8110,
+	NO_REGISTERS, NO_MEMORY,
+	{ {1, 0}, REG_END}, NO_MEMORY},
+/* MSR */
+	{ "msr apsr, r3", 0xF383, 0x8800,
+	{ {3, 0x9000ABCD}, REG_END}, NO_MEMORY,
+	{ {INDEX_APSR, 0x90000000}, REG_END}, NO_MEMORY},
 /* MUL */
 	{ "mul r2, r1", INSTR_10_Rm_Rdn(0x10D, 1, 2), 
 	{ {1, 10 }, {2, 100}, {INDEX_APSR, FLAG_C|FLAG_V}, REG_END}, NO_MEMORY,
@@ -324,6 +354,12 @@ const struct testcase testcases[] =
 	NO_MEMORY,
 	{{INDEX_SP, TESTCASE_DEFAULT_SP - 3*4}, REG_END},
 	{ 3*4, TESTCASE_DEFAULT_SP-3*4, "\x16\x00\x00\x00" "\x17\x00\x00\x00"  "\x11\x22\x33\x44"} },
+/* PUSH */
+	{ "push {r0, r1, r2, r3}",	0xb40f, INSTRUCTION_16BIT,
+	{ {0, 0x10}, {1, 0x11}, {2, 0x12}, {3, 0x13}, {INDEX_SP, TESTCASE_DEFAULT_SP - 8}, REG_END},
+	NO_MEMORY,
+	{{INDEX_SP, TESTCASE_DEFAULT_SP - 8 - 4*4}, REG_END},
+	{ 4*4, TESTCASE_DEFAULT_SP - 8 - 4*4, "\x10\x00\x00\x00" "\x11\x00\x00\x00" "\x12\x00\x00\x00" "\x13\x00\x00\x00"} },
 /* REV */
 	{ "rev r0, r6", INSTR_10_Rm_Rd(0x2E8, 6, 0),
 	{ {6, 0x87654321}, REG_END}, NO_MEMORY,
@@ -356,7 +392,8 @@ const struct testcase testcases[] =
 	{ "sbc r2, r0", INSTR_10_Rm_Rdn(0x106, 0, 2),
 	{ {2, 0x400}, {0, 0x200}, {INDEX_APSR, 0}, REG_END}, NO_MEMORY,
 	{ {2, 0x1ff}, {INDEX_APSR, FLAG_C}, REG_END}, NO_MEMORY},
-/* SEV: not implemented. */
+/* SEV */
+	{ "sev", 0xBF40, INSTRUCTION_16BIT, NO_REGISTERS, NO_MEMORY, NO_REGISTERS, NO_MEMORY },
 /* STM */
 	{ "stm r1!, {r0, r6}", INSTR_5_Rn_imm8(0x18, 1, ((1<<0)|(1<<6))),
 	{ {1, TESTCASE_PLUGIN_DATA_ADDRESS+400}, {0, 0x12345678}, {6, 0x11223344}, REG_END}, NO_MEMORY,
@@ -401,7 +438,7 @@ const struct testcase testcases[] =
 	{ "sub sp, sp, #500", INSTR_9_imm7(0x161, 500/4),
 	{ {INDEX_SP, TESTCASE_PLUGIN_STACK_ADDRESS}, REG_END}, NO_MEMORY,
 	{ {INDEX_SP, TESTCASE_PLUGIN_STACK_ADDRESS-500}, REG_END}, NO_MEMORY},
-/* SVC: not implemented. */
+/* SVC: needs a handler table, see arm_emulator_set_svc_table(). */
 /* SXTB */
 	{ "sxtb r1, r2", INSTR_10_Rm_Rd(0x2C9, 2, 1),
 	{ {2, 0x11223344}, REG_END}, NO_MEMORY,
@@ -431,10 +468,9 @@ const struct testcase testcases[] =
 	{ "uxth r5, r2", INSTR_10_Rm_Rd(0x2CA, 2, 5),
 	{ {2, 0x11223344}, REG_END}, NO_MEMORY,
 	{ {5, 0x00003344}, REG_END}, NO_MEMORY},
-/* WFE: not implemented. */
-/* WFI: not implemented. */
-/* YIELD: not implemented. */
-	// { "yield", 0xBF10, INSTRUCTION_16BIT, NO_REGISTERS, NO_MEMORY, NO_REGISTERS, NO_MEMORY },
+/* WFE, WFI: stop with ARM_EMULATOR_WAIT. */
+/* YIELD */
+	{ "yield", 0xBF10, INSTRUCTION_16BIT, NO_REGISTERS, NO_MEMORY, NO_REGISTERS, NO_MEMORY },
 /* END */
 	{ 0 }
 };
@@ -470,7 +506,7 @@ uint8_t	program_memory[8 * 1024];
 uint8_t	data_memory[TESTCASE_DATA_MEMORY_SIZE];
 
 /// Service API memory.
-const SERVICE_API service_api = {
+const SERVICE_API testcase_service_api = {
 		1, 1,
 		5,
 		0x98234983,
@@ -483,6 +519,10 @@ const SERVICE_API service_api = {
 };
 /// Last function called address.
 uint32_t	last_function_call = -1;
+/// Number of calls to the function call callback.
+unsigned int	function_calls = 0;
+/// APSR at the last read outside program memory.
+uint32_t	last_read_apsr = 0;
 
 /** Static emulator state for tests. */
 static struct arm_emulator_state emu;
@@ -495,7 +535,6 @@ arm_emulator_callback_read_program_memory(
 	uint32_t address,
 	size_t count)
 {
-	(void)state;
 	const uint32_t offset = address - TESTCASE_PLUGIN_API_ADDRESS;
 	if (offset < TESTCASE_PLUGIN_API_SIZE && offset + count <= TESTCASE_PLUGIN_API_SIZE)
 	{
@@ -504,6 +543,7 @@ arm_emulator_callback_read_program_memory(
 	}
 	else
 	{
+		last_read_apsr = state->APSR;
 		return -1;
 	}
 }
@@ -516,6 +556,7 @@ arm_emulator_callback_functioncall(
 {
 	(void)state;
 	last_function_call = function_address;
+	++function_calls;
 	/* No action to be taken. */
 	return -1;
 }
@@ -543,7 +584,7 @@ testcase_run(const struct testcase *testcase)
 		&emu,
 		&program_memory[0], TESTCASE_PLUGIN_API_ADDRESS, sizeof(program_memory),
 		data_memory, TESTCASE_PLUGIN_DATA_ADDRESS, sizeof(data_memory),
-		(uint8_t *)&service_api, TESTCASE_SERVICE_API_ADDRESS, sizeof(service_api));
+		(uint8_t *)&testcase_service_api, TESTCASE_SERVICE_API_ADDRESS, sizeof(testcase_service_api));
 
 	// 2. Fill memory and registers with random stuff.
 	for (i=0; i<sizeof(program_memory); ++i)
@@ -727,3 +768,1511 @@ testcase_run(const struct testcase *testcase)
 	/* 10. Sure we are OK? */
 	return return_value;
 }
+
+/* Program tests. */
+
+/// Fail the running program test if the condition does not hold.
+#define	CHECK(x) \
+	do { \
+		if (!(x)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+			return -1; \
+		} \
+	} while (0)
+
+/// Guest address of the program.
+#define	PROGRAM_ENTRY	(TESTCASE_PLUGIN_API_ADDRESS | 1)
+
+//============================================================
+/* Reset the emulator and memory, and load code at the start of program memory. */
+static void
+_load_program(
+	const uint16_t *code,
+	size_t count)
+{
+	size_t i;
+	arm_emulator_init(
+		&emu,
+		&program_memory[0], TESTCASE_PLUGIN_API_ADDRESS, sizeof(program_memory),
+		data_memory, TESTCASE_PLUGIN_DATA_ADDRESS, sizeof(data_memory),
+		(uint8_t *)&testcase_service_api, TESTCASE_SERVICE_API_ADDRESS, sizeof(testcase_service_api));
+	memset(program_memory, 0, sizeof(program_memory));
+	memset(data_memory, 0, sizeof(data_memory));
+	for (i = 0; i < count; ++i)
+	{
+		program_memory[2*i] = code[i] & 0xFF;
+		program_memory[2*i+1] = code[i] >> 8;
+	}
+}
+
+//============================================================
+/* Call the program with up to four arguments. */
+static enum arm_emulator_result
+_call_program(
+	const uint32_t *arguments,
+	unsigned int arguments_count,
+	unsigned int max_instructions)
+{
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)PROGRAM_ENTRY, arguments, arguments_count);
+	return arm_emulator_execute(&emu, max_instructions);
+}
+
+//============================================================
+static int
+_test_loop_idiom(void)
+{
+	static const uint16_t code[] = {
+		0x2300,		// movs r3, #0
+		0x54C1,		// L: strb r1, [r0, r3]
+		0x3301,		// adds r3, #1
+		0x4293,		// cmp r3, r2
+		0xD1FB,		// bne L
+		0x4770,		// bx lr
+	};
+	const uint32_t arguments[3] = { TESTCASE_PLUGIN_DATA_ADDRESS + 16, 0xAB, 100 };
+	size_t i;
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	// One instruction short of the whole loop: not finished.
+	CHECK(_call_program(arguments, 3, 1 + 4 * 100) == ARM_EMULATOR_OK);
+	CHECK(arm_emulator_execute(&emu, 1) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[3] == 100);
+	CHECK(emu.APSR == (FLAG_Z | FLAG_C));
+	for (i = 0; i < sizeof(data_memory); ++i)
+	{
+		CHECK(data_memory[i] == (i >= 16 && i < 116 ? 0xAB : 0));
+	}
+	return 0;
+}
+
+//============================================================
+/// Cycles of a call, run at once or one instruction at a time, which
+/// keeps the loop idiom fast path out.
+static uint64_t
+_call_cycles(
+	const uint16_t *code,
+	size_t count,
+	const uint32_t *arguments,
+	uint8_t wait_states,
+	int stepped)
+{
+	enum arm_emulator_result	r;
+	_load_program(code, count);
+	arm_emulator_set_flash_wait_states(&emu, wait_states);
+	data_memory[512] = 0x5A;
+	r = _call_program(arguments, 3, stepped ? 1 : 100000);
+	while (stepped && r == ARM_EMULATOR_OK)
+	{
+		r = arm_emulator_execute(&emu, 1);
+	}
+	return r == ARM_EMULATOR_FUNCTION_RETURNED ? emu.cycles : 0;
+}
+
+//============================================================
+static int
+_test_cycles(void)
+{
+	static const uint16_t straight[] = {
+		0x2001,		// movs r0, #1		1
+		0x3002,		// adds r0, #2		1
+		0xB510,		// push {r4, lr}	3
+		0x4901,		// ldr r1, [pc, #4]	2
+		0xBD10,		// pop {r4, pc}		5
+		0xBF00,		// nop
+		0x5678, 0x1234,
+	};
+	static const uint16_t loop[] = {
+		0x3001,		// L: adds r0, #1	1
+		0xE7FD,		// b L				3
+	};
+	// Fill and copy loops, with the loop at an even and an odd halfword.
+	static const uint16_t fill[] = {
+		0xBF00,		// nop
+		0x2300,		// movs r3, #0
+		0x54C1,		// L: strb r1, [r0, r3]
+		0x3301,		// adds r3, #1
+		0x4293,		// cmp r3, r2
+		0xD1FB,		// bne L
+		0x4770,		// bx lr
+	};
+	static const uint16_t copy[] = {
+		0xBF00,		// nop
+		0x2300,		// movs r3, #0
+		0x5CCC,		// L: ldrb r4, [r1, r3]
+		0x54C4,		// strb r4, [r0, r3]
+		0x3301,		// adds r3, #1
+		0x4293,		// cmp r3, r2
+		0xD1FA,		// bne L
+		0x4770,		// bx lr
+	};
+	const uint32_t fill_arguments[3] = { TESTCASE_PLUGIN_DATA_ADDRESS + 16, 0xAB, 100 };
+	const uint32_t copy_arguments[3] = { TESTCASE_PLUGIN_DATA_ADDRESS + 16, TESTCASE_PLUGIN_DATA_ADDRESS + 512, 100 };
+	uint8_t wait_states;
+	int skip;
+
+	// 12 cycles, one wait state per word of code and per literal.
+	CHECK(_call_cycles(straight, 8, NULL, 0, 0) == 12);
+	CHECK(emu.R[0] == 3 && emu.R[1] == 0x12345678);
+	CHECK(_call_cycles(straight, 8, NULL, 2, 0) == 12 + 2 * 4);
+
+	// Stops once the budget is used up, overrunning by less than an instruction.
+	_load_program(loop, 2);
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)PROGRAM_ENTRY, NULL, 0);
+	CHECK(arm_emulator_execute_cycles(&emu, 100) == ARM_EMULATOR_OK);
+	CHECK(emu.cycles >= 100 && emu.cycles < 103);
+	CHECK(emu.R[0] == 25);
+	CHECK(arm_emulator_execute_cycles(&emu, 40) == ARM_EMULATOR_OK);
+	CHECK(emu.cycles >= 140 && emu.cycles < 143);
+	CHECK(emu.cycles_limit == ARM_CYCLES_UNLIMITED);
+
+	// The loop idiom fast path charges what the loop would have.
+	for (wait_states = 0; wait_states <= 2; wait_states += 2)
+	{
+		for (skip = 0; skip <= 1; ++skip)
+		{
+			uint64_t cycles = _call_cycles(fill + skip, 7 - skip, fill_arguments, wait_states, 1);
+			CHECK(cycles != 0);
+			CHECK(_call_cycles(fill + skip, 7 - skip, fill_arguments, wait_states, 0) == cycles);
+			CHECK(data_memory[16] == 0xAB && data_memory[115] == 0xAB && data_memory[116] == 0);
+			cycles = _call_cycles(copy + skip, 8 - skip, copy_arguments, wait_states, 1);
+			CHECK(cycles != 0);
+			CHECK(_call_cycles(copy + skip, 8 - skip, copy_arguments, wait_states, 0) == cycles);
+			CHECK(data_memory[16] == 0x5A && data_memory[17] == 0);
+		}
+	}
+	return 0;
+}
+
+//============================================================
+static int
+_test_flags_at_callback(void)
+{
+	static const uint16_t code[] = {
+		0x3101,		// adds r1, #1 ; flags overwritten by the CMP
+		0x6810,		// ldr r0, [r2] ; unmapped
+		0x2800,		// cmp r0, #0
+		0x4770,		// bx lr
+	};
+	static struct arm_emulator_block blocks[4];
+	const uint32_t arguments[3] = { 0, 0xFFFFFFFF, 0x40000000 };
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	arm_emulator_set_block_cache(&emu, blocks, 4);
+	last_read_apsr = 0;
+	CHECK(_call_program(arguments, 3, 100) == ARM_EMULATOR_ERROR);
+	CHECK(last_read_apsr == (FLAG_Z | FLAG_C));
+	CHECK(emu.APSR == (FLAG_Z | FLAG_C));
+	arm_emulator_set_block_cache(&emu, NULL, 0);
+	return 0;
+}
+
+/// Translation of the polling loop below, generated from tests/poll.bin.
+extern int poll_register(struct arm_emulator_state *emu);
+extern const struct arm_emulator_native_function poll_functions[];
+extern const unsigned int poll_functions_count;
+
+//============================================================
+static int
+_test_translated_polling_loop(void)
+{
+	// while (GetUptime() < deadline);
+	static const uint16_t code[] = {
+		0xB510,			// push {r4, lr}
+		0x0004,			// movs r4, r0
+		0xF7FA, 0xF87C,	// L: bl 0x100 ; GetUptime
+		0x42A0,			// cmp r0, r4
+		0xD3FB,			// bcc L
+		0xBD10,			// pop {r4, pc}
+	};
+	const uint32_t arguments[1] = { 5 };
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(arm_emulator_register_native(&emu, 0x100, arm_emulator_native_get_uptime) == 0);
+	CHECK(poll_register(&emu) == 1);
+	CHECK(_call_program(arguments, 1, 1000000) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 5);
+	CHECK(arm_emulator_get_uptime(&emu) == 5);
+	return 0;
+}
+
+/// Translation of the flag transfers below, generated from tests/flags.bin.
+extern int flags_register(struct arm_emulator_state *emu);
+
+//============================================================
+static int
+_test_translated_flags(void)
+{
+	// MSR/MRS with high registers; cycles as charged by the interpreter.
+	static const uint16_t code[] = {
+		0xB510,			// push {r4, lr}
+		0x4B06,			// ldr r3, =0x80000000
+		0x4699,			// mov r9, r3
+		0x2101,			// movs r1, #1
+		0xF389, 0x8800,	// msr apsr_nzcvq, r9
+		0xF3EF, 0x8A00,	// mrs r10, apsr
+		0xD401,			// bmi L
+		0x2000,			// movs r0, #0
+		0xBD10,			// pop {r4, pc}
+		0x4650,			// L: mov r0, r10
+		0x467A,			// mov r2, pc ; not translated
+		0xBD10,			// pop {r4, pc}
+		0x0000, 0x8000,	// .word 0x80000000
+	};
+	uint64_t	cycles;
+	uint64_t	ticks;
+	int			translated;
+
+	for (translated = 0; translated <= 1; ++translated)
+	{
+		_load_program(code, sizeof(code) / sizeof(code[0]));
+		arm_emulator_set_flash_wait_states(&emu, 1);
+		if (translated)
+		{
+			CHECK(flags_register(&emu) == 1);
+		}
+		emu.R[10] = 0;
+		CHECK(_call_program(NULL, 0, 1000) == ARM_EMULATOR_FUNCTION_RETURNED);
+		CHECK(emu.R[0] == 0x80000000);
+		CHECK(emu.R[10] == 0x80000000);
+		if (!translated)
+		{
+			cycles = emu.cycles;
+			ticks = emu.clock_ticks;
+		}
+	}
+	// Including the instructions left to the interpreter, once only.
+	CHECK(emu.cycles == cycles);
+	CHECK(emu.clock_ticks == ticks);
+	return 0;
+}
+
+//============================================================
+static int
+_test_idle_loop(void)
+{
+	// while (GetUptime() < deadline);
+	static const uint16_t poll_clock[] = {
+		0xB510,			// push {r4, lr}
+		0x0004,			// movs r4, r0
+		0xF7FA, 0xF87C,	// L: bl 0x100 ; GetUptime
+		0x42A0,			// cmp r0, r4
+		0xD3FB,			// bcc L
+		0xBD10,			// pop {r4, pc}
+	};
+	// while (*flag == 0);
+	static const uint16_t poll_memory[] = {
+		0x6801,		// L: ldr r1, [r0]
+		0x2900,		// cmp r1, #0
+		0xD0FC,		// beq L
+		0x4770,		// bx lr
+	};
+	const uint32_t deadline[1] = { 5 };
+	const uint32_t flag[1] = { TESTCASE_PLUGIN_DATA_ADDRESS };
+
+	// Skipped up to each millisecond, never past it.
+	_load_program(poll_clock, sizeof(poll_clock) / sizeof(poll_clock[0]));
+	CHECK(arm_emulator_register_native(&emu, 0x100, arm_emulator_native_get_uptime) == 0);
+	CHECK(arm_emulator_set_clock(&emu, 1000, 0) == 0);
+	CHECK(_call_program(deadline, 1, 1000000) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 5);
+	CHECK(arm_emulator_get_uptime(&emu) == 5);
+	CHECK(emu.idle_skipped > 0);
+
+	// Nothing can change the flag: skipped to the end of the budget.
+	_load_program(poll_memory, sizeof(poll_memory) / sizeof(poll_memory[0]));
+	CHECK(arm_emulator_set_clock(&emu, 1000, 0) == 0);
+	CHECK(_call_program(flag, 1, 30000) == ARM_EMULATOR_OK);
+	CHECK(emu.idle_skipped > 20000);
+	CHECK(arm_emulator_get_uptime(&emu) >= 29);
+	data_memory[0] = 1;
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[1] == 1);
+	return 0;
+}
+
+/// Timers in the order they ran.
+static uint32_t	_timers_run[8];
+static unsigned int	_timers_run_count;
+
+//============================================================
+static void
+_record_timer(struct arm_emulator_state *state, uint32_t id, uint64_t when)
+{
+	if (state->clock_ticks >= when && _timers_run_count < 8)
+	{
+		_timers_run[_timers_run_count++] = id;
+	}
+}
+
+//============================================================
+static void
+_pend_irq0(struct arm_emulator_state *state, uint32_t id, uint64_t when)
+{
+	(void)id;
+	(void)when;
+	arm_emulator_set_pending(state, ARM_EXCEPTION_IRQ(0));
+}
+
+//============================================================
+static int
+_test_timers(void)
+{
+	static const uint16_t code[] = {
+		0x3801,		// L: subs r0, #1
+		0xD1FD,		// bne L
+		0x4770,		// bx lr
+	};
+	const uint32_t arguments[1] = { 100 };
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	_timers_run_count = 0;
+	CHECK(arm_emulator_add_timer(&emu, 120, _record_timer, 4) == 0);
+	CHECK(arm_emulator_add_timer(&emu, 30, _record_timer, 2) == 0);
+	CHECK(arm_emulator_add_timer(&emu, 90, _record_timer, 3) == 0);
+	CHECK(arm_emulator_add_timer(&emu, 10, _record_timer, 1) == 0);
+	CHECK(arm_emulator_add_timer(&emu, 60, _record_timer, 9) == 0);
+	CHECK(arm_emulator_add_timer(&emu, 1000, _record_timer, 5) == 0);
+	CHECK(arm_emulator_remove_timer(&emu, _record_timer, 9) == 0);
+	CHECK(arm_emulator_remove_timer(&emu, _record_timer, 9) < 0);
+	CHECK(_call_program(arguments, 1, 1000) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(_timers_run_count == 4);
+	CHECK(_timers_run[0] == 1 && _timers_run[1] == 2 && _timers_run[2] == 3 && _timers_run[3] == 4);
+	CHECK(emu.timers_count == 1);
+	return 0;
+}
+
+//============================================================
+static int
+_test_primask(void)
+{
+	static const uint16_t code[] = {
+		0xB672,		// cpsid i
+		0x200A,		// movs r0, #10
+		0x3801,		// L: subs r0, #1 ; IRQ 0 pending from here
+		0xD1FD,		// bne L
+		0x002C,		// movs r4, r5
+		0xB662,		// cpsie i
+		0xBF00,		// nop
+		0x4770,		// bx lr
+		0x3501,		// handler: adds r5, #1
+		0x4770,		// bx lr
+	};
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(arm_emulator_set_vector(&emu, ARM_EXCEPTION_IRQ(0), PROGRAM_ENTRY + 16) == 0);
+	CHECK(arm_emulator_add_timer(&emu, 4, _pend_irq0, 0) == 0);
+	CHECK(_call_program(NULL, 0, 1000) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[4] == 0);
+	CHECK(emu.R[5] == 1);
+	CHECK(emu.pending == 0);
+	return 0;
+}
+
+//============================================================
+static int
+_test_exception_return(void)
+{
+	static const uint16_t code[] = {
+		0x4770,		// bx lr
+		0x2000,		// handler: movs r0, #0
+		0x2100,		// movs r1, #0
+		0x2200,		// movs r2, #0
+		0x2300,		// movs r3, #0
+		0x4684,		// mov r12, r0
+		0x3501,		// adds r5, #1
+		0x4770,		// bx lr
+	};
+	const uint32_t arguments[4] = { 0x11111111, 0x22222222, 0x33333333, 0x44444444 };
+	uint32_t sp;
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(arm_emulator_set_vector(&emu, ARM_EXCEPTION_IRQ(3), PROGRAM_ENTRY + 2) == 0);
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)PROGRAM_ENTRY, arguments, 4);
+	emu.R[12] = 0xCCCCCCCC;
+	emu.APSR = (uint32_t)(FLAG_N | FLAG_C | FLAG_V);
+	sp = emu.R[13];
+	CHECK(arm_emulator_set_pending(&emu, ARM_EXCEPTION_IRQ(3)) == 0);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[5] == 1);
+	CHECK(emu.R[0] == 0x11111111 && emu.R[1] == 0x22222222);
+	CHECK(emu.R[2] == 0x33333333 && emu.R[3] == 0x44444444);
+	CHECK(emu.R[12] == 0xCCCCCCCC);
+	CHECK(emu.APSR == (uint32_t)(FLAG_N | FLAG_C | FLAG_V));
+	CHECK(emu.R[13] == sp);
+	CHECK(emu.exception == 0);
+	return 0;
+}
+
+//============================================================
+static int
+_svc_add(struct arm_emulator_state *state)
+{
+	state->R[0] += state->R[1];
+	return 0;
+}
+
+//============================================================
+static int
+_test_svc(void)
+{
+	static const uint16_t code[] = {
+		0xDF01,		// svc #1
+		0x3001,		// adds r0, #1
+		0x4770,		// bx lr
+		0xDF00,		// svc #0 ; no handler
+		0xDF02,		// svc #2 ; beyond the table
+	};
+	static const arm_emulator_native_t table[2] = { NULL, _svc_add };
+	const uint32_t arguments[2] = { 40, 1 };
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	arm_emulator_set_svc_table(&emu, table, 2);
+	CHECK(_call_program(arguments, 2, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 42);
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)(PROGRAM_ENTRY + 6), arguments, 2);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_ERROR);
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)(PROGRAM_ENTRY + 8), arguments, 2);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_ERROR);
+	// arm_emulator_init() clears the table.
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(_call_program(arguments, 2, 100) == ARM_EMULATOR_ERROR);
+	return 0;
+}
+
+//============================================================
+/* Call a host function at address with three arguments through BLX. */
+static enum arm_emulator_result
+_call_host(
+	uint32_t address,
+	uint32_t r0,
+	uint32_t r1,
+	uint32_t r2)
+{
+	static const uint16_t code[] = {
+		0xB510,		// push {r4, lr}
+		0x4798,		// blx r3
+		0xBD10,		// pop {r4, pc}
+	};
+	const uint32_t arguments[4] = { r0, r1, r2, address | 1 };
+	size_t i;
+	for (i = 0; i < sizeof(code) / sizeof(code[0]); ++i)
+	{
+		program_memory[2*i] = code[i] & 0xFF;
+		program_memory[2*i+1] = code[i] >> 8;
+	}
+	return _call_program(arguments, 4, 100);
+}
+
+//============================================================
+static int
+_test_service_natives(void)
+{
+	const uint32_t data = TESTCASE_PLUGIN_DATA_ADDRESS;
+	size_t i;
+
+	_load_program(NULL, 0);
+	CHECK(arm_emulator_register_native(&emu, 0x110, arm_emulator_native_mem_copy) == 0);
+	CHECK(arm_emulator_register_native(&emu, 0x120, arm_emulator_native_mem_set) == 0);
+	CHECK(arm_emulator_register_native(&emu, 0x130, arm_emulator_native_mem_compare) == 0);
+	CHECK(arm_emulator_register_native(&emu, 0x140, arm_emulator_native_crc32) == 0);
+	for (i = 0; i < 16; ++i)
+	{
+		data_memory[i] = (uint8_t)(i + 1);
+	}
+
+	// MemCopy: overlapping ranges, and from program memory.
+	CHECK(_call_host(0x110, data + 4, data, 8) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == data + 4);
+	for (i = 0; i < 12; ++i)
+	{
+		CHECK(data_memory[i] == (i < 4 ? i + 1 : i - 3));
+	}
+	CHECK(_call_host(0x110, data + 32, TESTCASE_PLUGIN_API_ADDRESS, 6) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(memcmp(data_memory + 32, program_memory, 6) == 0);
+
+	// MemSet uses the low 8 bits of the value.
+	CHECK(_call_host(0x120, data + 64, 0x1A5, 10) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == data + 64);
+	for (i = 62; i < 76; ++i)
+	{
+		CHECK(data_memory[i] == (i >= 64 && i < 74 ? 0xA5 : 0));
+	}
+
+	// MemCompare compares unsigned bytes.
+	CHECK(_call_host(0x130, data + 64, data + 65, 9) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 0);
+	CHECK(_call_host(0x130, data + 64, data + 65, 10) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK((int32_t)emu.R[0] > 0);
+	CHECK(_call_host(0x130, data + 73, data + 64, 2) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK((int32_t)emu.R[0] < 0);
+
+	// Crc32 check value, in one call and continued.
+	memcpy(data_memory + 128, "123456789", 9);
+	CHECK(_call_host(0x140, 0, data + 128, 9) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 0xCBF43926);
+	CHECK(_call_host(0x140, 0, data + 128, 4) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(_call_host(0x140, emu.R[0], data + 132, 5) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 0xCBF43926);
+
+	// A destination outside the data region goes to the callback.
+	last_function_call = 0;
+	CHECK(_call_host(0x120, TESTCASE_PLUGIN_API_ADDRESS, 0, 4) == ARM_EMULATOR_ERROR);
+	CHECK(last_function_call == (0x120 | 1));
+	CHECK(program_memory[0] == 0x10);
+	return 0;
+}
+
+//============================================================
+static int
+_test_mapped_regions(void)
+{
+	static const uint16_t code[] = {
+		0x6802,		// ldr r2, [r0]
+		0x3201,		// adds r2, #1
+		0x600A,		// str r2, [r1]
+		0x4770,		// bx lr
+	};
+	uint8_t input[2][4] = { { 1, 2, 3, 4 }, { 9, 8, 7, 6 } };
+	uint8_t output[8] = { 0 };
+	const uint32_t in = 0x20000000;
+	const uint32_t out = 0x30000000;
+	const uint32_t arguments[2] = { in, out + 4 };
+	const uint32_t read_only[2] = { in, in };
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(arm_emulator_map_region(&emu, in, input[0], 4, 0) == 0);
+	CHECK(arm_emulator_map_region(&emu, out, output, 8, 1) == 0);
+	CHECK(arm_emulator_map_region(&emu, out + 4, output, 8, 1) < 0);
+	CHECK(arm_emulator_map_region(&emu, TESTCASE_PLUGIN_DATA_ADDRESS - 2, output, 8, 1) < 0);
+	CHECK(arm_emulator_host_pointer(&emu, in + 1, 3) == &input[0][1]);
+	CHECK(arm_emulator_host_data_pointer(&emu, in, 4) == NULL);
+
+	CHECK(_call_program(arguments, 2, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(output[4] == 2 && output[5] == 2 && output[6] == 3 && output[7] == 4);
+	CHECK(output[0] == 0);
+
+	// Swap the input buffer between calls.
+	CHECK(arm_emulator_map_region(&emu, in, input[1], 4, 0) == 0);
+	CHECK(_call_program(arguments, 2, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(output[4] == 10 && output[5] == 8 && output[6] == 7 && output[7] == 6);
+
+	// Read-only regions reject stores; unmapped regions reject loads.
+	CHECK(_call_program(read_only, 2, 100) == ARM_EMULATOR_ERROR);
+	CHECK(input[1][0] == 9);
+	CHECK(arm_emulator_unmap_region(&emu, in) == 0);
+	CHECK(arm_emulator_unmap_region(&emu, in) < 0);
+	CHECK(_call_program(arguments, 2, 100) == ARM_EMULATOR_ERROR);
+	CHECK(arm_emulator_unmap_region(&emu, out) == 0);
+	return 0;
+}
+
+//============================================================
+static int
+_test_start_call(void)
+{
+	static const uint16_t code[] = {
+		// int64_t sum(int32_t a, int64_t b, int32_t c, int64_t d)
+		0x9900,		// ldr r1, [sp, #0] ; c
+		0x1840,		// adds r0, r0, r1
+		0x9902,		// ldr r1, [sp, #8] ; d, low word
+		0x1840,		// adds r0, r0, r1
+		0x9903,		// ldr r1, [sp, #12] ; d, high word
+		0x1880,		// adds r0, r0, r2 ; b, low word
+		0x4159,		// adcs r1, r3 ; b, high word
+		0x4770,		// bx lr
+		// int32_t count(void), keeps its state in R4
+		0x3401,		// adds r4, #1
+		0x0020,		// movs r0, r4
+		0x4770,		// bx lr
+		// struct { int32_t x[3]; } fill(int32_t v)
+		0x6001,		// str r1, [r0]
+		0x6041,		// str r1, [r0, #4]
+		0x6081,		// str r1, [r0, #8]
+		0x4770,		// bx lr
+	};
+	const struct arm_emulator_arg sum_args[4] = {
+		ARM_ARG32(1), ARM_ARG64(0x0000000700000020ull), ARM_ARG32(3), ARM_ARG64(0x00000005FFFFFFF0ull)
+	};
+	const struct arm_emulator_arg fill_args[1] = { ARM_ARG32(0x12345678) };
+	const struct arm_emulator_arg bad_args[1] = { { 0, 2 } };
+	const uint32_t top = TESTCASE_PLUGIN_DATA_ADDRESS + sizeof(data_memory);
+	const uint32_t sum = TESTCASE_PLUGIN_API_ADDRESS;
+	const uint32_t count = TESTCASE_PLUGIN_API_ADDRESS + 16;
+	const uint32_t fill = TESTCASE_PLUGIN_API_ADDRESS + 22;
+	uint32_t result[3];
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(arm_emulator_start_call(&emu, sum, bad_args, 1, 0, 0) < 0);
+
+	// 64-bit values in an even register pair and an aligned stack slot.
+	CHECK(arm_emulator_start_call(&emu, sum, sum_args, 4, 0, 0) == 0);
+	CHECK(emu.R[0] == 1 && emu.R[2] == 0x20 && emu.R[3] == 7);
+	CHECK(emu.R[13] == top - 16);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(arm_emulator_get_function_return_value64(&emu) == 0x0000000D00000014ull);
+
+	// Warm calls keep R4 and release the stack arguments; cold calls reset.
+	CHECK(arm_emulator_start_call(&emu, count, NULL, 0, 0, 0) == 0);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 1);
+	CHECK(arm_emulator_start_call(&emu, count, NULL, 0, 0, ARM_CALL_WARM) == 0);
+	CHECK(emu.R[13] == top);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 2);
+	CHECK(arm_emulator_start_call(&emu, count, NULL, 0, 0, 0) == 0);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 1);
+
+	// Structure result in memory reserved on the stack, address in R0.
+	CHECK(arm_emulator_start_call(&emu, fill, fill_args, 1, sizeof(result), 0) == 0);
+	CHECK(emu.R[0] == emu.R[13] && emu.R[0] >= top - 16);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(arm_emulator_get_call_result(&emu, result, sizeof(result)) == 0);
+	CHECK(result[0] == 0x12345678 && result[1] == 0x12345678 && result[2] == 0x12345678);
+	CHECK(arm_emulator_get_call_result(&emu, result, sizeof(result) + 4) < 0);
+	return 0;
+}
+
+//============================================================
+/* Native function calling back into the guest: R0 = nested(R0) + 1. */
+static int
+_native_nested(struct arm_emulator_state *state)
+{
+	struct arm_emulator_frame frame;
+	const struct arm_emulator_arg argument = ARM_ARG32(state->R[0]);
+	uint32_t result;
+
+	if (arm_emulator_push_frame(state, &frame) < 0)
+	{
+		return -1;
+	}
+	if (arm_emulator_start_call(state, TESTCASE_PLUGIN_API_ADDRESS + 10, &argument, 1, 0, 0) < 0
+		|| arm_emulator_execute(state, 100) != ARM_EMULATOR_FUNCTION_RETURNED)
+	{
+		arm_emulator_pop_frame(state, &frame);
+		return -1;
+	}
+	result = state->R[0];
+	arm_emulator_pop_frame(state, &frame);
+	state->R[0] = result + 1;
+	return 0;
+}
+
+//============================================================
+static int
+_test_nested_call(void)
+{
+	static const uint16_t code[] = {
+		0xB510,		// push {r4, lr}
+		0x2405,		// movs r4, #5
+		0x4798,		// blx r3 ; _native_nested
+		0x1900,		// adds r0, r0, r4
+		0xBD10,		// pop {r4, pc}
+		0x2400,		// nested: movs r4, #0
+		0x0040,		// lsls r0, r0, #1
+		0x4770,		// bx lr
+	};
+	const uint32_t arguments[4] = { 10, 0, 0, 0x151 };
+	struct arm_emulator_frame frames[ARM_CALL_DEPTH_MAX + 1];
+	unsigned int i;
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(arm_emulator_register_native(&emu, 0x150, _native_nested) == 0);
+	CHECK(_call_program(arguments, 4, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	// R4 = 5 survives the nested call, which clears it.
+	CHECK(emu.R[0] == 2 * 10 + 1 + 5);
+	CHECK(emu.R[13] == TESTCASE_PLUGIN_DATA_ADDRESS + sizeof(data_memory));
+	CHECK(emu.call_depth == 0);
+
+	// Nesting is limited.
+	for (i = 0; i < ARM_CALL_DEPTH_MAX; ++i)
+	{
+		CHECK(arm_emulator_push_frame(&emu, &frames[i]) == 0);
+	}
+	CHECK(arm_emulator_push_frame(&emu, &frames[i]) < 0);
+	while (i-- > 0)
+	{
+		arm_emulator_pop_frame(&emu, &frames[i]);
+	}
+	CHECK(emu.call_depth == 0);
+	return 0;
+}
+
+//============================================================
+/* Run the routine in data memory at offset with R0 = 0, return APSR or -1. */
+static uint32_t
+_run_in_ram(uint32_t offset)
+{
+	const uint32_t argument[1] = { 0 };
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)((TESTCASE_PLUGIN_DATA_ADDRESS + offset) | 1), argument, 1);
+	return arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED ? emu.APSR : 0xFFFFFFFF;
+}
+
+//============================================================
+static int
+_test_code_in_ram(void)
+{
+	static const uint16_t code[] = {
+		0x8001,		// strh r1, [r0]
+		0x4770,		// bx lr
+	};
+	static const uint8_t routine[] = {
+		0x01, 0x38,	// subs r0, #1 ; flags dead while the CMP follows
+		0x80, 0x42,	// cmp r0, r0 ; patched to a NOP
+		0x70, 0x47,	// bx lr
+	};
+	// Each routine and the patch code in its own cache entry.
+	static struct arm_emulator_block blocks[16];
+	const uint32_t patch[2] = { TESTCASE_PLUGIN_DATA_ADDRESS + 260 + 2, 0xBF00 };
+	unsigned int i;
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	arm_emulator_set_block_cache(&emu, blocks, 16);
+	memcpy(data_memory + 260, routine, sizeof(routine));
+	memcpy(data_memory + 520, routine, sizeof(routine));
+	for (i = 0; i < 3; ++i)
+	{
+		CHECK(_run_in_ram(260) == (FLAG_Z | FLAG_C));
+		CHECK(_run_in_ram(520) == (FLAG_Z | FLAG_C));
+	}
+
+	// Rewritten by the guest: the SUBS flags are now live.
+	CHECK(_call_program(patch, 2, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(_run_in_ram(260) == (uint32_t)FLAG_N);
+
+	// Rewritten by the host.
+	data_memory[520 + 2] = 0x00;
+	data_memory[520 + 3] = 0xBF;
+	arm_emulator_invalidate_code(&emu, TESTCASE_PLUGIN_DATA_ADDRESS + 520 + 2, 2);
+	CHECK(_run_in_ram(520) == (uint32_t)FLAG_N);
+	arm_emulator_set_block_cache(&emu, NULL, 0);
+	return 0;
+}
+
+//============================================================
+static int
+_test_branch_cache(void)
+{
+	static const uint16_t code[] = {
+		0xB500,			// push {lr}
+		0x2403,			// movs r4, #3
+		0xF000, 0xF804,	// L: bl f
+		0x3C01,			// subs r4, #1
+		0xD1FB,			// bne L
+		0xBD00,			// pop {pc}
+		0x46C0,			// nop
+		0x4770,			// f: bx lr
+	};
+
+	// By default every branch, call and return is passed to the callback.
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	function_calls = 0;
+	CHECK(_call_program(NULL, 0, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(function_calls == 3 + 2 + 3);
+	CHECK(_call_program(NULL, 0, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(function_calls == 16);
+
+	// With the cache, declined targets once and returns never.
+	arm_emulator_set_branch_cache(&emu, 1);
+	function_calls = 0;
+	CHECK(_call_program(NULL, 0, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(function_calls == 2);
+	CHECK(_call_program(NULL, 0, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(function_calls == 2);
+
+	// Reset forgets the declined targets.
+	arm_emulator_reset(&emu);
+	CHECK(_call_program(NULL, 0, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(function_calls == 4);
+
+	// Disabling passes everything again.
+	arm_emulator_set_branch_cache(&emu, 0);
+	CHECK(_call_program(NULL, 0, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(function_calls == 12);
+	return 0;
+}
+
+//============================================================
+static int
+_test_branch_to_zero(void)
+{
+	static const uint16_t code[] = {
+		0x2000,		// movs r0, #0
+		0x4700,		// bx r0
+	};
+
+	// An empty return stack slot must not predict a return to 0.
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	arm_emulator_set_branch_cache(&emu, 1);
+	last_function_call = 0xFFFFFFFF;
+	CHECK(_call_program(NULL, 0, 100) == ARM_EMULATOR_ERROR);
+	CHECK(last_function_call == 0);
+	return 0;
+}
+
+//============================================================
+/* Check that a native function is bound at the offset in program memory. */
+static int
+_is_bound(uint32_t offset)
+{
+	unsigned int i;
+	for (i = 0; i < emu.natives_count; ++i)
+	{
+		if (emu.natives[i].address == TESTCASE_PLUGIN_API_ADDRESS + offset)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//============================================================
+static int
+_test_signatures(void)
+{
+	static const uint16_t code[] = {
+		// __udivsi3, lib1funcs.S (__OPTIMIZE_SIZE__), division loop left out
+		0x2900,		// 00: cmp r1, #0
+		0xD017,		// 02: beq .Ldiv0
+		0x2301,		// 04: movs r3, #1
+		0x2200,		// 06: movs r2, #0
+		0xB410,		// 08: push {r4}
+		0x4288,		// 0a: cmp r0, r1
+		0xD301,		// 0c: blo 0x12
+		0x1A40,		// 0e: subs r0, r0, r1
+		0x18D2,		// 10: adds r2, r2, r3
+		0x4610,		// 12: mov r0, r2
+		0xBC10,		// 14: pop {r4}
+		0x4770,		// 16: bx lr
+		// __divsi3, likewise
+		0x2900,		// 18: cmp r1, #0
+		0xD00B,		// 1a: beq .Ldiv0
+		0xB410,		// 1c: push {r4}
+		0x4604,		// 1e: mov r4, r0
+		0x404C,		// 20: eors r4, r1
+		0x46A4,		// 22: mov r12, r4
+		0x2301,		// 24: movs r3, #1
+		0x2200,		// 26: movs r2, #0
+		0x2900,		// 28: cmp r1, #0
+		0xD500,		// 2a: bpl 0x2e
+		0x4249,		// 2c: rsbs r1, r1, #0
+		0x4610,		// 2e: mov r0, r2
+		0xBC10,		// 30: pop {r4}
+		0x4770,		// 32: bx lr
+		// .Ldiv0
+		0xB501,		// 34: push {r0, lr}
+		0x2000,		// 36: movs r0, #0
+		0xBD02,		// 38: pop {r1, pc}
+		// __aeabi_uidivmod: BL to udivsi3_skip_div0_test
+		0x2900,		// 3a: cmp r1, #0
+		0xD0FA,		// 3c: beq .Ldiv0
+		0xB503,		// 3e: push {r0, r1, lr}
+		0xF7FF, 0xFFE0,	// 40: bl 0x4
+		0xBC0E,		// 44: pop {r1, r2, r3}
+		0x4342,		// 46: muls r2, r0, r2
+		0x1A89,		// 48: subs r1, r1, r2
+		0x4718,		// 4a: bx r3
+		// __aeabi_idivmod: BL to divsi3_skip_div0_test
+		0x2900,		// 4c: cmp r1, #0
+		0xD0F1,		// 4e: beq .Ldiv0
+		0xB503,		// 50: push {r0, r1, lr}
+		0xF7FF, 0xFFE3,	// 52: bl 0x1c
+		0xBC0E,		// 56: pop {r1, r2, r3}
+		0x4342,		// 58: muls r2, r0, r2
+		0x1A89,		// 5a: subs r1, r1, r2
+		0x4718,		// 5c: bx r3
+		// memcpy, newlib PREFER_SIZE_OVER_SPEED, GCC -Os
+		0x2300,		// 5e: movs r3, #0
+		0xB510,		// 60: push {r4, lr}
+		0x4293,		// 62: cmp r3, r2
+		0xD100,		// 64: bne 0x68
+		0xBD10,		// 66: pop {r4, pc}
+		0x5CCC,		// 68: ldrb r4, [r1, r3]
+		0x54C4,		// 6a: strb r4, [r0, r3]
+		0x3301,		// 6c: adds r3, #1
+		0xE7F8,		// 6e: b 0x62
+		// memset, likewise
+		0x1882,		// 70: adds r2, r0, r2
+		0x0003,		// 72: movs r3, r0
+		0x4293,		// 74: cmp r3, r2
+		0xD100,		// 76: bne 0x7a
+		0x4770,		// 78: bx lr
+		0x7019,		// 7a: strb r1, [r3]
+		0x3301,		// 7c: adds r3, #1
+		0xE7F9,		// 7e: b 0x74
+		// __aeabi_fcmpeq, bpabi-v6m.S COMPARISON
+		0xB510,		// 80: push {r4, lr}
+		0xF000, 0xF80F,	// 82: bl 0xa4
+		0x2800,		// 86: cmp r0, #0
+		0xD001,		// 88: beq 0x8e
+		0x2000,		// 8a: movs r0, #0
+		0xBD10,		// 8c: pop {r4, pc}
+		0x2001,		// 8e: movs r0, #1
+		0xBD10,		// 90: pop {r4, pc}
+		// __aeabi_dcmpeq, same code
+		0xB510,		// 92: push {r4, lr}
+		0xF000, 0xF80E,	// 94: bl 0xb4
+		0x2800,		// 98: cmp r0, #0
+		0xD001,		// 9a: beq 0xa0
+		0x2000,		// 9c: movs r0, #0
+		0xBD10,		// 9e: pop {r4, pc}
+		0x2001,		// a0: movs r0, #1
+		0xBD10,		// a2: pop {r4, pc}
+		// __eqsf2 stand-in: reads R0-R1 only
+		0x0042,		// a4: lsls r2, r0, #1
+		0x004B,		// a6: lsls r3, r1, #1
+		0x4313,		// a8: orrs r3, r2
+		0xD001,		// aa: beq 0xb0
+		0x1A40,		// ac: subs r0, r0, r1
+		0x4770,		// ae: bx lr
+		0x2000,		// b0: movs r0, #0
+		0x4770,		// b2: bx lr
+		// __eqdf2 stand-in: reads R0-R3
+		0xB510,		// b4: push {r4, lr}
+		0x004C,		// b6: lsls r4, r1, #1
+		0x4304,		// b8: orrs r4, r0
+		0x1A80,		// ba: subs r0, r0, r2
+		0x4199,		// bc: sbcs r1, r3
+		0x4308,		// be: orrs r0, r1
+		0xBD10,		// c0: pop {r4, pc}
+	};
+	struct arm_signature_match matches[8];
+	const uint32_t uidivmod[2] = { 100, 7 };
+	const uint32_t idivmod[2] = { (uint32_t)-7, 2 };
+	const uint32_t nan[2] = { 0x7FC00000, 0x7FC00000 };
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(arm_signatures_scan(&emu, arm_signatures_default, arm_signatures_default_count, 100, matches, 8) == 6);
+	CHECK(strcmp(matches[2].signature->name, "__aeabi_uidivmod") == 0);
+	CHECK(matches[2].address == TESTCASE_PLUGIN_API_ADDRESS + 0x3A);
+	CHECK(strcmp(matches[3].signature->name, "__aeabi_idivmod") == 0);
+	CHECK(matches[3].address == TESTCASE_PLUGIN_API_ADDRESS + 0x4C);
+	CHECK(_is_bound(0x00) && _is_bound(0x18) && _is_bound(0x3A) && _is_bound(0x4C));
+	CHECK(_is_bound(0x5E) && _is_bound(0x70));
+
+	// Only the wrapper whose helper takes float arguments.
+	CHECK(arm_signatures_scan(&emu, arm_signatures_float, arm_signatures_float_count, 100, matches, 8) == 1);
+	CHECK(matches[0].address == TESTCASE_PLUGIN_API_ADDRESS + 0x80);
+	CHECK(_is_bound(0x80) && !_is_bound(0x92));
+	CHECK(emu.natives_count == 7);
+
+	// The natives run instead of the shortened bodies.
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)(TESTCASE_PLUGIN_API_ADDRESS + 0x3A + 1), uidivmod, 2);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 14 && emu.R[1] == 2);
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)(TESTCASE_PLUGIN_API_ADDRESS + 0x4C + 1), idivmod, 2);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == (uint32_t)-3 && emu.R[1] == (uint32_t)-1);
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)(TESTCASE_PLUGIN_API_ADDRESS + 0x80 + 1), nan, 2);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.R[0] == 0);
+	return 0;
+}
+
+//============================================================
+static int
+_test_wait(void)
+{
+	static const uint16_t code[] = {
+		0xBF20,		// wfe ; stops
+		0x3001,		// adds r0, #1
+		0xBF40,		// sev
+		0xBF20,		// wfe ; consumes the event
+		0x3001,		// adds r0, #1
+		0xBF30,		// wfi ; stops
+		0x3001,		// adds r0, #1
+		0xBF20,		// wfe ; stops, resumed with an event
+		0xBF20,		// wfe ; stops, the event was consumed
+		0x4770,		// bx lr
+	};
+	const uint32_t arguments[1] = { 0 };
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(_call_program(arguments, 1, 100) == ARM_EMULATOR_WAIT);
+	CHECK(emu.waiting == ARM_EMULATOR_WAIT_FOR_EVENT);
+	CHECK(emu.R[15] == TESTCASE_PLUGIN_API_ADDRESS + 2 && emu.R[0] == 0);
+
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_WAIT);
+	CHECK(emu.waiting == ARM_EMULATOR_WAIT_FOR_INTERRUPT);
+	CHECK(emu.R[15] == TESTCASE_PLUGIN_API_ADDRESS + 12 && emu.R[0] == 2);
+	CHECK(emu.event == 0);
+
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_WAIT);
+	CHECK(emu.waiting == ARM_EMULATOR_WAIT_FOR_EVENT);
+	CHECK(emu.R[15] == TESTCASE_PLUGIN_API_ADDRESS + 16 && emu.R[0] == 3);
+
+	arm_emulator_signal_event(&emu);
+	CHECK(emu.event == 1);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_WAIT);
+	CHECK(emu.waiting == ARM_EMULATOR_WAIT_FOR_EVENT);
+	CHECK(emu.R[15] == TESTCASE_PLUGIN_API_ADDRESS + 18 && emu.event == 0);
+
+	arm_emulator_signal_event(&emu);
+	CHECK(arm_emulator_execute(&emu, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+	CHECK(emu.waiting == ARM_EMULATOR_NOT_WAITING && emu.event == 0);
+	CHECK(emu.R[0] == 3);
+	return 0;
+}
+
+//============================================================
+/// Store an I2C transaction operation (struct service_i2c_op) in data memory.
+static void
+_put_i2c_op(
+	uint32_t offset,
+	uint32_t address_page_register,
+	uint32_t data,
+	uint16_t nbytes,
+	uint8_t direction)
+{
+	memcpy(&data_memory[offset], &address_page_register, 4);
+	memcpy(&data_memory[offset + 4], &data, 4);
+	memcpy(&data_memory[offset + 8], &nbytes, 2);
+	data_memory[offset + 10] = direction;
+	data_memory[offset + 11] = 0;
+}
+
+//============================================================
+static int
+_test_i2c(void)
+{
+	static uint8_t			registers[2 * 256];
+	struct arm_i2c_device	device = { 0x48, 2, registers, 0, 0 };
+	struct arm_i2c_bus		bus = { &device, 1, 0 };
+	static const uint8_t	data[4] = { 1, 2, 3, 4 };
+	uint8_t					buffer[4];
+	const uint32_t			ops = TESTCASE_PLUGIN_DATA_ADDRESS;
+
+	// Auto-increment, wrapping within the page.
+	memset(registers, 0, sizeof(registers));
+	CHECK(arm_i2c_write(&bus, MAKE_ADDRESS_PAGE_REGISTER(0x48, 1, 0xFE), data, 4) == 0);
+	CHECK(registers[256 + 0xFE] == 1 && registers[256 + 0xFF] == 2);
+	CHECK(registers[256] == 3 && registers[257] == 4);
+	CHECK(registers[0xFF] == 0 && registers[0] == 0);
+	CHECK(arm_i2c_read(&bus, buffer, MAKE_ADDRESS_PAGE_REGISTER(0x48, 1, 0xFF), 3) == 0);
+	CHECK(buffer[0] == 2 && buffer[1] == 3 && buffer[2] == 4);
+	CHECK(device.bytes_written == 4 && device.bytes_read == 3 && bus.transfers == 2);
+
+	// No device at the address, no such page.
+	CHECK(arm_i2c_write(&bus, MAKE_ADDRESS_PAGE_REGISTER(0x49, 0, 0), data, 1) == -1);
+	CHECK(arm_i2c_read(&bus, buffer, MAKE_ADDRESS_PAGE_REGISTER(0x48, 2, 0), 1) == -1);
+	CHECK(device.bytes_written == 4 && device.bytes_read == 3 && bus.transfers == 4);
+
+	// Batched: write 2 bytes, read them back, then fail at the third op.
+	_load_program(NULL, 0);
+	arm_i2c_attach(&emu, &bus);
+	data_memory[64] = 0xA5;
+	data_memory[65] = 0x5A;
+	_put_i2c_op(0, MAKE_ADDRESS_PAGE_REGISTER(0x48, 0, 0x10), ops + 64, 2, SERVICE_I2C_WRITE);
+	_put_i2c_op(12, MAKE_ADDRESS_PAGE_REGISTER(0x48, 0, 0x10), ops + 80, 2, SERVICE_I2C_READ);
+	_put_i2c_op(24, MAKE_ADDRESS_PAGE_REGISTER(0x48, 5, 0x10), ops + 80, 2, SERVICE_I2C_READ);
+	_put_i2c_op(36, MAKE_ADDRESS_PAGE_REGISTER(0x48, 0, 0x20), ops + 64, 2, SERVICE_I2C_WRITE);
+	emu.R[0] = ops;
+	emu.R[1] = 2;
+	CHECK(arm_i2c_native_transaction(&emu) == 0 && emu.R[0] == 0);
+	CHECK(data_memory[80] == 0xA5 && data_memory[81] == 0x5A);
+	emu.R[0] = ops;
+	emu.R[1] = 4;
+	CHECK(arm_i2c_native_transaction(&emu) == 0 && emu.R[0] == (uint32_t)(-1 - 2));
+	// Stopped at the failed op.
+	CHECK(registers[0x20] == 0);
+	// Reading into program memory fails the op.
+	_put_i2c_op(0, MAKE_ADDRESS_PAGE_REGISTER(0x48, 0, 0x10), TESTCASE_PLUGIN_API_ADDRESS, 2, SERVICE_I2C_READ);
+	emu.R[0] = ops;
+	emu.R[1] = 1;
+	CHECK(arm_i2c_native_transaction(&emu) == 0 && emu.R[0] == (uint32_t)-1);
+
+	// No bus attached.
+	arm_i2c_attach(&emu, NULL);
+	emu.R[0] = ops;
+	emu.R[1] = 1;
+	CHECK(arm_i2c_native_transaction(&emu) == 0 && emu.R[0] == (uint32_t)-1);
+	return 0;
+}
+
+/// Calls of _screen_flush() and the dirty rectangle it was passed.
+static int		screen_flushes;
+static uint16_t	screen_dirty[4];
+
+//============================================================
+static void
+_screen_flush(void *context, const struct arm_services *services)
+{
+	(void)context;
+	++screen_flushes;
+	screen_dirty[0] = services->dirty_top;
+	screen_dirty[1] = services->dirty_left;
+	screen_dirty[2] = services->dirty_bottom;
+	screen_dirty[3] = services->dirty_right;
+}
+
+//============================================================
+/// Call a screen native with R0...R2 set.
+static void
+_screen_native(arm_emulator_native_t native, uint32_t yx, uint32_t r1, uint32_t r2)
+{
+	emu.R[0] = yx;
+	emu.R[1] = r1;
+	emu.R[2] = r2;
+	native(&emu);
+}
+
+//============================================================
+static int
+_test_services(void)
+{
+	static const uint16_t loop[] = {
+		0x3001,		// L: adds r0, #1
+		0xE7FD,		// b L
+	};
+	char					cells[3 * 8];
+	struct arm_services		services;
+	struct service_api		api;
+	const uint32_t			text = TESTCASE_PLUGIN_DATA_ADDRESS;
+	unsigned int			i;
+
+	_load_program(loop, 2);
+	CHECK(arm_emulator_set_clock(&emu, 1000, 0) == 0);
+	memset(cells, ' ', sizeof(cells));
+	memset(&services, 0, sizeof(services));
+	services.cells = cells;
+	services.rows = 3;
+	services.columns = 8;
+	services.flush = _screen_flush;
+	CHECK(arm_services_attach(&emu, &services, 1) == 0);
+	CHECK(services.flush_ticks == 1000);
+	screen_flushes = 0;
+	memcpy(data_memory, "abcdef", 6);
+
+	// Clipped at the right edge, not wrapped to the next row.
+	_screen_native(arm_services_native_write_screen, (1 << 16) | 5, text, 6);
+	CHECK(memcmp(cells + 8, "     abc", 8) == 0);
+	CHECK(memcmp(cells + 16, "        ", 8) == 0);
+	arm_services_flush(&services);
+	CHECK(screen_flushes == 1);
+	CHECK(screen_dirty[0] == 1 && screen_dirty[1] == 5 && screen_dirty[2] == 2 && screen_dirty[3] == 8);
+	CHECK(services.dirty_top >= services.dirty_bottom);
+
+	// Only cells that change are dirty; nothing changed, nothing flushed.
+	_screen_native(arm_services_native_write_screen, 1 << 16, text, 4);
+	arm_services_flush(&services);
+	data_memory[2] = 'X';
+	_screen_native(arm_services_native_write_screen, 1 << 16, text, 4);
+	CHECK(memcmp(cells + 8, "abXd abc", 8) == 0);
+	CHECK(services.dirty_top == 1 && services.dirty_left == 2);
+	CHECK(services.dirty_bottom == 2 && services.dirty_right == 3);
+	arm_services_flush(&services);
+	_screen_native(arm_services_native_write_screen, 1 << 16, text, 4);
+	arm_services_flush(&services);
+	CHECK(screen_flushes == 3);
+	// Out of the framebuffer.
+	_screen_native(arm_services_native_write_screen, 3 << 16, text, 4);
+	_screen_native(arm_services_native_write_screen, 8, text, 4);
+	CHECK(services.dirty_top >= services.dirty_bottom);
+
+	// WriteScreenDecimal pads to nspaces, and is clipped like text.
+	_screen_native(arm_services_native_write_screen_decimal, 0, (uint32_t)-42, 5);
+	CHECK(memcmp(cells, "  -42   ", 8) == 0);
+	_screen_native(arm_services_native_write_screen_decimal, 5, 12345, 2);
+	CHECK(memcmp(cells, "  -42123", 8) == 0);
+	_screen_native(arm_services_native_write_screen_decimal, 2 << 16, 0x80000000, 0);
+	CHECK(memcmp(cells + 16, "-2147483", 8) == 0);
+	_screen_native(arm_services_native_write_screen_decimal, 2 << 16, 0, 3);
+	CHECK(memcmp(cells + 16, "  047483", 8) == 0);
+	CHECK(screen_flushes == 3);
+
+	// Flushed by the periodic timer on the virtual clock.
+	arm_emulator_start_function_call(&emu, (const void *)(uintptr_t)PROGRAM_ENTRY, NULL, 0);
+	CHECK(arm_emulator_execute(&emu, 1200) == ARM_EMULATOR_OK);
+	CHECK(screen_flushes == 4);
+	CHECK(screen_dirty[0] == 0 && screen_dirty[2] == 3);
+	_screen_native(arm_services_native_write_screen, 0, text, 1);
+	CHECK(arm_emulator_execute(&emu, 1000) == ARM_EMULATOR_OK);
+	CHECK(screen_flushes == 5);
+	CHECK(screen_dirty[0] == 0 && screen_dirty[1] == 0 && screen_dirty[2] == 1 && screen_dirty[3] == 1);
+	CHECK(arm_services_attach(&emu, NULL, 0) == 0);
+
+	// Bound up to function_count, NULL entries skipped.
+	memset(&api, 0, sizeof(api));
+	api.function_count = 4;
+	api.GetUptime = (service_get_uptime_t)(uintptr_t)0x101;
+	api.DebugWriteLineHex32 = (service_debug_writeln_hex32_t)(uintptr_t)0x121;
+	api.WriteScreen = (service_write_screen_t)(uintptr_t)0x131;
+	api.WriteScreenDecimal = (service_write_screen_decimal_t)(uintptr_t)0x141;
+	_load_program(NULL, 0);
+	CHECK(arm_services_bind(&emu, &api) == 0);
+	CHECK(emu.natives_count == 3);
+	for (i = 0; i < emu.natives_count; ++i)
+	{
+		CHECK(emu.natives[i].address == 0x100 + 0x10 * (i == 0 ? 0 : i + 1));
+	}
+	CHECK(emu.natives[0].function == arm_emulator_native_get_uptime);
+	CHECK(emu.natives[2].function == arm_services_native_write_screen);
+	return 0;
+}
+
+//============================================================
+static int
+_test_verify(void)
+{
+	static const uint16_t code[] = {
+		0xB500,			// f: push {lr}
+		0xF7FF, 0xFFFD,	// bl f
+		0xBD00,			// pop {pc}
+		0xB510,			// g: push {r4, lr}
+		0xB082,			// sub sp, #8
+		0xF000, 0xF802,	// bl h
+		0xB002,			// add sp, #8
+		0xBD10,			// pop {r4, pc}
+		0xB570,			// h: push {r4, r5, r6, lr}
+		0xBD70,			// pop {r4, r5, r6, pc}
+	};
+	static const uint16_t out_of_range[] = {
+		0xB510,			// push {r4, lr}
+		0xF7FA, 0xF87D,	// bl 0x100
+		0xBD10,			// pop {r4, pc}
+	};
+	static const uint16_t invalid[] = {
+		0x2000,			// movs r0, #0
+		0xDE00,			// udf #0
+	};
+	static const uint16_t indirect[] = {
+		0x4700,			// bx r0
+		0, 0, 0, 0, 0, 0, 0,
+		0x2007,			// movs r0, #7 ; not reached by the verifier
+		0x4770,			// bx lr
+	};
+	static uint32_t				bitmap[ARM_VERIFY_BITMAP_WORDS(sizeof(program_memory))];
+	static uint16_t				depths[ARM_VERIFY_DEPTHS(sizeof(program_memory))];
+	struct arm_verify_result	result;
+	const uint32_t				f = TESTCASE_PLUGIN_API_ADDRESS | 1;
+	const uint32_t				g = (TESTCASE_PLUGIN_API_ADDRESS + 8) | 1;
+	const uint32_t				entries[2] = { g, f };
+	const uint32_t				end = TESTCASE_PLUGIN_API_ADDRESS + sizeof(program_memory);
+
+	// Stack bound over the deepest call path.
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	CHECK(arm_verify(&emu, &g, 1, bitmap, depths, &result) == 0);
+	CHECK(result.error == ARM_VERIFY_OK && result.instructions == 7);
+	CHECK(result.stack_bound == 8 + 8 + 16);
+	CHECK(bitmap[0] == 0xF70 && bitmap[1] == 0);
+	// Recursion has no bound, but verifies.
+	CHECK(arm_verify(&emu, entries, 2, bitmap, depths, &result) == 0);
+	CHECK(result.stack_bound == ARM_VERIFY_UNBOUNDED && result.instructions == 10);
+
+	// A call that leaves the program region, unless there is a native.
+	_load_program(out_of_range, sizeof(out_of_range) / sizeof(out_of_range[0]));
+	CHECK(arm_verify(&emu, &f, 1, bitmap, depths, &result) < 0);
+	CHECK(result.error == ARM_VERIFY_BRANCH_OUT_OF_RANGE);
+	CHECK(result.error_address == TESTCASE_PLUGIN_API_ADDRESS + 2);
+	CHECK(arm_emulator_register_native(&emu, 0x100, arm_emulator_native_get_uptime) == 0);
+	CHECK(arm_verify(&emu, &f, 1, bitmap, depths, &result) == 0);
+
+	// Invalid instruction.
+	_load_program(invalid, sizeof(invalid) / sizeof(invalid[0]));
+	CHECK(arm_verify(&emu, &f, 1, bitmap, depths, &result) < 0);
+	CHECK(result.error == ARM_VERIFY_INVALID_INSTRUCTION);
+	CHECK(result.error_address == TESTCASE_PLUGIN_API_ADDRESS + 2);
+
+	// Falls off the end of the program region.
+	program_memory[sizeof(program_memory) - 2] = 0x00;
+	program_memory[sizeof(program_memory) - 1] = 0x20;	// movs r0, #0
+	{
+		const uint32_t last = (end - 2) | 1;
+		CHECK(arm_verify(&emu, &last, 1, bitmap, depths, &result) < 0);
+		CHECK(result.error == ARM_VERIFY_FALLS_OFF_END && result.error_address == end - 2);
+	}
+	// Entry point out of range.
+	CHECK(arm_verify(&emu, &end, 1, bitmap, depths, &result) < 0);
+	CHECK(result.error == ARM_VERIFY_ENTRY_OUT_OF_RANGE && result.error_address == end);
+
+	// Code past an indirect branch is fetched with checks, and stops
+	// outside the program region.
+	_load_program(indirect, sizeof(indirect) / sizeof(indirect[0]));
+	CHECK(arm_verify(&emu, &f, 1, bitmap, depths, &result) == 0);
+	CHECK(result.instructions == 1);
+	arm_emulator_set_verified(&emu, bitmap);
+	{
+		const uint32_t unverified[1] = { (TESTCASE_PLUGIN_API_ADDRESS + 16) | 1 };
+		const uint32_t outside[1] = { end | 1 };
+		CHECK(_call_program(unverified, 1, 100) == ARM_EMULATOR_FUNCTION_RETURNED);
+		CHECK(emu.R[0] == 7);
+		CHECK(_call_program(outside, 1, 100) == ARM_EMULATOR_ERROR);
+		CHECK(emu.R[15] == end);
+	}
+	arm_emulator_set_verified(&emu, NULL);
+	return 0;
+}
+
+//============================================================
+static int
+_test_cfg(void)
+{
+	static const uint16_t code[] = {
+		0xB500,			// f: push {lr}
+		0x4803,			// ldr r0, [pc, #12] ; the literal at 0x10
+		0x2800,			// cmp r0, #0
+		0xD001,			// beq 0x0C
+		0xF000, 0xF804,	// bl g
+		0xBD00,			// pop {pc}
+		0x46C0,			// nop ; padding, not reached
+		0x5678, 0x1234,	// .word 0x12345678
+		0x2001,			// g: movs r0, #1
+		0x4770,			// bx lr
+		0x2002,			// movs r0, #2 ; not reached
+	};
+	static uint8_t					map[ARM_CFG_MAP_SIZE(sizeof(program_memory))];
+	static struct arm_cfg_function	functions[4];
+	static struct arm_cfg_block		blocks[8];
+	static struct arm_cfg_call		calls[4];
+	struct arm_cfg					cfg;
+	const uint32_t					base = TESTCASE_PLUGIN_API_ADDRESS;
+	const uint32_t					f = base | 1;
+
+	_load_program(code, sizeof(code) / sizeof(code[0]));
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.map = map;
+	cfg.functions = functions;
+	cfg.functions_max = 4;
+	cfg.blocks = blocks;
+	cfg.blocks_max = 8;
+	cfg.calls = calls;
+	cfg.calls_max = 4;
+	CHECK(arm_cfg_build(&emu, &f, 1, &cfg) == 0);
+	CHECK(cfg.invalid_count == 0);
+
+	// The callee is found through the call.
+	CHECK(cfg.functions_count == 2);
+	CHECK(functions[0].address == base && functions[0].first_block == 0 && functions[0].blocks_count == 3);
+	CHECK(functions[1].address == base + 0x14 && functions[1].first_block == 3 && functions[1].blocks_count == 1);
+
+	// Blocks end at branches and calls, and start at their targets and returns.
+	CHECK(cfg.blocks_count == 4);
+	CHECK(blocks[0].address == base && blocks[0].size == 8 && blocks[0].count == 4);
+	CHECK(blocks[0].kind == ARM_INSN_BRANCH_COND && blocks[0].target == base + 0x0C && blocks[0].function == 0);
+	CHECK(blocks[1].address == base + 0x08 && blocks[1].size == 4 && blocks[1].count == 1);
+	CHECK(blocks[1].kind == ARM_INSN_CALL && blocks[1].target == base + 0x14 && blocks[1].function == 0);
+	CHECK(blocks[2].address == base + 0x0C && blocks[2].size == 2 && blocks[2].kind == ARM_INSN_RETURN);
+	CHECK(blocks[3].address == base + 0x14 && blocks[3].size == 4 && blocks[3].count == 2);
+	CHECK(blocks[3].kind == ARM_INSN_RETURN && blocks[3].function == 1);
+
+	CHECK(cfg.calls_count == 1);
+	CHECK(calls[0].address == base + 0x08 && calls[0].target == base + 0x14);
+
+	// The literal pool is data, padding and dead code are neither.
+	CHECK(map[0x10 / 2] == ARM_CFG_LITERAL && map[0x12 / 2] == ARM_CFG_LITERAL);
+	CHECK(map[0x0E / 2] == 0 && map[0x18 / 2] == 0);
+	CHECK(map[0x08 / 2] == (ARM_CFG_CODE | ARM_CFG_BLOCK) && map[0x0A / 2] == ARM_CFG_CODE2);
+	CHECK(map[0x14 / 2] == (ARM_CFG_CODE | ARM_CFG_BLOCK | ARM_CFG_FUNCTION));
+
+	// Lookups by any address within an instruction.
+	CHECK(arm_cfg_find_block(&cfg, base) == &blocks[0]);
+	CHECK(arm_cfg_find_block(&cfg, base + 0x07) == &blocks[0]);
+	CHECK(arm_cfg_find_block(&cfg, base + 0x0A) == &blocks[1]);
+	CHECK(arm_cfg_find_block(&cfg, base + 0x16) == &blocks[3]);
+	CHECK(arm_cfg_find_block(&cfg, base + 0x0E) == NULL);
+	CHECK(arm_cfg_find_block(&cfg, base + 0x10) == NULL);
+	CHECK(arm_cfg_find_block(&cfg, base + 0x18) == NULL);
+	CHECK(arm_cfg_find_block(&cfg, base - 2) == NULL);
+	CHECK(arm_cfg_find_function(&cfg, base + 0x0C) == &functions[0]);
+	CHECK(arm_cfg_find_function(&cfg, base + 0x16) == &functions[1]);
+	CHECK(arm_cfg_find_function(&cfg, base + 0x10) == NULL);
+
+	// Too little storage fails, but still counts everything.
+	cfg.blocks_max = 2;
+	CHECK(arm_cfg_build(&emu, &f, 1, &cfg) < 0);
+	CHECK(cfg.blocks_count == 4 && cfg.functions_count == 2);
+	CHECK(arm_cfg_find_block(&cfg, base + 0x0C) == NULL);
+	CHECK(arm_cfg_find_block(&cfg, base + 0x08) == &blocks[1]);
+	return 0;
+}
+
+/// Output received by _capture_sink().
+static uint8_t	captured[2 * UART_BUFFER_SIZE];
+static uint32_t	captured_length;
+static int		captured_calls;
+
+//============================================================
+static void
+_capture_sink(void *context, const uint8_t *data, uint32_t length)
+{
+	(void)context;
+	if (captured_length + length <= sizeof(captured))
+	{
+		memcpy(captured + captured_length, data, length);
+		captured_length += length;
+	}
+	++captured_calls;
+}
+
+//============================================================
+static int
+_test_uart_sink(void)
+{
+	struct uart_buffer	buffer;
+	char				line[UART_BUFFER_SIZE + 11];
+
+	captured_length = 0;
+	captured_calls = 0;
+	uart_set_sink(&buffer, _capture_sink, NULL);
+
+	// Held until flushed.
+	uart_write("abc");
+	CHECK(captured_calls == 0 && buffer.length == 3);
+	uart_flush();
+	CHECK(captured_calls == 1 && captured_length == 3 && memcmp(captured, "abc", 3) == 0);
+	CHECK(buffer.length == 0);
+	uart_flush();
+	CHECK(captured_calls == 1);
+
+	// Passed on in bulk when the buffer is full, the rest at the end of the line.
+	memset(line, 'x', sizeof(line) - 1);
+	line[sizeof(line) - 1] = 0;
+	uart_write(line);
+	CHECK(captured_calls == 2 && captured_length == 3 + UART_BUFFER_SIZE);
+	CHECK(buffer.length == 10);
+	uart_write_crlf();
+	CHECK(captured_calls == 3 && captured_length == 3 + UART_BUFFER_SIZE + 12);
+	CHECK(memcmp(captured + captured_length - 3, "x\r\n", 3) == 0);
+
+	// Pending output goes to the old sink before the switch.
+	uart_write("def");
+	uart_set_sink(&buffer, uart_sink_discard, NULL);
+	CHECK(captured_calls == 4 && memcmp(captured + captured_length - 3, "def", 3) == 0);
+	uart_writeln("discarded");
+	uart_write("discarded too");
+	uart_flush();
+	CHECK(captured_calls == 4 && buffer.length == 0);
+
+	uart_set_sink(NULL, NULL, NULL);
+	return 0;
+}
+
+const struct testcase_program testcase_programs[] =
+{
+	{ "loop idiom: fill", _test_loop_idiom },
+	{ "cycles: counted, budgeted and skipped loops", _test_cycles },
+	{ "block cache: flags exact at callbacks", _test_flags_at_callback },
+	{ "translation: polling loop", _test_translated_polling_loop },
+	{ "translation: flags and cycles", _test_translated_flags },
+	{ "idle loop: skipped to the next millisecond", _test_idle_loop },
+	{ "timers: run in order of time", _test_timers },
+	{ "exceptions: masked by PRIMASK", _test_primask },
+	{ "exceptions: EXC_RETURN restores the frame", _test_exception_return },
+	{ "svc: dispatched through the handler table", _test_svc },
+	{ "service api 1.1: memory and CRC-32 natives", _test_service_natives },
+	{ "regions: host buffers mapped at runtime", _test_mapped_regions },
+	{ "calls: AAPCS arguments, results and warm calls", _test_start_call },
+	{ "calls: nested guest call from a host callback", _test_nested_call },
+	{ "block cache: code rewritten in RAM", _test_code_in_ram },
+	{ "branch cache: callback contract", _test_branch_cache },
+	{ "branch cache: branch to address 0", _test_branch_to_zero },
+	{ "signatures: libgcc and newlib helpers bound", _test_signatures },
+	{ "i2c: auto-increment, missing devices and batched failures", _test_i2c },
+	{ "services: screen writes, flushes and binding", _test_services },
+	{ "verifier: errors, stack bound and unverified code", _test_verify },
+	{ "cfg: functions, blocks, calls and literals", _test_cfg },
+	{ "wait: WFE and WFI stop and resume", _test_wait },
+	{ "uart: sink buffer filled, flushed and discarded", _test_uart_sink },
+/* END */
+	{ 0 }
+};
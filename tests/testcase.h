@@ -97,6 +97,19 @@ extern const struct testcase testcases[];
 
 extern int testcase_run(const struct testcase *testcase);
 
+/**
+ * Test running a short program, for behaviour beyond single instructions.
+ */
+struct testcase_program {
+	/** Name of the test. Nullpointer signals end of test cases. */
+	const char *name;
+	/** Run the test.
+	    @return 0 on success. */
+	int (*run)(void);
+};
+
+extern const struct testcase_program testcase_programs[];
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,1200 @@
+// SPDX-License-Identifier: MIT
+/**
+ * Static translator of plugin images to C.
+ *
+ * Functions reachable from the plugin_api entry points (and any entry
+ * points given on the command line) are followed through direct branches
+ * and BL calls, and each is emitted as a C function with the
+ * arm_emulator_native_t signature. Backward branches continue in the
+ * interpreter, so that loops observe the instruction budget and timers.
+ * Each straight-line run charges the cycles the interpreter would. The
+ * generated file provides <prefix>_register(), which binds the functions
+ * to an emulator instance, and the <prefix>_functions table for tiered
+ * binding.
+ * Instructions that are not covered, indirect branches and memory faults
+ * leave the translated code and continue in the interpreter.
+ *
+ * Usage: arm_translate [-p prefix] [-a api_address] [-e entry]... image base
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm_decode.h"
+#include "plugin_api.h"
+
+/** Maximum number of translated functions. */
+#define	FUNCTIONS_MAX	1024
+
+enum {
+	INDEX_SP = 13,
+	INDEX_LR = 14,
+	INDEX_PC = 15
+};
+
+static const uint8_t	*_image;
+static uint32_t			_image_address;
+static uint32_t			_image_size;
+static const char		*_prefix = "plugin";
+
+static uint32_t			_functions[FUNCTIONS_MAX];
+static unsigned int		_functions_count;
+
+/* Per-function analysis, indexed by halfword. */
+static uint8_t			*_visited;
+static uint8_t			*_label;
+static uint8_t			*_dead;
+
+/** Clock charge of instructions, see ARM_TRANSLATED_TICKS(). */
+struct charge {
+	unsigned int	instructions;
+	unsigned int	cycles;
+	unsigned int	words;
+};
+
+/* Charge from the instruction being emitted to the end of its run. */
+static struct charge	_rest;
+
+//================================================================================================================
+static int
+_in_image(uint32_t address, uint32_t size)
+{
+	const uint32_t	offset = address - _image_address;
+	return offset < _image_size && offset + size <= _image_size;
+}
+
+//================================================================================================================
+static uint16_t
+_halfword(uint32_t address)
+{
+	const uint32_t	offset = address - _image_address;
+	return _image[offset] | (_image[offset + 1] << 8);
+}
+
+//================================================================================================================
+static uint32_t
+_word(uint32_t address)
+{
+	return _halfword(address) | ((uint32_t)_halfword(address + 2) << 16);
+}
+
+//================================================================================================================
+/** Decode the instruction at address; the kind is INVALID past the image end. */
+static void
+_decode(
+	uint32_t address,
+	uint16_t *instruction,
+	uint16_t *instruction2,
+	struct arm_insn *insn)
+{
+	*instruction = _halfword(address);
+	*instruction2 = 0;
+	if (arm_decode_is_32bit(*instruction))
+	{
+		if (!_in_image(address, 4))
+		{
+			memset(insn, 0, sizeof(*insn));
+			insn->kind = ARM_INSN_INVALID;
+			insn->size = 2;
+			return;
+		}
+		*instruction2 = _halfword(address + 2);
+	}
+	arm_decode(address, *instruction, *instruction2, insn);
+}
+
+//================================================================================================================
+static void
+_add_function(uint32_t address)
+{
+	unsigned int	i;
+	address &= ~(uint32_t)1;
+	if (!_in_image(address, 2))
+	{
+		return;
+	}
+	for (i = 0; i < _functions_count; ++i)
+	{
+		if (_functions[i] == address)
+		{
+			return;
+		}
+	}
+	if (_functions_count < FUNCTIONS_MAX)
+	{
+		_functions[_functions_count++] = address;
+	}
+	else
+	{
+		fprintf(stderr, "arm_translate: too many functions, skipping 0x%08X\n", address);
+	}
+}
+
+//================================================================================================================
+static int
+_is_function(uint32_t address)
+{
+	unsigned int	i;
+	for (i = 0; i < _functions_count; ++i)
+	{
+		if (_functions[i] == address)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//================================================================================================================
+/** Find the instructions reachable from entry, queueing called functions. */
+static void
+_discover(uint32_t entry)
+{
+	uint32_t		*stack = malloc(_image_size * sizeof(uint32_t));
+	unsigned int	stack_count = 0;
+
+	memset(_visited, 0, _image_size / 2);
+	memset(_label, 0, _image_size / 2);
+	stack[stack_count++] = entry;
+	while (stack_count > 0)
+	{
+		uint32_t	address = stack[--stack_count];
+		while (_in_image(address, 2) && !_visited[(address - _image_address) / 2])
+		{
+			uint16_t		instruction;
+			uint16_t		instruction2;
+			struct arm_insn	insn;
+			_decode(address, &instruction, &instruction2, &insn);
+			_visited[(address - _image_address) / 2] = 1;
+			if (insn.kind == ARM_INSN_BRANCH || insn.kind == ARM_INSN_BRANCH_COND)
+			{
+				if (_in_image(insn.target, 2))
+				{
+					// Backward branches leave translated code and need no label.
+					if (insn.target > address)
+					{
+						_label[(insn.target - _image_address) / 2] = 1;
+					}
+					stack[stack_count++] = insn.target;
+				}
+				if (insn.kind == ARM_INSN_BRANCH)
+				{
+					break;
+				}
+			}
+			else if (insn.kind == ARM_INSN_CALL)
+			{
+				_add_function(insn.target);
+			}
+			else if (insn.kind >= ARM_INSN_INDIRECT)
+			{
+				break;
+			}
+			address += insn.size;
+		}
+	}
+	free(stack);
+}
+
+//================================================================================================================
+/** Next visited address after address, 0 if none. */
+static uint32_t
+_next_visited(uint32_t address)
+{
+	for (address += 2; _in_image(address, 2); address += 2)
+	{
+		if (_visited[(address - _image_address) / 2])
+		{
+			return address;
+		}
+	}
+	return 0;
+}
+
+//================================================================================================================
+/**
+ * Mark labels needed by fall-through and compute dead flag writes per
+ * straight-line run. Flags are treated as live at the end of each run.
+ */
+static void
+_analyse(void)
+{
+	uint8_t			written[64];
+	uint8_t			killed[64];
+	uint8_t			read[64];
+	uint32_t		run[64];
+	unsigned int	n = 0;
+	uint32_t		address;
+
+	memset(_dead, 0, _image_size / 2);
+	for (address = _image_address; _in_image(address, 2); address += 2)
+	{
+		uint16_t		instruction;
+		uint16_t		instruction2;
+		struct arm_insn	insn;
+		uint32_t		next;
+		int				end;
+		if (!_visited[(address - _image_address) / 2])
+		{
+			continue;
+		}
+		_decode(address, &instruction, &instruction2, &insn);
+		next = _next_visited(address);
+		if (insn.kind < ARM_INSN_BRANCH || insn.kind == ARM_INSN_BRANCH_COND
+			|| insn.kind == ARM_INSN_CALL || insn.kind == ARM_INSN_CALL_INDIRECT)
+		{
+			// Falls through: jump if the next instruction is not emitted next.
+			if (next != address + insn.size && _in_image(address + insn.size, 2)
+				&& _visited[(address + insn.size - _image_address) / 2])
+			{
+				_label[(address + insn.size - _image_address) / 2] = 1;
+			}
+		}
+		written[n] = insn.flags_written;
+		killed[n] = insn.flags_killed;
+		// Memory faults continue in the interpreter with exact flags.
+		read[n] = insn.access ? ARM_FLAGS_ALL : insn.flags_read;
+		run[n] = address;
+		++n;
+		end = insn.kind >= ARM_INSN_BRANCH || next != address + insn.size || n == 64
+			|| (next != 0 && _label[(next - _image_address) / 2]);
+		if (end)
+		{
+			uint8_t	live = ARM_FLAGS_ALL;
+			int		i;
+			for (i = (int)n - 1; i >= 0; --i)
+			{
+				if (written[i] != 0 && (written[i] & live) == 0)
+				{
+					_dead[(run[i] - _image_address) / 2] = 1;
+				}
+				live = (live & ~killed[i]) | read[i];
+			}
+			n = 0;
+		}
+	}
+}
+
+//================================================================================================================
+static void
+_emit_exit(FILE *out, uint32_t address)
+{
+	fprintf(out, "\tARM_TRANSLATED_EXIT(0x%08Xu);\n", address);
+}
+
+//================================================================================================================
+/** Leave before the instruction at address, see ARM_TRANSLATED_STOP(). */
+static const char *
+_stop(uint32_t address)
+{
+	static char	text[96];
+	snprintf(text, sizeof(text), "ARM_TRANSLATED_STOP(0x%08Xu, %u, %u, %u)",
+		address, _rest.instructions, _rest.cycles, _rest.words);
+	return text;
+}
+
+//================================================================================================================
+static void
+_emit_stop(FILE *out, uint32_t address)
+{
+	fprintf(out, "\t%s;\n", _stop(address));
+}
+
+//================================================================================================================
+/* Backward branches leave translated code, so loops run under the interpreter's budget and timers. */
+static void
+_emit_goto(FILE *out, uint32_t address, uint32_t target)
+{
+	if (target > address && _in_image(target, 2) && _visited[(target - _image_address) / 2])
+	{
+		fprintf(out, "\tgoto L_%08X;\n", target);
+	}
+	else
+	{
+		_emit_exit(out, target | 1);
+	}
+}
+
+//================================================================================================================
+/** Emit a flag-setting x1 + x2 + carry into Rd, or discard the result if Rd is negative. */
+static void
+_emit_add(FILE *out, int live, int Rd, const char *x1, const char *x2, const char *carry)
+{
+	if (live)
+	{
+		if (Rd >= 0)
+		{
+			fprintf(out, "\tR[%d] = arm_translated_add(emu, %s, %s, %s);\n", Rd, x1, x2, carry);
+		}
+		else
+		{
+			fprintf(out, "\t(void)arm_translated_add(emu, %s, %s, %s);\n", x1, x2, carry);
+		}
+	}
+	else if (Rd >= 0)
+	{
+		fprintf(out, "\tR[%d] = %s + %s + %s;\n", Rd, x1, x2, carry);
+	}
+}
+
+//================================================================================================================
+static void
+_emit_shift(FILE *out, int live, const char *op, int Rd, const char *x, const char *n)
+{
+	if (live)
+	{
+		fprintf(out, "\tR[%d] = arm_translated_%s(emu, %s, %s);\n", Rd, op, x, n);
+	}
+	else
+	{
+		fprintf(out, "\tR[%d] = arm_translated_%s_value(%s, %s);\n", Rd, op, x, n);
+	}
+}
+
+//================================================================================================================
+static void
+_emit_logical(FILE *out, int live, int Rd, const char *expression)
+{
+	fprintf(out, "\tR[%d] = %s;\n", Rd, expression);
+	if (live)
+	{
+		fprintf(out, "\tarm_translated_nzc(emu, R[%d], 0);\n", Rd);
+	}
+}
+
+//================================================================================================================
+static void
+_emit_load(FILE *out, uint32_t address, int Rt, const char *addr, unsigned int size, int sign_bits)
+{
+	fprintf(out, "\tif (arm_translated_load(emu, &R[%d], %s, %u) != 0) %s;\n",
+		Rt, addr, size, _stop(address));
+	if (sign_bits == 8)
+	{
+		fprintf(out, "\tR[%d] = (uint32_t)(int32_t)(int8_t)R[%d];\n", Rt, Rt);
+	}
+	else if (sign_bits == 16)
+	{
+		fprintf(out, "\tR[%d] = (uint32_t)(int32_t)(int16_t)R[%d];\n", Rt, Rt);
+	}
+}
+
+//================================================================================================================
+static void
+_emit_store(FILE *out, uint32_t address, int Rt, const char *addr, unsigned int size)
+{
+	fprintf(out, "\tif (arm_translated_store(emu, %s, R[%d], %u) != 0) %s;\n",
+		addr, Rt, size, _stop(address));
+}
+
+//================================================================================================================
+/**
+ * Emit a load of the registers in list from base, all or nothing.
+ * A loaded PC goes to LR. Rn, if not negative, is set to base + 4*n.
+ */
+static void
+_emit_load_multiple(FILE *out, uint32_t address, int Rn_base, uint16_t list, int Rn_writeback)
+{
+	int		i;
+	int		k = 0;
+	fprintf(out, "\t{\n\t\tconst uint32_t b = R[%d];\n\t\tuint32_t w[9];\n\t\tif (0", Rn_base);
+	for (i = 0; i < 16; ++i)
+	{
+		if (list & (1 << i))
+		{
+			fprintf(out, "\n\t\t\t|| arm_translated_load(emu, &w[%d], b + %du, 4) != 0", k, 4 * k);
+			++k;
+		}
+	}
+	fprintf(out, ")\n\t\t{\n\t\t\t%s;\n\t\t}\n", _stop(address));
+	k = 0;
+	for (i = 0; i < 16; ++i)
+	{
+		if (list & (1 << i))
+		{
+			fprintf(out, "\t\tR[%d] = w[%d];\n", i == INDEX_PC ? INDEX_LR : i, k++);
+		}
+	}
+	if (Rn_writeback >= 0)
+	{
+		fprintf(out, "\t\tR[%d] = b + %du;\n", Rn_writeback, 4 * k);
+	}
+	fprintf(out, "\t}\n");
+}
+
+//================================================================================================================
+/** Emit a store of the registers in list to base upwards. */
+static void
+_emit_store_multiple(FILE *out, uint32_t address, const char *base, uint16_t list)
+{
+	int		i;
+	int		k = 0;
+	fprintf(out, "\tif (0");
+	for (i = 0; i < 15; ++i)
+	{
+		if (list & (1 << i))
+		{
+			fprintf(out, "\n\t\t|| arm_translated_store(emu, %s + %d, R[%d], 4) != 0", base, 4 * k, i);
+			++k;
+		}
+	}
+	fprintf(out, ")\n\t{\n\t\t%s;\n\t}\n", _stop(address));
+}
+
+//================================================================================================================
+static int
+_bit_count(uint16_t x)
+{
+	int	n = 0;
+	for (; x != 0; x &= x - 1)
+	{
+		++n;
+	}
+	return n;
+}
+
+//================================================================================================================
+/**
+ * Emit one instruction, following the decoding in arm_emulator_execute().
+ * @return Non-zero if control may fall through to the next instruction.
+ */
+static int
+_emit_instruction(FILE *out, uint32_t address, uint16_t instruction, uint16_t instruction2, int live)
+{
+	const uint8_t	i_l = (uint8_t)instruction;
+	const uint8_t	i_h = (uint8_t)(instruction >> 8);
+	const uint8_t	opcode = i_h & 0xFC;
+	const uint8_t	opcode2bits = i_h & 0xC0;
+	const uint8_t	opcode3bits = i_h & 0xE0;
+	const uint8_t	opcode4bits = i_h & 0xF0;
+	const uint8_t	opcode5bits = i_h & 0xF8;
+	const uint32_t	next = address + 2;
+	char			a[64];
+	char			b[64];
+
+	if (opcode2bits==0)
+	{
+		// Shift (immediate), add, subtract, move, and compare.
+		const uint8_t	scode = i_h & 0x3E;
+		const uint8_t	scode3bits = i_h & 0x38;
+		const int		Rdn = instruction & 0x07;
+		const int		Rm = (instruction >> 3) & 0x07;
+		const int		Rm2 = (instruction >> 6) & 0x07;
+		const int		imm5 = (instruction >> 6) & 0x1F;
+		const int		imm3 = (instruction >> 6) & 0x07;
+		const int		Rd2 = (instruction >> 8) & 0x07;
+		snprintf(a, sizeof(a), "R[%d]", Rm);
+		if (scode3bits==0x00)
+		{
+			snprintf(b, sizeof(b), "%d", imm5);
+			_emit_shift(out, live, "lsl", Rdn, a, b);
+		}
+		else if (scode3bits==0x08 || scode3bits==0x10)
+		{
+			snprintf(b, sizeof(b), "%d", imm5 == 0 ? 32 : imm5);
+			_emit_shift(out, live, scode3bits==0x08 ? "lsr" : "asr", Rdn, a, b);
+		}
+		else if (scode==0x18 || scode==0x1A)
+		{
+			snprintf(b, sizeof(b), scode==0x18 ? "R[%d]" : "~R[%d]", Rm2);
+			_emit_add(out, live, Rdn, a, b, scode==0x18 ? "0" : "1");
+		}
+		else if (scode==0x1C || scode==0x1E)
+		{
+			snprintf(b, sizeof(b), scode==0x1C ? "%du" : "~%du", imm3);
+			_emit_add(out, live, Rdn, a, b, scode==0x1C ? "0" : "1");
+		}
+		else if (scode3bits==0x20)
+		{
+			fprintf(out, "\tR[%d] = %uu;\n", Rd2, i_l);
+			if (live)
+			{
+				fprintf(out, "\tarm_translated_nz(emu, R[%d]);\n", Rd2);
+			}
+		}
+		else
+		{
+			snprintf(a, sizeof(a), "R[%d]", Rd2);
+			snprintf(b, sizeof(b), scode3bits==0x30 ? "%uu" : "~%uu", i_l);
+			_emit_add(out, live, scode3bits==0x28 ? -1 : Rd2, a, b, scode3bits==0x30 ? "0" : "1");
+		}
+		return 1;
+	}
+	else if (opcode==0x40)
+	{
+		// Data processing.
+		const int	Rdn = i_l & 0x07;
+		const int	Rm = (i_l >> 3) & 0x07;
+		snprintf(a, sizeof(a), "R[%d]", Rdn);
+		switch ((instruction >> 2) & 0xF0)
+		{
+		case 0x00:
+			snprintf(b, sizeof(b), "R[%d] & R[%d]", Rdn, Rm);
+			_emit_logical(out, live, Rdn, b);
+			break;
+		case 0x10:
+			snprintf(b, sizeof(b), "R[%d] ^ R[%d]", Rdn, Rm);
+			_emit_logical(out, live, Rdn, b);
+			break;
+		case 0x20:
+		case 0x30:
+		case 0x40:
+		case 0x70:
+			{
+				static const char	*ops[8] = { NULL, NULL, "lsl", "lsr", "asr", NULL, NULL, "ror" };
+				snprintf(b, sizeof(b), "R[%d] & 0xFF", Rm);
+				_emit_shift(out, live, ops[(instruction >> 6) & 0x07], Rdn, a, b);
+			}
+			break;
+		case 0x50:
+			snprintf(b, sizeof(b), "R[%d]", Rm);
+			_emit_add(out, live, Rdn, a, b, "arm_translated_carry(emu)");
+			break;
+		case 0x60:
+			snprintf(b, sizeof(b), "~R[%d]", Rm);
+			_emit_add(out, live, Rdn, a, b, "arm_translated_carry(emu)");
+			break;
+		case 0x80:
+			if (live)
+			{
+				fprintf(out, "\tarm_translated_nzc(emu, R[%d] & R[%d], 0);\n", Rdn, Rm);
+			}
+			break;
+		case 0x90:
+			snprintf(a, sizeof(a), "~R[%d]", Rm);
+			_emit_add(out, live, Rdn, a, "0u", "1");
+			break;
+		case 0xA0:
+			snprintf(b, sizeof(b), "~R[%d]", Rm);
+			_emit_add(out, live, -1, a, b, "1");
+			break;
+		case 0xB0:
+			snprintf(b, sizeof(b), "R[%d]", Rm);
+			_emit_add(out, live, -1, a, b, "0");
+			break;
+		case 0xC0:
+			snprintf(b, sizeof(b), "R[%d] | R[%d]", Rdn, Rm);
+			_emit_logical(out, live, Rdn, b);
+			break;
+		case 0xD0:
+			fprintf(out, "\tR[%d] = R[%d] * R[%d];\n", Rdn, Rdn, Rm);
+			if (live)
+			{
+				fprintf(out, "\tarm_translated_nz(emu, R[%d]);\n", Rdn);
+			}
+			break;
+		case 0xE0:
+			snprintf(b, sizeof(b), "R[%d] & ~R[%d]", Rdn, Rm);
+			_emit_logical(out, live, Rdn, b);
+			break;
+		default:
+			snprintf(b, sizeof(b), "~R[%d]", Rm);
+			_emit_logical(out, live, Rdn, b);
+			break;
+		}
+		return 1;
+	}
+	else if (opcode==0x44)
+	{
+		// Special data instructions and branch and exchange
+		const uint8_t	scode =  (instruction >> 2) & 0xF0;
+		const uint8_t	scode2bits = scode & 0xC0;
+		const uint8_t	scode3bits = scode & 0xE0;
+		const int		Rdn = ((i_l >> 4) & 0x08) | (i_l & 0x07);
+		const int		Rm = (i_l >> 3) & 0x0F;
+		if (Rm == INDEX_PC || (Rdn == INDEX_PC && scode2bits != 0x80 && scode3bits < 0xC0))
+		{
+			// PC as an operand: leave it to the interpreter.
+			_emit_stop(out, address);
+			return 0;
+		}
+		snprintf(a, sizeof(a), "R[%d]", Rdn);
+		snprintf(b, sizeof(b), "R[%d]", Rm);
+		if (scode2bits==0x00)
+		{
+			// ADD (registers); flags are kept for SP.
+			if (Rdn == INDEX_SP)
+			{
+				fprintf(out, "\tR[13] = R[13] + R[%d];\n", Rm);
+			}
+			else
+			{
+				_emit_add(out, live, Rdn, a, b, "0");
+			}
+			return 1;
+		}
+		else if ((scode==0x50) || (scode3bits==0x60))
+		{
+			snprintf(b, sizeof(b), "~R[%d]", Rm);
+			_emit_add(out, live, -1, a, b, "1");
+			return 1;
+		}
+		else if (scode2bits==0x80)
+		{
+			if (Rdn == INDEX_PC)
+			{
+				if (Rm == INDEX_LR)
+				{
+					fprintf(out, "\treturn 0;\n");
+				}
+				else
+				{
+					fprintf(out, "\tARM_TRANSLATED_EXIT(R[%d]);\n", Rm);
+				}
+				return 0;
+			}
+			fprintf(out, "\tR[%d] = R[%d];\n", Rdn, Rm);
+			return 1;
+		}
+		else if (scode3bits==0xC0)
+		{
+			// BX
+			if (Rm == INDEX_LR)
+			{
+				fprintf(out, "\treturn 0;\n");
+			}
+			else
+			{
+				fprintf(out, "\tARM_TRANSLATED_EXIT(R[%d]);\n", Rm);
+			}
+			return 0;
+		}
+		else if (scode3bits==0xE0)
+		{
+			// BLX
+			fprintf(out, "\t{\n\t\tconst uint32_t target = R[%d];\n", Rm);
+			fprintf(out, "\t\tR[14] = 0x%08Xu;\n", next | 1);
+			fprintf(out, "\t\tARM_TRANSLATED_CALL(arm_emulator_call_native(emu, target), target, 0x%08Xu);\n", next | 1);
+			fprintf(out, "\t}\n");
+			return 1;
+		}
+		_emit_stop(out, address);
+		return 0;
+	}
+	else if (opcode5bits==0x48)
+	{
+		// Load from Literal Pool (LDR). Program memory is read-only.
+		const int		Rt = (instruction >> 8) & 0x07;
+		const uint32_t	literal = ((address + 4) & ~(uint32_t)3) + i_l*4;
+		if (_in_image(literal, 4))
+		{
+			fprintf(out, "\tR[%d] = 0x%08Xu;\n", Rt, _word(literal));
+		}
+		else
+		{
+			snprintf(a, sizeof(a), "0x%08Xu", literal);
+			_emit_load(out, address, Rt, a, 4, 0);
+		}
+		return 1;
+	}
+	else if (opcode4bits==0x50)
+	{
+		// Load/store single data item, register offset.
+		const int	Rt = instruction & 0x07;
+		const int	Rn = (instruction >> 3) & 0x07;
+		const int	Rm = (instruction >> 6) & 0x07;
+		snprintf(a, sizeof(a), "R[%d] + R[%d]", Rn, Rm);
+		switch (i_h & 0xFE)
+		{
+		case 0x50: _emit_store(out, address, Rt, a, 4); break;
+		case 0x52: _emit_store(out, address, Rt, a, 2); break;
+		case 0x54: _emit_store(out, address, Rt, a, 1); break;
+		case 0x56: _emit_load(out, address, Rt, a, 1, 8); break;
+		case 0x58: _emit_load(out, address, Rt, a, 4, 0); break;
+		case 0x5A: _emit_load(out, address, Rt, a, 2, 0); break;
+		case 0x5C: _emit_load(out, address, Rt, a, 1, 0); break;
+		default: _emit_load(out, address, Rt, a, 2, 16); break;
+		}
+		return 1;
+	}
+	else if (opcode3bits==0x60 || opcode3bits==0x80)
+	{
+		// Load/store single data item, immediate offset.
+		const uint8_t	scode5bits = i_h & 0xF8;
+		const int		Rt = instruction & 0x07;
+		const int		Rn = (instruction >> 3) & 0x07;
+		const int		Rt2 = (instruction >> 8) & 0x07;
+		const int		imm5 = (instruction >> 6) & 0x1F;
+		switch (scode5bits)
+		{
+		case 0x60:
+		case 0x68:
+			snprintf(a, sizeof(a), "R[%d] + %du", Rn, imm5*4);
+			if (scode5bits == 0x60) _emit_store(out, address, Rt, a, 4); else _emit_load(out, address, Rt, a, 4, 0);
+			break;
+		case 0x70:
+		case 0x78:
+			snprintf(a, sizeof(a), "R[%d] + %du", Rn, imm5);
+			if (scode5bits == 0x70) _emit_store(out, address, Rt, a, 1); else _emit_load(out, address, Rt, a, 1, 0);
+			break;
+		case 0x80:
+		case 0x88:
+			snprintf(a, sizeof(a), "R[%d] + %du", Rn, imm5*2);
+			if (scode5bits == 0x80) _emit_store(out, address, Rt, a, 2); else _emit_load(out, address, Rt, a, 2, 0);
+			break;
+		default:
+			snprintf(a, sizeof(a), "R[13] + %du", i_l*4);
+			if (scode5bits == 0x90) _emit_store(out, address, Rt2, a, 4); else _emit_load(out, address, Rt2, a, 4, 0);
+			break;
+		}
+		return 1;
+	}
+	else if (opcode5bits==0xA0)
+	{
+		// ADR
+		fprintf(out, "\tR[%d] = 0x%08Xu;\n", i_h & 0x07, ((address + 4) & ~(uint32_t)3) + 4*i_l);
+		return 1;
+	}
+	else if (opcode5bits==0xA8)
+	{
+		// ADD (SP plus immediate)
+		fprintf(out, "\tR[%d] = R[13] + %uu;\n", i_h & 0x07, 4*i_l);
+		return 1;
+	}
+	else if (opcode4bits==0xB0)
+	{
+		// Miscellaneous 16-bit instructions.
+		const uint8_t	scode = instruction >> 4 & 0xFE;
+		const uint8_t	scode3bits = scode & 0xE0;
+		const uint8_t	scode4bits = scode & 0xF0;
+		const uint8_t	scode5bits = scode & 0xF8;
+		const uint8_t	scode6bits = scode & 0xFC;
+		const int		imm7 = instruction & 0x7F;
+		const int		Rd = instruction & 0x07;
+		const int		Rm = (instruction >> 3) & 0x07;
+		if (scode5bits==0x00 || scode5bits==0x08)
+		{
+			fprintf(out, "\tR[13] = R[13] %c %du;\n", scode5bits==0x00 ? '+' : '-', 4*imm7);
+		}
+		else if (scode6bits==0x20)
+		{
+			fprintf(out, "\tR[%d] = (uint32_t)(int32_t)(int16_t)R[%d];\n", Rd, Rm);
+		}
+		else if (scode6bits==0x24)
+		{
+			fprintf(out, "\tR[%d] = (uint32_t)(int32_t)(int8_t)R[%d];\n", Rd, Rm);
+		}
+		else if (scode6bits==0x28)
+		{
+			fprintf(out, "\tR[%d] = (uint16_t)R[%d];\n", Rd, Rm);
+		}
+		else if (scode6bits==0x2C)
+		{
+			fprintf(out, "\tR[%d] = (uint8_t)R[%d];\n", Rd, Rm);
+		}
+		else if (scode3bits==0x40)
+		{
+			// PUSH
+			const uint16_t	list = ((i_h & 1) << INDEX_LR) | i_l;
+			const int		n = _bit_count(list);
+			snprintf(a, sizeof(a), "R[13] - %du", 4*n);
+			_emit_store_multiple(out, address, a, list);
+			fprintf(out, "\tR[13] -= %du;\n", 4*n);
+		}
+		else if (scode==0x66 && (i_l & 0x10))
+		{
+			// CPSID i
+			fprintf(out, "\temu->primask = 1;\n");
+		}
+		else if (scode4bits==0xE0)
+		{
+			// BKPT: nothing to do.
+		}
+		else if (scode6bits==0xA0)
+		{
+			fprintf(out, "\t{\n\t\tconst uint32_t x = R[%d];\n", Rm);
+			fprintf(out, "\t\tR[%d] = (x << 24) | ((x << 8) & 0x00FF0000u) | ((x >> 8) & 0x0000FF00u) | (x >> 24);\n\t}\n", Rd);
+		}
+		else if (scode6bits==0xA4)
+		{
+			fprintf(out, "\t{\n\t\tconst uint32_t x = R[%d];\n", Rm);
+			fprintf(out, "\t\tR[%d] = ((x << 8) & 0xFF00FF00u) | ((x >> 8) & 0x00FF00FFu);\n\t}\n", Rd);
+		}
+		else if (scode6bits==0xAC)
+		{
+			fprintf(out, "\t{\n\t\tconst uint32_t x = R[%d];\n", Rm);
+			fprintf(out, "\t\tR[%d] = ((uint32_t)(int32_t)(int8_t)x << 8) | ((x >> 8) & 0xFFu);\n\t}\n", Rd);
+		}
+		else if (scode3bits==0xC0)
+		{
+			// POP; a popped PC is returned through LR.
+			const uint16_t	list = ((i_h & 1) << INDEX_PC) | i_l;
+			_emit_load_multiple(out, address, INDEX_SP, list, INDEX_SP);
+			if (i_h & 1)
+			{
+				fprintf(out, "\treturn 0;\n");
+				return 0;
+			}
+		}
+		else if (scode4bits==0xF0 && (i_l == 0x00 || i_l == 0x10))
+		{
+			// NOP, YIELD
+		}
+		else if (scode4bits==0xF0 && i_l == 0x40)
+		{
+			// SEV
+			fprintf(out, "\temu->event = 1;\n");
+		}
+		else
+		{
+			_emit_stop(out, address);
+			return 0;
+		}
+		return 1;
+	}
+	else if (opcode5bits==0xC0)
+	{
+		// STM
+		const int	Rn = i_h & 0x07;
+		snprintf(a, sizeof(a), "R[%d]", Rn);
+		_emit_store_multiple(out, address, a, i_l);
+		fprintf(out, "\tR[%d] += %du;\n", Rn, 4*_bit_count(i_l));
+		return 1;
+	}
+	else if (opcode5bits==0xC8)
+	{
+		// LDM, writeback unless Rn is in the list.
+		const int	Rn = i_h & 0x07;
+		_emit_load_multiple(out, address, Rn, i_l, (i_l & (1 << Rn)) ? -1 : Rn);
+		return 1;
+	}
+	else if (opcode4bits==0xD0 && (i_h & 0x0F) < 0x0E)
+	{
+		// B<cond>
+		struct arm_insn	insn;
+		arm_decode(address, instruction, instruction2, &insn);
+		fprintf(out, "\tif (arm_translated_condition(emu, %u))\n\t{\n", i_h & 0x0F);
+		fprintf(out, "\t\tARM_TRANSLATED_TICKS(0x%08Xu, 0, 2, 0);\n\t", address);
+		_emit_goto(out, address, insn.target);
+		fprintf(out, "\t}\n");
+		return 1;
+	}
+	else if (opcode4bits==0xD0 && (i_h & 0x0F) == 0x0F)
+	{
+		// SVC; a handler returning non-zero leaves translated code.
+		fprintf(out, "\tR[15] = 0x%08Xu;\n", address + 2);
+		fprintf(out, "\t{\n\t\tconst int r_ = arm_emulator_call_svc(emu, %u);\n", i_l);
+		fprintf(out, "\t\tif (r_ < 0)\n\t\t{\n\t\t\t%s;\n\t\t}\n", _stop(address));
+		fprintf(out, "\t\tif (r_ > 0)\n\t\t{\n\t\t\tARM_TRANSLATED_TICKS(0x%08Xu, 0, 2, 0);\n", address);
+		fprintf(out, "\t\t\treturn 1;\n\t\t}\n\t}\n");
+		return 1;
+	}
+	else if (opcode5bits==0xE0)
+	{
+		// B
+		struct arm_insn	insn;
+		arm_decode(address, instruction, instruction2, &insn);
+		_emit_goto(out, address, insn.target);
+		return 0;
+	}
+	else if (arm_decode_is_32bit(instruction))
+	{
+		struct arm_insn	insn;
+		arm_decode(address, instruction, instruction2, &insn);
+		if (insn.kind == ARM_INSN_CALL)
+		{
+			const uint32_t	return_address = (address + 4) | 1;
+			fprintf(out, "\tR[14] = 0x%08Xu;\n", return_address);
+			if (_is_function(insn.target))
+			{
+				fprintf(out, "\tARM_TRANSLATED_CALL(%s_%08X(emu), 0x%08Xu, 0x%08Xu);\n",
+					_prefix, insn.target, insn.target, return_address);
+			}
+			else
+			{
+				fprintf(out, "\tARM_TRANSLATED_CALL(arm_emulator_call_native(emu, 0x%08Xu), 0x%08Xu, 0x%08Xu);\n",
+					insn.target, insn.target, return_address);
+			}
+			return 1;
+		}
+		else if (insn.kind == ARM_INSN_NORMAL)
+		{
+			if (insn.flags_written != 0)
+			{
+				// MSR APSR, Rn
+				fprintf(out, "\temu->APSR = R[%d] & 0xF8000000u;\n", instruction & 0x0F);
+			}
+			else if (insn.flags_read != 0)
+			{
+				// MRS Rd, APSR
+				fprintf(out, "\tR[%d] = emu->APSR;\n", (instruction2 >> 8) & 0x0F);
+			}
+			return 1;
+		}
+	}
+	_emit_stop(out, address);
+	return 0;
+}
+
+//================================================================================================================
+/**
+ * Charge of one instruction, as arm_emulator_execute() charges it. A taken
+ * conditional branch adds 2 cycles when it is taken.
+ */
+static void
+_add_charge(struct charge *c, uint32_t address, uint16_t instruction, const struct arm_insn *insn)
+{
+	c->instructions += 1;
+	c->cycles += arm_decode_cycles[instruction >> 11];
+	c->words += (address & 2) == 0;
+	if (insn->kind == ARM_INSN_LOAD_LITERAL)
+	{
+		c->words += 1;
+	}
+	if ((instruction & 0xFE00) == 0xB400)
+	{
+		// PUSH: 1+N.
+		c->cycles += _bit_count(instruction & 0x1FF);
+	}
+	else if ((instruction & 0xF000) == 0xC000)
+	{
+		// STM, LDM: 1+N.
+		c->cycles += _bit_count(instruction & 0xFF);
+	}
+	else if ((instruction & 0xFE00) == 0xBC00)
+	{
+		// POP: 1+N, 4+N with PC.
+		c->cycles += _bit_count(instruction & 0x1FF) + 2*((instruction >> 8) & 1);
+	}
+	else if (insn->kind == ARM_INSN_BRANCH
+		|| ((instruction & 0xFC00) == 0x4400 && insn->kind >= ARM_INSN_CALL_INDIRECT && insn->kind <= ARM_INSN_RETURN))
+	{
+		// B, and BX, BLX, MOV PC, ADD PC.
+		c->cycles += 2;
+	}
+}
+
+//================================================================================================================
+/* Charge from address to the end of its straight-line run. */
+static struct charge
+_run_charge(uint32_t address)
+{
+	struct charge	c = { 0, 0, 0 };
+	for (;;)
+	{
+		uint16_t		instruction;
+		uint16_t		instruction2;
+		struct arm_insn	insn;
+		uint32_t		next;
+		_decode(address, &instruction, &instruction2, &insn);
+		_add_charge(&c, address, instruction, &insn);
+		next = _next_visited(address);
+		if (insn.kind >= ARM_INSN_BRANCH || next != address + insn.size || _label[(next - _image_address) / 2])
+		{
+			return c;
+		}
+		address = next;
+	}
+}
+
+//================================================================================================================
+static void
+_emit_function(FILE *out, uint32_t entry)
+{
+	uint32_t	address;
+	int			run_start = 1;
+
+	_discover(entry);
+	for (address = _image_address; !_visited[(address - _image_address) / 2]; address += 2)
+	{
+	}
+	if (address != entry)
+	{
+		// Code before the entry point is reachable only through labels.
+		_label[(entry - _image_address) / 2] = 1;
+	}
+	_analyse();
+	fprintf(out, "//================================================================================================================\n");
+	fprintf(out, "static int\n%s_%08X(struct arm_emulator_state *emu)\n{\n", _prefix, entry);
+	fprintf(out, "\tuint32_t *const R = emu->R;\n\t(void)R;\n");
+	if (address != entry)
+	{
+		fprintf(out, "\tgoto L_%08X;\n", entry);
+	}
+	for (address = _image_address; _in_image(address, 2); address += 2)
+	{
+		uint16_t		instruction;
+		uint16_t		instruction2;
+		struct arm_insn	insn;
+		const unsigned int	index = (address - _image_address) / 2;
+		if (!_visited[index])
+		{
+			continue;
+		}
+		_decode(address, &instruction, &instruction2, &insn);
+		if (_label[index])
+		{
+			fprintf(out, "L_%08X:\n", address);
+			run_start = 1;
+		}
+		_rest = _run_charge(address);
+		if (run_start)
+		{
+			fprintf(out, "\tARM_TRANSLATED_TICKS(0x%08Xu, %u, %u, %u);\n",
+				address, _rest.instructions, _rest.cycles, _rest.words);
+		}
+		run_start = insn.kind >= ARM_INSN_BRANCH || _next_visited(address) != address + insn.size;
+		if (insn.size == 4)
+		{
+			fprintf(out, "\t/* %08X: %04X %04X */\n", address, instruction, instruction2);
+		}
+		else
+		{
+			fprintf(out, "\t/* %08X: %04X */\n", address, instruction);
+		}
+		if (insn.kind == ARM_INSN_INVALID)
+		{
+			_emit_stop(out, address);
+		}
+		else if (_emit_instruction(out, address, instruction, instruction2, !_dead[index]))
+		{
+			const uint32_t	next = address + insn.size;
+			if (_next_visited(address) != next)
+			{
+				_emit_goto(out, address, next);
+			}
+		}
+	}
+	fprintf(out, "}\n\n");
+}
+
+//================================================================================================================
+static int
+_usage(void)
+{
+	fprintf(stderr,
+		"Usage: arm_translate [-p prefix] [-a api_address] [-e entry]... image base_address\n"
+		"Translates the functions of a plugin image to C, writing to standard output.\n"
+		"  -p prefix       Symbol prefix, default \"plugin\".\n"
+		"  -a api_address  Address of struct plugin_api, default 0x%X; 0 for none.\n"
+		"  -e entry        Additional entry point.\n",
+		PLUGIN_API_ADDRESS);
+	return 1;
+}
+
+//================================================================================================================
+int
+main(int argc, char **argv)
+{
+	uint32_t		api_address = PLUGIN_API_ADDRESS;
+	uint32_t		entries[FUNCTIONS_MAX];
+	unsigned int	entries_count = 0;
+	const char		*filename = NULL;
+	FILE			*f;
+	uint8_t			*image;
+	long			size;
+	unsigned int	i;
+	int				argi;
+
+	for (argi = 1; argi < argc && argv[argi][0] == '-'; argi += 2)
+	{
+		if (argi + 1 >= argc)
+		{
+			return _usage();
+		}
+		switch (argv[argi][1])
+		{
+		case 'p': _prefix = argv[argi + 1]; break;
+		case 'a': api_address = strtoul(argv[argi + 1], NULL, 0); break;
+		case 'e':
+			if (entries_count < FUNCTIONS_MAX)
+			{
+				entries[entries_count++] = strtoul(argv[argi + 1], NULL, 0);
+			}
+			break;
+		default: return _usage();
+		}
+	}
+	if (argi + 2 != argc)
+	{
+		return _usage();
+	}
+	filename = argv[argi];
+	_image_address = strtoul(argv[argi + 1], NULL, 0) & ~(uint32_t)1;
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		fprintf(stderr, "arm_translate: cannot open %s\n", filename);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	image = malloc(size + 2);
+	if (image == NULL || fread(image, 1, size, f) != (size_t)size)
+	{
+		fprintf(stderr, "arm_translate: cannot read %s\n", filename);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+	_image = image;
+	_image_size = (uint32_t)size & ~(uint32_t)1;
+	_visited = malloc(_image_size / 2 + 1);
+	_label = malloc(_image_size / 2 + 1);
+	_dead = malloc(_image_size / 2 + 1);
+
+	// Entry points: plugin_api functions, then the command line.
+	if (api_address != 0 && _in_image(api_address, sizeof(struct plugin_api)))
+	{
+		const unsigned int	count = _halfword(api_address + 2);
+		const uint32_t		table = api_address + offsetof(struct plugin_api, Init);
+		for (i = 0; i < count && _in_image(table + 4*i, 4); ++i)
+		{
+			_add_function(_word(table + 4*i));
+		}
+	}
+	for (i = 0; i < entries_count; ++i)
+	{
+		_add_function(entries[i]);
+	}
+	if (_functions_count == 0)
+	{
+		fprintf(stderr, "arm_translate: no entry points in the image\n");
+		return 1;
+	}
+
+	// Discovery appends callees; run it to a fixed point before emitting.
+	for (i = 0; i < _functions_count; ++i)
+	{
+		_discover(_functions[i]);
+	}
+
+	printf("/* Generated by arm_translate from %s. Do not edit. */\n", filename);
+	printf("#include \"arm_translated.h\"\n\n");
+	for (i = 0; i < _functions_count; ++i)
+	{
+		printf("static int %s_%08X(struct arm_emulator_state *emu);\n", _prefix, _functions[i]);
+	}
+	printf("\n");
+	for (i = 0; i < _functions_count; ++i)
+	{
+		_emit_function(stdout, _functions[i]);
+	}
+
+	printf("/** Translated functions, entry points first, for arm_emulator_set_translations(). */\n");
+	printf("const struct arm_emulator_native_function %s_functions[] = {\n", _prefix);
+	for (i = 0; i < _functions_count; ++i)
+	{
+		printf("\t{ 0x%08Xu, %s_%08X },\n", _functions[i], _prefix, _functions[i]);
+	}
+	printf("};\n");
+	printf("const unsigned int %s_functions_count = %u;\n\n", _prefix, _functions_count);
+
+	printf("//================================================================================================================\n");
+	printf("/**\n * Bind the translated functions, entry points first.\n");
+	printf(" * @return Number of functions bound; the rest stay interpreted.\n */\n");
+	printf("int\n%s_register(struct arm_emulator_state *emu)\n{\n", _prefix);
+	printf("\tunsigned int i;\n");
+	printf("\tfor (i = 0; i < %s_functions_count; ++i)\n\t{\n", _prefix);
+	printf("\t\tif (arm_emulator_register_native(emu, %s_functions[i].address, %s_functions[i].function) != 0)\n\t\t{\n", _prefix, _prefix);
+	printf("\t\t\tbreak;\n\t\t}\n\t}\n\treturn (int)i;\n}\n");
+
+	free(_visited);
+	free(_label);
+	free(_dead);
+	free(image);
+	return 0;
+}